@@ -0,0 +1,407 @@
+// SPDX-License-Identifier: MIT
+#ifndef BASE64_H_16_10_2026
+#define BASE64_H_16_10_2026
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BASE64_X86 1
+#endif
+
+// Base64 encoder and decoder for the standard alphabet. The encoder writes its
+// output without line breaks. Like libb64, the decoder skips every character
+// that is not part of the alphabet, padding included. On x86 the bulk of the
+// work is done with SSSE3 or AVX2 when the CPU supports it.
+
+constexpr size_t base64_encoded_size(size_t len) {
+    return (len + 2) / 3 * 4;
+}
+
+constexpr size_t base64_decoded_size(size_t len) {
+    return (len + 3) / 4 * 3;
+}
+
+namespace base64_detail {
+    static constexpr const char *alphabet{
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"
+    };
+
+    static constexpr struct sextet_table_type {
+        constexpr sextet_table_type() : value{} {
+            for (size_t i=0; i<256; ++i) {
+                value[i] = -1;
+            }
+
+            for (size_t i=0; i<64; ++i) {
+                value[(unsigned char) alphabet[i]] = int8_t(i);
+            }
+        }
+
+        int8_t value[256];
+    } sextets{};
+
+    inline size_t encode_scalar(
+        const unsigned char *src, size_t len, char *dst
+    ) {
+        char *start = dst;
+
+        for (; len >= 3; len -= 3, src += 3) {
+            uint32_t v{
+                uint32_t(src[0]) << 16 | uint32_t(src[1]) << 8 | src[2]
+            };
+
+            *dst++ = alphabet[(v >> 18) & 0x3f];
+            *dst++ = alphabet[(v >> 12) & 0x3f];
+            *dst++ = alphabet[(v >>  6) & 0x3f];
+            *dst++ = alphabet[ v        & 0x3f];
+        }
+
+        if (len) {
+            uint32_t v = uint32_t(src[0]) << 16 | (
+                len > 1 ? uint32_t(src[1]) << 8 : 0
+            );
+
+            *dst++ = alphabet[(v >> 18) & 0x3f];
+            *dst++ = alphabet[(v >> 12) & 0x3f];
+            *dst++ = len > 1 ? alphabet[(v >> 6) & 0x3f] : '=';
+            *dst++ = '=';
+        }
+
+        return size_t(dst - start);
+    }
+
+    inline size_t decode_scalar(
+        const char *src, size_t len, unsigned char *dst
+    ) {
+        unsigned char *start = dst;
+        uint32_t v = 0;
+        size_t n = 0;
+
+        for (; len; --len) {
+            int8_t sextet = sextets.value[(unsigned char) *src++];
+
+            if (sextet < 0) continue;
+
+            v = v << 6 | uint32_t(sextet);
+
+            if (++n == 4) {
+                *dst++ = (unsigned char) (v >> 16);
+                *dst++ = (unsigned char) (v >>  8);
+                *dst++ = (unsigned char)  v;
+                v = 0;
+                n = 0;
+            }
+        }
+
+        if (n == 2) {
+            *dst++ = (unsigned char) (v >> 4);
+        }
+        else if (n == 3) {
+            *dst++ = (unsigned char) (v >> 10);
+            *dst++ = (unsigned char) (v >>  2);
+        }
+
+        return size_t(dst - start);
+    }
+
+#ifdef BASE64_X86
+    // The vectorized kernels follow the algorithms of Wojciech Muła and Daniel
+    // Lemire: the input bytes are shuffled so that every 32-bit lane holds the
+    // bits of four sextets and the ASCII translation is done with pshufb.
+
+    __attribute__((target("ssse3")))
+    inline __m128i encode_lookup(__m128i indices) {
+        __m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+
+        result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+
+        const __m128i shift_lut = _mm_setr_epi8(
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+            '/' - 63, 'A', 0, 0
+        );
+
+        return _mm_add_epi8(_mm_shuffle_epi8(shift_lut, result), indices);
+    }
+
+    __attribute__((target("ssse3")))
+    inline __m128i encode_split(__m128i in) {
+        in = _mm_shuffle_epi8(
+            in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1)
+        );
+
+        __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+        __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+        __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+
+        return _mm_or_si128(t1, t3);
+    }
+
+    __attribute__((target("ssse3")))
+    inline size_t encode_ssse3(
+        const unsigned char *src, size_t len, char *dst
+    ) {
+        char *start = dst;
+
+        // 16 bytes are loaded but only 12 of them are consumed.
+        for (; len >= 16; len -= 12, src += 12, dst += 16) {
+            __m128i in = _mm_loadu_si128((const __m128i *) src);
+
+            _mm_storeu_si128((__m128i *) dst, encode_lookup(encode_split(in)));
+        }
+
+        return size_t(dst - start) + encode_scalar(src, len, dst);
+    }
+
+    __attribute__((target("avx2")))
+    inline size_t encode_avx2(
+        const unsigned char *src, size_t len, char *dst
+    ) {
+        char *start = dst;
+
+        const __m256i shuffle = _mm256_set_epi8(
+            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1
+        );
+
+        const __m256i shift_lut = _mm256_setr_epi8(
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+            '/' - 63, 'A', 0, 0,
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+            '/' - 63, 'A', 0, 0
+        );
+
+        // Each lane loads 16 bytes and consumes 12 of them.
+        for (; len >= 28; len -= 24, src += 24, dst += 32) {
+            __m256i in = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) src)),
+                _mm_loadu_si128((const __m128i *) (src + 12)), 1
+            );
+
+            in = _mm256_shuffle_epi8(in, shuffle);
+
+            __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+            __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+            __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+            __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+            __m256i indices = _mm256_or_si256(t1, t3);
+
+            __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+            __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+
+            result = _mm256_or_si256(
+                result, _mm256_and_si256(less, _mm256_set1_epi8(13))
+            );
+
+            result = _mm256_add_epi8(
+                _mm256_shuffle_epi8(shift_lut, result), indices
+            );
+
+            _mm256_storeu_si256((__m256i *) dst, result);
+        }
+
+        return size_t(dst - start) + encode_ssse3(src, len, dst);
+    }
+
+    __attribute__((target("ssse3")))
+    inline bool decode_block(__m128i input, __m128i &output) {
+        const __m128i lut_lo = _mm_setr_epi8(
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+            0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a
+        );
+
+        const __m128i lut_hi = _mm_setr_epi8(
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10
+        );
+
+        const __m128i lut_roll = _mm_setr_epi8(
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0
+        );
+
+        const __m128i mask_0f = _mm_set1_epi8(0x0f);
+        const __m128i slash   = _mm_set1_epi8(0x2f);
+
+        __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(input, 4), mask_0f);
+        __m128i lo_nibbles = _mm_and_si128(input, mask_0f);
+        __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+        __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+
+        if (_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())
+        ) != 0xffff) {
+            return false;
+        }
+
+        __m128i eq_2f = _mm_cmpeq_epi8(input, slash);
+        __m128i roll = _mm_shuffle_epi8(
+            lut_roll, _mm_add_epi8(eq_2f, hi_nibbles)
+        );
+
+        __m128i values = _mm_add_epi8(input, roll);
+        __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+
+        output = _mm_shuffle_epi8(
+            _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000)),
+            _mm_setr_epi8(
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+            )
+        );
+
+        return true;
+    }
+
+    __attribute__((target("ssse3")))
+    inline size_t decode_ssse3(
+        const char *src, size_t len, unsigned char *dst
+    ) {
+        unsigned char *start = dst;
+
+        // Every block stores 16 bytes of which 12 are valid, hence the input
+        // must extend far enough for the excess to land within the output.
+        for (; len >= 24; len -= 16, src += 16, dst += 12) {
+            __m128i output;
+
+            if (!decode_block(_mm_loadu_si128((const __m128i *) src), output)) {
+                break;
+            }
+
+            _mm_storeu_si128((__m128i *) dst, output);
+        }
+
+        return size_t(dst - start) + decode_scalar(src, len, dst);
+    }
+
+    __attribute__((target("avx2")))
+    inline size_t decode_avx2(
+        const char *src, size_t len, unsigned char *dst
+    ) {
+        unsigned char *start = dst;
+
+        const __m256i lut_lo = _mm256_setr_epi8(
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+            0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+            0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a
+        );
+
+        const __m256i lut_hi = _mm256_setr_epi8(
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10
+        );
+
+        const __m256i lut_roll = _mm256_setr_epi8(
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0
+        );
+
+        const __m256i pack = _mm256_setr_epi8(
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+        );
+
+        const __m256i mask_0f = _mm256_set1_epi8(0x0f);
+        const __m256i slash   = _mm256_set1_epi8(0x2f);
+
+        // Every block stores 32 bytes of which 24 are valid.
+        for (; len >= 48; len -= 32, src += 32, dst += 24) {
+            __m256i input = _mm256_loadu_si256((const __m256i *) src);
+
+            __m256i hi_nibbles = _mm256_and_si256(
+                _mm256_srli_epi32(input, 4), mask_0f
+            );
+
+            __m256i lo_nibbles = _mm256_and_si256(input, mask_0f);
+            __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+            __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+
+            if (!_mm256_testz_si256(lo, hi)) {
+                break;
+            }
+
+            __m256i eq_2f = _mm256_cmpeq_epi8(input, slash);
+            __m256i roll = _mm256_shuffle_epi8(
+                lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles)
+            );
+
+            __m256i values = _mm256_add_epi8(input, roll);
+            __m256i merged = _mm256_maddubs_epi16(
+                values, _mm256_set1_epi32(0x01400140)
+            );
+
+            __m256i output = _mm256_shuffle_epi8(
+                _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000)), pack
+            );
+
+            // Move the 12 valid bytes of each lane next to each other.
+            output = _mm256_permutevar8x32_epi32(
+                output, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7)
+            );
+
+            _mm256_storeu_si256((__m256i *) dst, output);
+        }
+
+        return size_t(dst - start) + decode_ssse3(src, len, dst);
+    }
+#endif
+}
+
+// Writes exactly base64_encoded_size(len) characters to dst.
+inline size_t base64_encode(const unsigned char *src, size_t len, char *dst) {
+#ifdef BASE64_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return base64_detail::encode_avx2(src, len, dst);
+    }
+
+    if (__builtin_cpu_supports("ssse3")) {
+        return base64_detail::encode_ssse3(src, len, dst);
+    }
+#endif
+
+    return base64_detail::encode_scalar(src, len, dst);
+}
+
+// Writes at most base64_decoded_size(len) bytes to dst and returns the number
+// of bytes written.
+inline size_t base64_decode(const char *src, size_t len, unsigned char *dst) {
+#ifdef BASE64_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return base64_detail::decode_avx2(src, len, dst);
+    }
+
+    if (__builtin_cpu_supports("ssse3")) {
+        return base64_detail::decode_ssse3(src, len, dst);
+    }
+#endif
+
+    return base64_detail::decode_scalar(src, len, dst);
+}
+
+inline std::string base64_encode(const unsigned char *src, size_t len) {
+    std::string encoded(base64_encoded_size(len), '\0');
+
+    base64_encode(src, len, encoded.data());
+
+    return encoded;
+}
+
+inline std::vector<unsigned char> base64_decode(const char *src, size_t len) {
+    std::vector<unsigned char> decoded(base64_decoded_size(len));
+
+    decoded.resize(base64_decode(src, len, decoded.data()));
+
+    return decoded;
+}
+
+#endif
@@ -0,0 +1,353 @@
+// SPDX-License-Identifier: MIT
+#include "../mdma.h"
+#include "corpus.h"
+////////////////////////////////////////////////////////////////////////////////
+#include <getopt.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <iostream>
+#include <map>
+#include <algorithm>
+#include <limits>
+
+// Assembles a generated book a number of times and prints one line of JSON
+// with the parameters, the wall times and the time spent in every stage, so
+// that the results of different releases can be collected and compared.
+// Builds of the program, such as this one and an older release that has no
+// stages to report, can be timed on the same book to compare their wall
+// times, which include starting the program.
+
+static constexpr const char *usage_format{
+    "Usage: %s [OPTION]...\n"
+    "      --name          Name the case in the results (%s).\n"
+    "      --headings      Set the number of headings (%zu).\n"
+    "      --depth         Set the deepest heading level (%u).\n"
+    "      --tables        Set the number of tables (%zu).\n"
+    "      --code          Set the number of code blocks (%zu).\n"
+    "      --images        Set the number of local images (%zu).\n"
+    "      --image-width   Set the width of the images in pixels (%u).\n"
+    "      --videos        Set the number of YouTube links (%zu).\n"
+    "      --seed          Set the seed of the generator (%u).\n"
+    "      --iterations    Set the number of measured runs (%zu).\n"
+    "      --preview       Set the image preview shrinking factor (%d).\n"
+    "      --monolith      Embed images and styles within the output.\n"
+    "      --full-decode   Never decode images at a reduced size.\n"
+    "      --compare       Also time the given program on the same book.\n"
+    "                      May be repeated.\n"
+    "  -h  --help          Display this usage information.\n"
+};
+
+static constexpr auto default_framework{
+    std::to_array<unsigned char>({ MDMA_FRAMEWORK })
+};
+
+static constexpr auto default_template{
+    std::to_array<unsigned char>({ MDMA_TEMPLATE })
+};
+
+struct stage_total_type {
+    size_t calls;
+    std::chrono::nanoseconds time;
+};
+
+void log_text(const char *text) {
+    std::cerr << text << "\n";
+}
+
+bool time_program(
+    const std::string &program, const std::filesystem::path &directory,
+    const std::string &md, int preview, bool monolith, size_t iterations,
+    std::vector<double> &wall_ms
+) {
+    // The program is run like the assembly above, with the book written next
+    // to its images and the first run left uncounted.
+
+    const std::string input{(directory / "book.md").string()};
+    const std::string output{(directory / "book.html").string()};
+
+    std::ofstream(input, std::ios::binary) << md;
+
+    const std::string preview_arg{std::to_string(preview)};
+    std::vector<char *> args{
+        const_cast<char *>(program.c_str()),
+        const_cast<char *>("--preview"), const_cast<char *>(preview_arg.c_str())
+    };
+
+    if (monolith) {
+        args.emplace_back(const_cast<char *>("--monolith"));
+    }
+
+    args.emplace_back(const_cast<char *>("-o"));
+    args.emplace_back(const_cast<char *>(output.c_str()));
+    args.emplace_back(const_cast<char *>(input.c_str()));
+    args.emplace_back(nullptr);
+
+    for (size_t i=0; i<=iterations; ++i) {
+        pid_t pid;
+        int status = 0;
+
+        auto start = std::chrono::steady_clock::now();
+
+        if ((errno = posix_spawnp(
+            &pid, program.c_str(), nullptr, nullptr, args.data(), environ
+        )) != 0) {
+            std::cerr << program << ": " << strerror(errno) << "\n";
+            return false;
+        }
+
+        while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+
+        auto end = std::chrono::steady_clock::now();
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            std::cerr << program << ": " << "assembly failed\n";
+            return false;
+        }
+
+        if (i) {
+            using milliseconds = std::chrono::duration<double, std::milli>;
+
+            wall_ms.emplace_back(milliseconds(end - start).count());
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv) {
+    static struct option long_options[] = {
+        { "name",        required_argument, 0, 'n' },
+        { "headings",    required_argument, 0, 'H' },
+        { "depth",       required_argument, 0, 'd' },
+        { "tables",      required_argument, 0, 't' },
+        { "code",        required_argument, 0, 'c' },
+        { "images",      required_argument, 0, 'i' },
+        { "image-width", required_argument, 0, 'w' },
+        { "videos",      required_argument, 0, 'y' },
+        { "seed",        required_argument, 0, 's' },
+        { "iterations",  required_argument, 0, 'r' },
+        { "preview",     required_argument, 0, 'p' },
+        { "monolith",    no_argument,       0, 'm' },
+        { "full-decode", no_argument,       0, 'f' },
+        { "compare",     required_argument, 0, 'C' },
+        { "help",        no_argument,       0, 'h' },
+        { 0,             0,                 0,  0  }
+    };
+
+    std::string name{"default"};
+    CORPUS::params_type params{
+        .headings    = 100,
+        .depth       = 3,
+        .tables      = 10,
+        .code_blocks = 10,
+        .images      = 4,
+        .image_width = 1024,
+        .videos      = 2,
+        .seed        = 1
+    };
+    size_t iterations = 5;
+    int preview = 8;
+    bool monolith = false;
+    bool full_decode = false;
+    std::vector<std::string> compare;
+
+    int c;
+
+    while ((c = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+        unsigned long value = optarg ? strtoul(optarg, nullptr, 10) : 0;
+
+        switch (c) {
+            case 'n': name.assign(optarg); break;
+            case 'H': params.headings = value; break;
+            case 'd': {
+                params.depth = unsigned(std::clamp(value, 1ul, 6ul));
+                break;
+            }
+            case 't': params.tables = value; break;
+            case 'c': params.code_blocks = value; break;
+            case 'i': params.images = value; break;
+            case 'w': {
+                params.image_width = unsigned(std::clamp(value, 1ul, 65535ul));
+                break;
+            }
+            case 'y': params.videos = value; break;
+            case 's': params.seed = uint32_t(value); break;
+            case 'r': iterations = std::max(value, 1ul); break;
+            case 'p': preview = int(std::min(value, 255ul)); break;
+            case 'm': monolith = true; break;
+            case 'f': full_decode = true; break;
+            case 'C': compare.emplace_back(optarg); break;
+            case 'h': {
+                fprintf(
+                    stdout, usage_format, argv[0], name.c_str(),
+                    params.headings, params.depth, params.tables,
+                    params.code_blocks, params.images, params.image_width,
+                    params.videos, params.seed, iterations, preview
+                );
+
+                return EXIT_SUCCESS;
+            }
+            default: return EXIT_FAILURE;
+        }
+    }
+
+    std::string directory_template{
+        (std::filesystem::temp_directory_path() / "mdma-bench-XXXXXX").string()
+    };
+
+    if (!mkdtemp(directory_template.data())) {
+        std::cerr << directory_template << ": " << strerror(errno) << "\n";
+        return EXIT_FAILURE;
+    }
+
+    const std::filesystem::path directory{directory_template};
+    std::string md;
+
+    if (!CORPUS(params, log_text).generate(directory, md)
+    ||  md.size() > std::numeric_limits<MD_SIZE>::max()) {
+        std::error_code ec;
+        std::filesystem::remove_all(directory, ec);
+        return EXIT_FAILURE;
+    }
+
+    // The images of the corpus are drawn at full size by this process, so
+    // the peak of its resident set is reset before the runs where the kernel
+    // allows it.
+    if (FILE *clear_refs = fopen("/proc/self/clear_refs", "w")) {
+        fputs("5", clear_refs);
+        fclose(clear_refs);
+    }
+
+    std::map<std::string, stage_total_type> stages;
+    std::vector<double> wall_ms;
+    size_t output_bytes = 0;
+    bool failed = false;
+
+    // The first run only warms up the caches of the system and is not
+    // counted. Every run gets a new instance, so nothing is carried over.
+    for (size_t i=0; i<=iterations && !failed; ++i) {
+        MDMA mdma;
+
+        mdma.cfg.preview  = uint8_t(preview);
+        mdma.cfg.monolith = monolith;
+        mdma.cfg.minify   = false;
+        mdma.cfg.full_decode = full_decode;
+        mdma.set_logger(log_text);
+        mdma.set_directory(directory);
+
+        if (i) {
+            mdma.set_stage_callback(
+                [&stages](const MDMA::stage_type &stage) {
+                    stage_total_type &total = stages[stage.name];
+
+                    ++total.calls;
+                    total.time += stage.end - stage.start;
+                }
+            );
+        }
+
+        output_bytes = 0;
+
+        auto start = std::chrono::steady_clock::now();
+
+        // The built-in framework is loaded the way the program loads it.
+        failed = !mdma.set_compiled_framework(
+            (const char *) default_template.data(), default_template.size()
+        ) || !mdma.assemble(
+            (const char *) default_framework.data(), default_framework.size(),
+            md.data(), md.size()
+        ) || !mdma.write(
+            [&output_bytes](const char *, size_t len) {
+                output_bytes += len;
+                return true;
+            }
+        );
+
+        auto end = std::chrono::steady_clock::now();
+
+        if (i) {
+            using milliseconds = std::chrono::duration<double, std::milli>;
+
+            wall_ms.emplace_back(milliseconds(end - start).count());
+        }
+    }
+
+    std::string compared;
+
+    for (const std::string &program : compare) {
+        std::vector<double> ms;
+
+        if (failed || (failed = !time_program(
+            program, directory, md, preview, monolith, iterations, ms
+        ))) {
+            break;
+        }
+
+        std::sort(ms.begin(), ms.end());
+
+        compared.append(
+            std::format(
+                "{}{{\"program\":\"{}\",\"wall_ms\":{{\"min\":{:.3f},"
+                "\"median\":{:.3f},\"max\":{:.3f}}}}}",
+                compared.empty() ? "" : ",", program, ms.front(),
+                ms[ms.size() / 2], ms.back()
+            )
+        );
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all(directory, ec);
+
+    if (failed) {
+        log_text("Assembly failed.");
+        return EXIT_FAILURE;
+    }
+
+    std::sort(wall_ms.begin(), wall_ms.end());
+
+    rusage self{};
+    rusage children{};
+
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+
+    std::string json{
+        std::format(
+            "{{\"name\":\"{}\",\"version\":\"{}\",\"headings\":{},"
+            "\"depth\":{},\"tables\":{},\"code\":{},\"images\":{},"
+            "\"image_width\":{},\"videos\":{},\"seed\":{},\"preview\":{},"
+            "\"monolith\":{},\"full_decode\":{},\"iterations\":{},"
+            "\"input_bytes\":{},\"output_bytes\":{},\"wall_ms\":{{"
+            "\"min\":{:.3f},\"median\":{:.3f},\"max\":{:.3f}}},"
+            "\"peak_rss_kb\":{},\"peak_children_rss_kb\":{},{}\"stages\":{{",
+            name, MDMA::VERSION, params.headings, params.depth, params.tables,
+            params.code_blocks, params.images, params.image_width,
+            params.videos, params.seed, preview, monolith, full_decode,
+            iterations, md.size(), output_bytes, wall_ms.front(),
+            wall_ms[wall_ms.size() / 2], wall_ms.back(), self.ru_maxrss,
+            children.ru_maxrss, compared.empty() ? "" : (
+                std::format("\"compare\":[{}],", compared)
+            )
+        )
+    };
+
+    // The stages are averaged over the runs. Some of them are nested in
+    // others, so they do not add up to the wall time.
+    for (const auto &[stage, total] : stages) {
+        using milliseconds = std::chrono::duration<double, std::milli>;
+
+        json.append(
+            std::format(
+                "{}\"{}\":{{\"calls\":{},\"ms\":{:.3f}}}",
+                json.back() == '{' ? "" : ",", stage,
+                double(total.calls) / double(iterations),
+                milliseconds(total.time).count() / double(iterations)
+            )
+        );
+    }
+
+    std::cout << json << "}}" << std::endl;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,306 @@
+// SPDX-License-Identifier: MIT
+#ifndef CORPUS_H_16_10_2026
+#define CORPUS_H_16_10_2026
+
+#include <Imlib2.h>
+#include <filesystem>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <format>
+#include <cstdint>
+
+class CORPUS {
+    // Generates a synthetic markdown book together with its local images.
+    // Only the raw output of the Mersenne Twister is used, never the standard
+    // distributions, so the same parameters produce the same bytes on every
+    // platform and the results of different releases stay comparable.
+
+    public:
+    struct params_type {
+        size_t headings;
+        unsigned depth;
+        size_t tables;
+        size_t code_blocks;
+        size_t images;
+        unsigned image_width;
+        size_t videos;
+        uint32_t seed;
+    };
+
+    CORPUS(
+        const params_type &params,
+        const std::function<void(const char *text)> &log_callback
+    ) : params(params), rng(params.seed), log_callback(log_callback) {}
+
+    bool generate(const std::filesystem::path &directory, std::string &md);
+
+    private:
+    enum item_type { ITEM_TABLE, ITEM_CODE, ITEM_IMAGE, ITEM_VIDEO };
+
+    size_t below(size_t n) { return n ? size_t(rng()) % n : 0; }
+
+    void words(std::string &md, size_t count);
+    void paragraph(std::string &md);
+    void table(std::string &md);
+    void code_block(std::string &md);
+    bool image(const std::filesystem::path &path, unsigned w, unsigned h);
+
+    params_type params;
+    std::mt19937 rng;
+    std::function<void(const char *text)> log_callback;
+};
+
+inline bool CORPUS::generate(
+    const std::filesystem::path &directory, std::string &md
+) {
+    std::error_code ec;
+
+    std::filesystem::create_directories(directory / "images", ec);
+
+    if (ec) {
+        log_callback(
+            std::format("{}: {}", directory.string(), ec.message()).c_str()
+        );
+        return false;
+    }
+
+    unsigned image_height = std::max(params.image_width * 2 / 3, 1u);
+
+    for (size_t i=0; i<params.images; ++i) {
+        if (!image(
+            directory / std::format("images/image-{}.jpg", i),
+            params.image_width, image_height
+        )) {
+            return false;
+        }
+    }
+
+    if (params.videos
+    && !image(directory / "images/thumbnail.jpg", 320, 180)) {
+        return false;
+    }
+
+    // The other items are scattered among the sections of the headings.
+    std::vector<std::vector<item_type>> items(
+        std::max(params.headings, size_t{1})
+    );
+
+    for (size_t i=0; i<params.tables; ++i) {
+        items[below(items.size())].emplace_back(ITEM_TABLE);
+    }
+
+    for (size_t i=0; i<params.code_blocks; ++i) {
+        items[below(items.size())].emplace_back(ITEM_CODE);
+    }
+
+    for (size_t i=0; i<params.images; ++i) {
+        items[below(items.size())].emplace_back(ITEM_IMAGE);
+    }
+
+    for (size_t i=0; i<params.videos; ++i) {
+        items[below(items.size())].emplace_back(ITEM_VIDEO);
+    }
+
+    static constexpr const char *id_chars{
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"
+    };
+
+    unsigned level = 0;
+    size_t next_image = 0;
+
+    md.clear();
+
+    for (size_t i=0; i<items.size(); ++i) {
+        if (i < params.headings) {
+            // Half of the time the next heading goes one level deeper, so the
+            // deepest levels are reached even in small books.
+
+            if (!level || ((rng() & 1) && level < params.depth)) {
+                ++level;
+            }
+            else level = unsigned(1 + below(level));
+
+            md.append(level, '#').append(" ");
+
+            // Every tenth heading repeats a title to exercise the suffixes of
+            // the identifiers.
+            if (i % 10 == 9) md.append("Overview");
+            else words(md, 2 + below(4));
+
+            md.append("\n\n");
+        }
+
+        for (size_t j = 1 + below(3); j; --j) {
+            paragraph(md);
+        }
+
+        for (item_type item : items[i]) {
+            switch (item) {
+                case ITEM_TABLE: table(md); break;
+                case ITEM_CODE:  code_block(md); break;
+                case ITEM_IMAGE: {
+                    md.append(
+                        std::format(
+                            "![Figure {0}](images/image-{0}.jpg)\n\n",
+                            next_image++
+                        )
+                    );
+
+                    break;
+                }
+                case ITEM_VIDEO: {
+                    std::string id;
+
+                    for (size_t k=0; k<11; ++k) {
+                        id.append(1, id_chars[below(64)]);
+                    }
+
+                    md.append(
+                        std::format(
+                            "[![Video](images/thumbnail.jpg)]"
+                            "(https://www.youtube.com/watch?v={})\n\n", id
+                        )
+                    );
+
+                    break;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+inline void CORPUS::words(std::string &md, size_t count) {
+    static constexpr const char *dictionary[]{
+        "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+        "elit", "sed", "do", "eiusmod", "tempor", "incididunt", "labore",
+        "dolore", "magna", "aliqua", "enim", "minim", "veniam", "quis",
+        "nostrud", "exercitation", "ullamco", "laboris", "nisi", "aliquip",
+        "commodo", "consequat", "Ünicode", "naïve", "façade"
+    };
+
+    for (size_t i=0; i<count; ++i) {
+        if (i) md.append(" ");
+
+        md.append(dictionary[below(std::size(dictionary))]);
+    }
+}
+
+inline void CORPUS::paragraph(std::string &md) {
+    for (size_t i = 2 + below(4); i; --i) {
+        words(md, 6 + below(12));
+
+        switch (below(8)) {
+            case 0: md.append(" *"); words(md, 2); md.append("*"); break;
+            case 1: md.append(" **"); words(md, 2); md.append("**"); break;
+            case 2: md.append(" `"); words(md, 1); md.append("`"); break;
+            case 3: {
+                md.append(" [");
+                words(md, 2);
+                md.append("](https://example.com/)");
+                break;
+            }
+            default: break;
+        }
+
+        md.append(".\n");
+    }
+
+    md.append("\n");
+}
+
+inline void CORPUS::table(std::string &md) {
+    size_t columns = 2 + below(4);
+    size_t rows = 3 + below(10);
+
+    for (size_t row = 0; row < rows + 2; ++row) {
+        md.append("|");
+
+        for (size_t column = 0; column < columns; ++column) {
+            if (row == 1) {
+                md.append(" --- |");
+                continue;
+            }
+
+            md.append(" ");
+            words(md, 1 + below(3));
+            md.append(" |");
+        }
+
+        md.append("\n");
+    }
+
+    md.append("\n");
+}
+
+inline void CORPUS::code_block(std::string &md) {
+    md.append("```cpp\n");
+
+    for (size_t i = 3 + below(20); i; --i) {
+        md.append(2 * below(4), ' ').append("int ");
+        words(md, 1);
+        // The order of evaluation of function arguments is unspecified.
+        uint32_t a = uint32_t(rng());
+        uint32_t b = uint32_t(rng());
+
+        md.append(std::format(" = {} < {} && \"&amp;\";\n", a, b));
+    }
+
+    md.append("```\n\n");
+}
+
+inline bool CORPUS::image(
+    const std::filesystem::path &path, unsigned w, unsigned h
+) {
+    // A gradient with some noise on top compresses about as well as a
+    // photograph does.
+
+    Imlib_Image img = imlib_create_image(int(w), int(h));
+
+    if (!img) {
+        log_callback(
+            std::format("{}: cannot create image", path.string()).c_str()
+        );
+        return false;
+    }
+
+    imlib_context_set_image(img);
+
+    uint32_t *data = imlib_image_get_data();
+
+    for (unsigned y=0; y<h; ++y) {
+        for (unsigned x=0; x<w; ++x) {
+            uint32_t noise = uint32_t(rng() & 0x1f);
+            uint32_t r = (x * 255 / w + noise) & 0xff;
+            uint32_t g = (y * 255 / h + noise) & 0xff;
+            uint32_t b = ((x + y) * 127 / (w + h) + noise) & 0xff;
+
+            data[size_t(y) * w + x] = 0xff000000 | r << 16 | g << 8 | b;
+        }
+    }
+
+    imlib_image_put_back_data(data);
+    imlib_image_set_format("jpg");
+
+    Imlib_Load_Error error = IMLIB_LOAD_ERROR_NONE;
+
+    imlib_save_image_with_error_return(path.c_str(), &error);
+    imlib_free_image();
+
+    if (error != IMLIB_LOAD_ERROR_NONE) {
+        log_callback(
+            std::format(
+                "{}: cannot save image ({})", path.string(), int(error)
+            ).c_str()
+        );
+        return false;
+    }
+
+    return true;
+}
+
+#endif
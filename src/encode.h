@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: MIT
+#ifndef ENCODE_H_16_10_2026
+#define ENCODE_H_16_10_2026
+
+#include "jpegerror.h"
+////////////////////////////////////////////////////////////////////////////////
+#include <webp/encode.h>
+#include <cstdio>
+#include <jpeglib.h>
+#include <csetjmp>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+// Encoders of the pixels that Imlib2 decodes, which are laid out as native
+// 32-bit ARGB values. The quality ranges from 0 to 100. WebP keeps the alpha
+// channel and is encoded losslessly at the quality of 100, JPEG drops it.
+
+inline bool encode_webp(
+    const uint32_t *argb, int width, int height, int quality,
+    std::vector<unsigned char> &out
+) {
+    WebPConfig config;
+    WebPPicture picture;
+
+    if (!WebPConfigInit(&config) || !WebPPictureInit(&picture)) {
+        return false;
+    }
+
+    config.quality = float(quality);
+    config.lossless = quality >= 100;
+
+    // The encoder only reads the pixels, converting them as needed into the
+    // memory of the picture.
+    picture.use_argb = 1;
+    picture.width = width;
+    picture.height = height;
+    picture.argb = const_cast<uint32_t *>(argb);
+    picture.argb_stride = width;
+
+    WebPMemoryWriter writer;
+
+    WebPMemoryWriterInit(&writer);
+    picture.writer = WebPMemoryWrite;
+    picture.custom_ptr = &writer;
+
+    bool success = WebPEncode(&config, &picture) != 0;
+
+    if (success) {
+        out.assign(writer.mem, writer.mem + writer.size);
+    }
+
+    WebPMemoryWriterClear(&writer);
+    WebPPictureFree(&picture);
+
+    return success;
+}
+
+inline bool encode_jpeg(
+    const uint32_t *argb, int width, int height, int quality,
+    std::vector<unsigned char> &out
+) {
+    // Nothing with a destructor may be created after the jump buffer is set,
+    // so the scanline buffer comes from the pool of the encoder.
+
+    jpeg_compress_struct cinfo;
+    jpeg_detail::jpeg_error_type error;
+    unsigned char *buffer = nullptr;
+    unsigned long size = 0;
+
+    cinfo.err = jpeg_std_error(&error.mgr);
+    error.mgr.error_exit = jpeg_detail::jpeg_error_exit;
+    error.mgr.output_message = jpeg_detail::jpeg_output_message;
+
+    if (setjmp(error.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        free(buffer);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buffer, &size);
+
+    cinfo.image_width = JDIMENSION(width);
+    cinfo.image_height = JDIMENSION(height);
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.optimize_coding = TRUE;
+    jpeg_start_compress(&cinfo, TRUE);
+
+    JSAMPARRAY row{
+        (*cinfo.mem->alloc_sarray)(
+            (j_common_ptr) &cinfo, JPOOL_IMAGE, cinfo.image_width * 3, 1
+        )
+    };
+
+    while (cinfo.next_scanline < cinfo.image_height) {
+        const uint32_t *src{
+            argb + size_t(cinfo.next_scanline) * size_t(width)
+        };
+
+        for (size_t x=0; x<size_t(width); ++x) {
+            JSAMPLE *rgb = row[0] + x * 3;
+
+            rgb[0] = JSAMPLE(src[x] >> 16);
+            rgb[1] = JSAMPLE(src[x] >> 8);
+            rgb[2] = JSAMPLE(src[x]);
+        }
+
+        jpeg_write_scanlines(&cinfo, row, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    out.assign(buffer, buffer + size);
+    free(buffer);
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: MIT
+#include "../mdma.h"
+#include "../input.h"
+#include "../output.h"
+////////////////////////////////////////////////////////////////////////////////
+#include <iostream>
+
+// Compiles a framework file into the record that MDMA::set_compiled_framework
+// takes. The build runs it on the built-in framework, so that the program
+// never has to parse that one.
+
+void log_text(const char *text) {
+    std::cerr << text << "\n";
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " FRAMEWORK OUTPUT\n";
+        return EXIT_FAILURE;
+    }
+
+    INPUT html;
+
+    if (!html.load(argv[1])) {
+        std::cerr << argv[1] << ": " << strerror(errno) << "\n";
+        return EXIT_FAILURE;
+    }
+
+    MDMA mdma;
+    std::string record;
+
+    mdma.set_logger(log_text);
+
+    if (!mdma.compile_framework(html.data(), html.size(), record)) {
+        return EXIT_FAILURE;
+    }
+
+    OUTPUT output;
+
+    if (!output.open(argv[2])
+    ||  !output.write(record.data(), record.size())
+    ||  !output.commit()) {
+        std::cerr << argv[2] << ": " << strerror(errno) << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
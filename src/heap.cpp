@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: MIT
+#include "heap.h"
+////////////////////////////////////////////////////////////////////////////////
+#include <new>
+#include <cstdlib>
+
+// The other forms of new and delete, except for the aligned ones, are
+// implemented by the standard library in terms of these.
+
+void *operator new(size_t size) {
+    void *block;
+
+    while (!(block = malloc(size ? size : 1))) {
+        std::new_handler handler = std::get_new_handler();
+
+        if (!handler) {
+            throw std::bad_alloc();
+        }
+
+        handler();
+    }
+
+    HEAP::allocated(block);
+
+    return block;
+}
+
+void operator delete(void *block) noexcept {
+    if (block) {
+        HEAP::freed(block);
+        free(block);
+    }
+}
+
+void operator delete(void *block, size_t) noexcept {
+    operator delete(block);
+}
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: MIT
+#ifndef HEAP_H_16_10_2026
+#define HEAP_H_16_10_2026
+
+#include <malloc.h>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+class HEAP {
+    // Counts the memory allocated with operator new, which is replaced in
+    // heap.cpp. Nothing is counted until the counting is enabled, so that the
+    // replacement costs next to nothing otherwise. The blocks are measured by
+    // the allocator, hence no header has to be added to them. Memory that the
+    // C libraries allocate with malloc is not seen here.
+
+    public:
+    static void enable() {
+        enabled.store(true, std::memory_order_relaxed);
+    }
+
+    static size_t live_bytes() {
+        // The blocks allocated before the counting was enabled may be freed
+        // afterwards, which could take the total below zero.
+        int64_t bytes = live.load(std::memory_order_relaxed);
+
+        return bytes > 0 ? size_t(bytes) : 0;
+    }
+
+    static size_t allocations() {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    static void allocated(void *block) {
+        if (enabled.load(std::memory_order_relaxed)) {
+            live.fetch_add(
+                int64_t(malloc_usable_size(block)), std::memory_order_relaxed
+            );
+            count.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    static void freed(void *block) {
+        if (enabled.load(std::memory_order_relaxed)) {
+            live.fetch_sub(
+                int64_t(malloc_usable_size(block)), std::memory_order_relaxed
+            );
+        }
+    }
+
+    private:
+    static inline std::atomic<bool> enabled{false};
+    static inline std::atomic<int64_t> live{0};
+    static inline std::atomic<size_t> count{0};
+};
+
+#endif
@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: MIT
+#ifndef INPUT_H_16_10_2026
+#define INPUT_H_16_10_2026
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <cerrno>
+
+class INPUT {
+    // Holds the contents of an input file as a read-only view. Regular files
+    // are mapped into memory, while pipes and terminals are read into a
+    // buffer. On failure errno tells the reason.
+
+    public:
+    INPUT() : mapping(nullptr), mapping_size(0), buffer(), view() {}
+
+    INPUT(const INPUT &) = delete;
+    INPUT &operator=(const INPUT &) = delete;
+
+    ~INPUT() {
+        clear();
+    }
+
+    bool load(const std::string &path, bool allow_mapping = true);
+    void assign(const void *data, size_t size);
+    void clear();
+
+    const char *data() const { return view.data(); }
+    size_t size() const { return view.size(); }
+    operator std::string_view() const { return view; }
+
+    private:
+    bool map(int fd, size_t size);
+    bool read_all(int fd, size_t size_hint);
+
+    void *mapping;
+    size_t mapping_size;
+    std::string buffer;
+    std::string_view view;
+};
+
+inline bool INPUT::load(const std::string &path, bool allow_mapping) {
+    // A mapped file must not be truncated while it is in use, so the
+    // mapping should be avoided for files that are being edited.
+
+    clear();
+
+    int fd = path.empty() ? STDIN_FILENO : open(
+        path.c_str(), O_RDONLY | O_CLOEXEC
+    );
+
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+    bool success = fstat(fd, &st) == 0;
+
+    if (success) {
+        bool regular = S_ISREG(st.st_mode);
+        size_t size = regular ? size_t(st.st_size) : 0;
+
+        // Some regular files, like the ones in /proc, report no size.
+        success = (
+            allow_mapping && regular && size && map(fd, size)
+        ) || read_all(fd, size);
+    }
+
+    int error = errno;
+
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+
+    errno = error;
+
+    return success;
+}
+
+inline void INPUT::assign(const void *data, size_t size) {
+    clear();
+    view = std::string_view(static_cast<const char *>(data), size);
+}
+
+inline void INPUT::clear() {
+    if (mapping) {
+        munmap(mapping, mapping_size);
+        mapping = nullptr;
+        mapping_size = 0;
+    }
+
+    buffer.clear();
+    view = {};
+}
+
+inline bool INPUT::map(int fd, size_t size) {
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    madvise(addr, size, MADV_SEQUENTIAL);
+
+    mapping = addr;
+    mapping_size = size;
+    view = std::string_view(static_cast<const char *>(addr), size);
+
+    return true;
+}
+
+inline bool INPUT::read_all(int fd, size_t size_hint) {
+    static constexpr size_t MIN_CHUNK = 64 * 1024;
+
+    size_t length = 0;
+
+    // One more byte than expected is asked for, so that the end of a regular
+    // file is usually seen without growing the buffer.
+    buffer.resize(std::max(size_hint + 1, MIN_CHUNK));
+
+    for (;;) {
+        if (length == buffer.size()) {
+            buffer.resize(buffer.size() * 2);
+        }
+
+        ssize_t got = read(fd, buffer.data() + length, buffer.size() - length);
+
+        if (got == -1) {
+            if (errno == EINTR) continue;
+
+            buffer.clear();
+            return false;
+        }
+
+        if (got == 0) {
+            break;
+        }
+
+        length += size_t(got);
+    }
+
+    buffer.resize(length);
+    view = buffer;
+
+    return true;
+}
+
+#endif
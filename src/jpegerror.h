@@ -0,0 +1,26 @@
+// SPDX-License-Identifier: MIT
+#ifndef JPEGERROR_H_16_10_2026
+#define JPEGERROR_H_16_10_2026
+
+#include <cstdio>
+#include <jpeglib.h>
+#include <csetjmp>
+
+// The error handling of libjpeg for the codecs that run inside the process.
+// An error jumps back to where the jump buffer was set instead of exiting,
+// and the warnings are not printed.
+
+namespace jpeg_detail {
+    struct jpeg_error_type {
+        jpeg_error_mgr mgr;
+        jmp_buf jump;
+    };
+
+    inline void jpeg_error_exit(j_common_ptr cinfo) {
+        longjmp(reinterpret_cast<jpeg_error_type *>(cinfo->err)->jump, 1);
+    }
+
+    inline void jpeg_output_message(j_common_ptr) {}
+}
+
+#endif
@@ -1,16 +1,43 @@
 // SPDX-License-Identifier: MIT
 #include "mdma.h"
 #include "options.h"
+#include "server.h"
+#include "watcher.h"
+#include "input.h"
+#include "output.h"
+#include "profiler.h"
+#include "heap.h"
 ////////////////////////////////////////////////////////////////////////////////
+#include <sys/resource.h>
 #include <iostream>
-#include <sstream>
 #include <fstream>
 #include <limits>
+#include <mutex>
+#include <thread>
+#include <atomic>
 
-bool load_framework(const std::string &path, std::string &dest);
-bool load_markdown (const std::string &path, std::string &dest);
+bool load_framework(const std::string &path, INPUT &dest, bool map = true);
+bool load_markdown (const std::string &path, INPUT &dest, bool map = true);
+void setup(MDMA &, const OPTIONS &, PROFILER *);
+void report(const OPTIONS &, PROFILER *);
+void sample_usage(MDMA::usage_type &);
+bool write_output(const MDMA &, const std::string &path);
+bool watch(const OPTIONS &, PROFILER *);
+bool batch(const OPTIONS &, PROFILER *);
+
+static constexpr auto default_framework{
+    std::to_array<unsigned char>({ MDMA_FRAMEWORK })
+};
+
+// The default framework compiled at build time.
+static constexpr auto default_template{
+    std::to_array<unsigned char>({ MDMA_TEMPLATE })
+};
 
 void log_text(const char *text) {
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+
     std::cerr << text << "\n";
 }
 
@@ -25,8 +52,74 @@ int main(int argc, char **argv) {
         return EXIT_SUCCESS;
     }
 
-    std::string html;
-    std::string md;
+    if (options.flags.footprint) {
+        HEAP::enable();
+    }
+
+    // A server never finishes, so it could not report the totals, but it can
+    // still write a trace.
+    PROFILER profiler(options.flags.profile && options.serve.empty());
+    PROFILER *profiling{
+        options.flags.profile || !options.trace.empty() ? &profiler : nullptr
+    };
+
+    if (!options.trace.empty() && !profiler.open_trace(options.trace)) {
+        std::cerr << options.trace << ": " << strerror(errno) << "\n";
+        return EXIT_FAILURE;
+    }
+
+    INPUT html;
+    INPUT md;
+
+    if (!options.serve.empty()) {
+        if (options.flags.profile) {
+            log_text("Profiling reports are not available for the server.");
+        }
+
+        if (!load_framework(options.framework, html)) {
+            return EXIT_FAILURE;
+        }
+
+        // The workers of the server share the processed images and the
+        // downloaded files within the cache size limit.
+        auto memory{
+            std::make_shared<MDMA::memory_type>(
+                size_t{options.cache_size} * 1024 * 1024
+            )
+        };
+
+        SERVER server(
+            options.serve, options.concurrency,
+            size_t{options.body_size} * 1024 * 1024,
+            [&options, &memory, profiling](MDMA &mdma) {
+                setup(mdma, options, profiling);
+                mdma.set_memory(memory);
+
+                // The documents come from the clients, so they may only refer
+                // to the files below the root and download nothing unless
+                // allowed to.
+                mdma.cfg.confined = true;
+                mdma.cfg.offline  = !options.flags.remote;
+
+                mdma.set_directory(
+                    options.root.empty() ? (
+                        std::filesystem::current_path()
+                    ) : std::filesystem::absolute(options.root)
+                );
+            },
+            log_text
+        );
+
+        return server.run(html) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (options.flags.watch) {
+        return watch(options, profiling) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (!options.batch.empty()) {
+        return batch(options, profiling) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
     if (!load_framework(options.framework, html)
     ||  !load_markdown(options.file, md)) {
@@ -34,13 +127,314 @@ int main(int argc, char **argv) {
     }
 
     MDMA mdma;
+    setup(mdma, options, profiling);
+
+    bool success{
+        mdma.assemble(html.data(), html.size(), md.data(), md.size())
+        && write_output(mdma, options.output)
+    };
+
+    report(options, profiling);
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+bool write_output(const MDMA &mdma, const std::string &path) {
+    OUTPUT output;
+
+    if (!output.open(path)
+    ||  !mdma.write(
+            [&output](const char *data, size_t len) {
+                return output.write(data, len);
+            },
+            [&output](int fd, size_t size) {
+                return output.splice(fd, size);
+            }
+        )
+    ||  !output.commit()) {
+        std::cerr << (
+            path.empty() ? "stdout" : path
+        ) << ": " << strerror(errno) << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+bool watch(const OPTIONS &options, PROFILER *profiler) {
+    // The document is assembled again whenever the markdown file, the
+    // framework file or any of the local assets changes. The same instance
+    // is kept for every build, so the framework is parsed again only when it
+    // has changed, and the unchanged images are found in the memory cache.
+
+    static constexpr std::chrono::milliseconds debounce{100};
+
+    if (options.file.empty() || options.output.empty()) {
+        log_text("Watching requires both an input file and an output file.");
+        return false;
+    }
+
+    MDMA mdma;
+    setup(mdma, options, profiler);
+    mdma.set_memory(
+        std::make_shared<MDMA::memory_type>(
+            size_t{options.cache_size} * 1024 * 1024
+        )
+    );
+
+    WATCHER watcher(log_text);
+    std::vector<std::filesystem::path> assets;
+    INPUT html;
+    INPUT md;
+    auto changed = std::chrono::steady_clock::now();
+
+    for (size_t build = 0;; ++build) {
+        // The files are read rather than mapped, because an editor truncating
+        // one of them in the middle of a build would crash a mapping.
+        if (load_framework(options.framework, html, false)
+        &&  load_markdown(options.file, md, false)
+        &&  mdma.assemble(html.data(), html.size(), md.data(), md.size())
+        &&  write_output(mdma, options.output)) {
+            using milliseconds = std::chrono::duration<double, std::milli>;
+
+            const auto &files = mdma.get_local_files();
+
+            assets.assign(files.begin(), files.end());
+
+            log_text(
+                std::format(
+                    "{} {} in {:.3f} ms.", build ? "Rebuilt" : "Built",
+                    options.output, milliseconds(
+                        std::chrono::steady_clock::now() - changed
+                    ).count()
+                ).c_str()
+            );
+        }
+
+        report(options, profiler);
+
+        // The assets of the last successful build remain watched when the
+        // build fails, since fixing one of them may be what comes next.
+        std::vector<std::filesystem::path> files{assets};
+
+        files.emplace_back(options.file);
+
+        if (!options.framework.empty()) {
+            files.emplace_back(options.framework);
+        }
+
+        if (!watcher.watch(files) || !watcher.wait(debounce, changed)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool batch(const OPTIONS &options, PROFILER *profiler) {
+    // The documents are either listed in a file, one input and output path
+    // pair per line, or found in a directory, in which case every markdown
+    // file is assembled next to itself or into the same place under the
+    // output directory. Every worker thread keeps its own instance, so the
+    // framework is parsed once per worker, and the processed images and the
+    // downloaded files are shared by all of them.
+
+    std::vector<std::pair<std::filesystem::path, std::filesystem::path>> jobs;
+    std::error_code ec;
+
+    if (std::filesystem::is_directory(options.batch, ec)) {
+        const std::filesystem::path root{options.batch};
+
+        for (const auto &entry : std::filesystem::recursive_directory_iterator(
+            root, ec
+        )) {
+            if (!entry.is_regular_file(ec)
+            ||  entry.path().extension() != ".md") {
+                continue;
+            }
+
+            std::filesystem::path output{
+                options.output.empty() ? entry.path() : (
+                    options.output / entry.path().lexically_relative(root)
+                )
+            };
+
+            jobs.emplace_back(entry.path(), output.replace_extension(".html"));
+        }
+
+        std::sort(jobs.begin(), jobs.end());
+    }
+    else {
+        std::ifstream list(options.batch);
+
+        if (!list) {
+            std::cerr << options.batch << ": " << strerror(errno) << "\n";
+            return false;
+        }
+
+        for (std::string line; std::getline(list, line);) {
+            if (line.empty()) continue;
+
+            size_t separator = line.find('\t');
+
+            if (separator == line.npos) {
+                separator = line.find(' ');
+            }
+
+            if (separator == line.npos) {
+                log_text(
+                    std::format(
+                        "{}: missing output path for {}", options.batch, line
+                    ).c_str()
+                );
+                return false;
+            }
+
+            jobs.emplace_back(
+                line.substr(0, separator), line.substr(separator + 1)
+            );
+        }
+    }
+
+    if (ec) {
+        log_text(std::format("{}: {}", options.batch, ec.message()).c_str());
+        return false;
+    }
+
+    INPUT html;
+
+    if (!load_framework(options.framework, html)) {
+        return false;
+    }
+
+    auto memory{
+        std::make_shared<MDMA::memory_type>(
+            size_t{options.cache_size} * 1024 * 1024
+        )
+    };
+
+    std::atomic<size_t> next_job{0};
+    std::atomic<size_t> failed{0};
+    std::atomic<uintmax_t> bytes_in{0};
+    std::atomic<uintmax_t> bytes_out{0};
+    std::vector<std::thread> workers;
+
+    // libcurl must be initialized before any other threads are started.
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    size_t concurrency = std::min(size_t{options.concurrency}, jobs.size());
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t i=0; i<concurrency; ++i) {
+        workers.emplace_back(
+            [&]() {
+                MDMA mdma;
+                INPUT md;
+
+                setup(mdma, options, profiler);
+                mdma.set_memory(memory);
+
+                if (concurrency > 1) {
+                    // The image workers are not forked while other threads
+                    // could be holding locks, so the images are decoded here
+                    // under the lock of Imlib2.
+                    mdma.cfg.jobs = 1;
+                }
+
+                for (size_t j; (j = next_job++) < jobs.size();) {
+                    const auto &[input, output] = jobs[j];
+                    std::error_code ec;
+
+                    mdma.set_directory(
+                        std::filesystem::absolute(input).remove_filename()
+                    );
+
+                    if (output.has_parent_path()) {
+                        std::filesystem::create_directories(
+                            output.parent_path(), ec
+                        );
+                    }
+
+                    if (!load_markdown(input, md)
+                    ||  !mdma.assemble(
+                            html.data(), html.size(), md.data(), md.size()
+                        )
+                    ||  !write_output(mdma, output)) {
+                        ++failed;
+                        continue;
+                    }
+
+                    bytes_in += md.size();
+                    bytes_out += std::filesystem::file_size(output, ec);
+                }
+            }
+        );
+    }
+
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    curl_global_cleanup();
+
+    using seconds = std::chrono::duration<double>;
+
+    double elapsed{
+        seconds(std::chrono::steady_clock::now() - start).count()
+    };
+
+    double rate = elapsed > 0.0 ? 1.0 / elapsed : 0.0;
+
+    log_text(
+        std::format(
+            "Assembled {} of {} documents in {:.3f} s: {:.1f} docs/s, "
+            "{:.2f} MB/s in, {:.2f} MB/s out.", jobs.size() - failed,
+            jobs.size(), elapsed, double(jobs.size() - failed) * rate,
+            double(bytes_in) / 1e6 * rate, double(bytes_out) / 1e6 * rate
+        ).c_str()
+    );
+
+    report(options, profiler);
+
+    return failed == 0;
+}
+
+void setup(MDMA &mdma, const OPTIONS &options, PROFILER *profiler) {
     mdma.cfg.minify   = options.flags.minify;
     mdma.cfg.github   = options.flags.dialect == OPTIONS::DIALECT_GITHUB;
     mdma.cfg.verbose  = options.flags.verbose;
     mdma.cfg.monolith = options.flags.monolith;
     mdma.cfg.preview  = options.preview;
+    mdma.cfg.embed_format = (
+        options.flags.embed_format == OPTIONS::EMBED_WEBP ? MDMA::EMBED_WEBP :
+        options.flags.embed_format == OPTIONS::EMBED_JPEG ? MDMA::EMBED_JPEG :
+        MDMA::EMBED_KEEP
+    );
+    mdma.cfg.embed_quality = options.embed_quality;
+    mdma.cfg.jobs     = options.jobs;
+    mdma.cfg.connections = options.connections;
+    mdma.cfg.cache_size  = options.cache_size;
 
     mdma.set_logger(log_text);
+    mdma.set_cache_directory(options.cache_dir);
+
+    if (profiler) {
+        mdma.set_stage_callback(
+            [profiler](const MDMA::stage_type &stage) {
+                profiler->record(stage);
+            }
+        );
+
+        if (options.flags.footprint) {
+            mdma.set_usage_probe(sample_usage);
+        }
+    }
+
+    if (options.framework.empty()) {
+        mdma.set_compiled_framework(
+            (const char *) default_template.data(), default_template.size()
+        );
+    }
 
     mdma.set_directory(
         options.file.empty() ? (
@@ -51,49 +445,68 @@ int main(int argc, char **argv) {
             ).remove_filename()
         )
     );
+}
 
-    const std::string *output{
-        mdma.assemble(html.data(), html.size(), md.data(), md.size())
-    };
+void report(const OPTIONS &options, PROFILER *profiler) {
+    // The report covers everything since the previous one, which in batch
+    // mode means all of the documents together.
 
-    if (!output) {
-        return EXIT_FAILURE;
+    if (!profiler || !options.flags.profile) {
+        return;
     }
 
-    if (!options.output.empty()) {
-        std::ofstream stream(options.output, std::ios::binary);
+    for (const std::string &line : profiler->report(
+        options.flags.profile == OPTIONS::PROFILE_JSON
+    )) {
+        log_text(line.c_str());
+    }
+}
 
-        if (!stream) {
-            std::cerr << options.output << ": " << strerror(errno) << "\n";
-            return EXIT_FAILURE;
-        }
+void sample_usage(MDMA::usage_type &usage) {
+    // The statm file is read without the streams of the standard library, so
+    // that the sample itself does not show up on the heap.
 
-        stream << *output;
-    }
-    else {
-        std::cout << *output;
-    }
+    static const size_t page_size = size_t(sysconf(_SC_PAGESIZE));
+    struct rusage self{};
+    struct rusage children{};
+    char statm[128];
+    size_t resident_pages = 0;
 
-    return EXIT_SUCCESS;
-}
+    int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
 
-bool load_markdown(const std::string &path, std::string &dest) {
-    if (path.empty()) {
-        std::ostringstream std_input;
-        std_input << std::cin.rdbuf();
-        dest.assign(std_input.str());
-    }
-    else {
-        std::ifstream input(path, std::ios::binary);
+    if (fd != -1) {
+        ssize_t len = read(fd, statm, sizeof(statm) - 1);
 
-        if (!input) {
-            std::cerr << path << ": " << strerror(errno) << "\n";
-            return false;
+        if (len > 0) {
+            statm[len] = '\0';
+
+            // The resident pages are in the second field.
+            char *resident = strchr(statm, ' ');
+
+            if (resident) {
+                resident_pages = strtoul(resident, nullptr, 10);
+            }
         }
 
-        std::stringstream sstr;
-        input >> sstr.rdbuf();
-        dest.assign(sstr.str());
+        close(fd);
+    }
+
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+
+    usage.rss = resident_pages * page_size;
+    usage.peak_rss = size_t(self.ru_maxrss) * 1024;
+    usage.peak_children_rss = size_t(children.ru_maxrss) * 1024;
+    usage.heap = HEAP::live_bytes();
+    usage.allocations = HEAP::allocations();
+}
+
+bool load_markdown(const std::string &path, INPUT &dest, bool map) {
+    if (!dest.load(path, map)) {
+        std::cerr << (path.empty() ? "stdin" : path) << ": " << (
+            strerror(errno)
+        ) << "\n";
+        return false;
     }
 
     if (dest.size() > std::numeric_limits<MD_SIZE>::max()) {
@@ -104,25 +517,13 @@ bool load_markdown(const std::string &path, std::string &dest) {
     return true;
 }
 
-bool load_framework(const std::string &path, std::string &framework) {
-    auto default_framework{std::to_array<unsigned char>({ MDMA_FRAMEWORK })};
-
+bool load_framework(const std::string &path, INPUT &framework, bool map) {
     if (path.empty()) {
-        framework.assign(
-            (const char *) default_framework.data(), default_framework.size()
-        );
+        framework.assign(default_framework.data(), default_framework.size());
     }
-    else {
-        std::ifstream input(path, std::ios::binary);
-
-        if (!input) {
-            std::cerr << path << ": " << strerror(errno) << "\n";
-            return false;
-        }
-
-        std::stringstream sstr;
-        input >> sstr.rdbuf();
-        framework.assign(sstr.str());
+    else if (!framework.load(path, map)) {
+        std::cerr << path << ": " << strerror(errno) << "\n";
+        return false;
     }
 
     return true;
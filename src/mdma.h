@@ -3,29 +3,42 @@
 #define MDMA_H_02_06_2023
 
 #include "slugify.h"
+#include "sha256.h"
+#include "base64.h"
+#include "scaled.h"
+#include "encode.h"
+#include "entity.h"
 ////////////////////////////////////////////////////////////////////////////////
 #include <cstdlib>
 #include <functional>
 #include <string>
 #include <cstdarg>
 #include <map>
+#include <set>
+#include <unordered_map>
 #include <tidy.h>
 #include <tidybuffio.h>
 #include <list>
-#include <tinyxml2.h>
-#include <md4c-html.h>
+#include <md4c.h>
 #include <uriparser/Uri.h>
 #include <Imlib2.h>
 #include <signal.h>
 #include <filesystem>
 #include <sys/mman.h>
-#include <b64/encode.h>
-#include <b64/decode.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <fstream>
 #include <format>
 #include <chrono>
 #include <curl/curl.h>
 #include <webp/decode.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <mutex>
+#include <limits>
 
 class MDMA {
     public:
@@ -36,60 +49,550 @@ class MDMA {
     MDMA() : cfg(
         {
             .preview= 0,
+            .embed_format = EMBED_KEEP,
+            .embed_quality= 80,
+            .jobs   = 1,
+            .connections = 16,
+            .cache_size  = 256,
             .github = false,
             .minify = false,
             .verbose= false,
-            .monolith=false
+            .monolith=false,
+            .full_decode=false,
+            .confined=false,
+            .offline=false
         }
     )
     , directory("")
+    , cache_directory("")
     , assembly_buffer("")
+    , blob_prefix("MDMA-BLOB-")
     , htmltidy_buffer{}
+    , framework(nullptr)
     , curl(nullptr)
-    , log_callback(nullptr) {
+    , log_callback(nullptr)
+    , stage_callback(nullptr)
+    , usage_probe(nullptr) {
+        std::random_device random;
+
+        // The nonce keeps the references from colliding with document text.
+        blob_prefix.append(
+            std::format("{:08x}{:08x}-", random(), random())
+        );
+
         tidyBufInit(&htmltidy_buffer);
-        curl = curl_easy_init();
+        curl = curl_multi_init();
     }
 
     ~MDMA() {
-        curl_easy_cleanup(curl);
+        curl_multi_cleanup(curl);
         tidyBufFree(&htmltidy_buffer);
     }
 
+    enum embed_format_type : uint8_t {
+        EMBED_KEEP, // the original file
+        EMBED_WEBP,
+        EMBED_JPEG
+    };
+
     struct cfg_type {
         uint8_t preview;
+        embed_format_type embed_format;
+        uint8_t embed_quality;
+        uint16_t jobs; // forked image workers, one where threads are used
+        uint16_t connections;
+        uint32_t cache_size; // in MiB
         bool github:1;
         bool minify:1;
         bool verbose:1;
         bool monolith:1;
+        bool full_decode:1; // never decode images at a reduced size
+        bool confined:1; // local files only by relative paths within directory
+        bool offline:1; // never download the remote files
     } cfg;
 
+    class memory_type;
+
+    struct usage_type {
+        size_t rss;
+        size_t peak_rss;
+        size_t peak_children_rss; // of the largest image worker
+        size_t heap;
+        size_t allocations;
+        size_t assembly_buffer;
+        size_t tidy_buffer;
+        size_t sections;
+    };
+
+    struct stage_type {
+        const char *name;
+        std::string_view detail; // the asset, if the stage concerns one
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point end;
+        std::chrono::nanoseconds cpu;
+        size_t bytes_in;
+        size_t bytes_out;
+        pid_t thread;
+        bool async; // may overlap the other stages of the same thread
+        bool sampled; // the usage is known
+        usage_type usage_start;
+        usage_type usage_end;
+    };
+
     void set_logger(const std::function<void(const char *)>& log_callback);
+    void set_stage_callback(const std::function<void(const stage_type &)> &);
+    void set_usage_probe(const std::function<void(usage_type &)> &);
     void set_directory(const std::filesystem::path &);
+    void set_cache_directory(const std::filesystem::path &);
+    void set_memory(const std::shared_ptr<memory_type> &);
 
-    const std::string *assemble(
-        const char *htm, size_t htm_sz, const char *md, size_t md_sz
+    const std::set<std::filesystem::path> &get_local_files() const;
+
+    bool assemble(const char *htm, size_t htm_sz, const char *md, size_t md_sz);
+    bool compile_framework(
+        const char *html, size_t html_len, std::string &record
     );
+    bool set_compiled_framework(const char *record, size_t record_len);
+    bool write(
+        const std::function<bool(const char *, size_t)> &sink,
+        const std::function<bool(int fd, size_t size)> &splice = nullptr
+    ) const;
 
     static std::string uri_param_value(const char *uri, const char *key);
+    static void vlog(
+        const std::function<void(const char *text)> &callback,
+        const char *fmt, va_list args
+    );
+
+    private:
+    static constexpr size_t BLOB_CHUNK_SIZE = 48 * 1024; // a multiple of 3
+    static constexpr size_t BLOB_SPILL_SIZE = 256 * 1024;
+    static constexpr size_t FRAMEWORK_FORMAT = 1;
+
+    enum dump_phase_type {
+        DUMP_ATTRIBUTES, // before the start tag, the attributes may change
+        DUMP_CONTENT,    // after the start tag, false skips the children
+        DUMP_CLOSING     // before the end tag
+    };
+
+    struct attribute_type {
+        std::string_view name;
+        std::string_view value;
+        std::string name_storage;
+        std::string value_storage;
+        bool boolean:1;
+        bool owns_name:1;
+        bool owns_value:1;
+    };
+
+    class attribute_list_type {
+        // The attributes are views into the storage of the parser until they
+        // are modified. The entries are reused, so the list does not allocate
+        // once it has grown to the widest element of the document.
+
+        public:
+        attribute_list_type() : entries(), count(0) {}
+
+        void clear() { count = 0; }
+        size_t size() const { return count; }
+        const attribute_type &operator[](size_t i) const { return entries[i]; }
+
+        static std::string_view name_of(const attribute_type &attr) {
+            return attr.owns_name ? attr.name_storage : attr.name;
+        }
+
+        static std::string_view value_of(const attribute_type &attr) {
+            return attr.owns_value ? attr.value_storage : attr.value;
+        }
+
+        bool contains(std::string_view name) const {
+            return find(name) != nullptr;
+        }
+
+        std::string_view get(std::string_view name) const {
+            const attribute_type *attr = find(name);
+
+            return attr ? value_of(*attr) : std::string_view{};
+        }
+
+        void add(std::string_view name, const char *value) {
+            attribute_type *attr = find(name);
+
+            if (!attr) {
+                attr = &append();
+                attr->name = name;
+            }
+
+            attr->value = value ? value : "";
+            attr->boolean = value == nullptr;
+            attr->owns_value = false;
+        }
+
+        std::string &set(std::string_view name) {
+            attribute_type *attr = find(name);
+
+            if (!attr) {
+                attr = &append();
+                attr->name_storage.assign(name);
+                attr->owns_name = true;
+            }
+
+            attr->value_storage.clear();
+            attr->boolean = false;
+            attr->owns_value = true;
+
+            return attr->value_storage;
+        }
+
+        void set(std::string_view name, std::string_view value) {
+            set(name).assign(value);
+        }
+
+        void set_boolean(std::string_view name) {
+            set(name);
+            find(name)->boolean = true;
+        }
+
+        void sort() {
+            std::sort(
+                entries.begin(), entries.begin() + long(count),
+                [](const attribute_type &a, const attribute_type &b) {
+                    if (a.boolean != b.boolean) return b.boolean;
+
+                    return name_of(a) < name_of(b);
+                }
+            );
+        }
+
+        private:
+        const attribute_type *find(std::string_view name) const {
+            for (size_t i=0; i<count; ++i) {
+                if (name_of(entries[i]) == name) return &entries[i];
+            }
+
+            return nullptr;
+        }
+
+        attribute_type *find(std::string_view name) {
+            return const_cast<attribute_type *>(
+                static_cast<const attribute_list_type *>(this)->find(name)
+            );
+        }
+
+        attribute_type &append() {
+            if (count == entries.size()) {
+                entries.emplace_back();
+            }
+
+            attribute_type &attr = entries[count++];
+
+            attr.name = {};
+            attr.value = {};
+            attr.boolean = false;
+            attr.owns_name = false;
+            attr.owns_value = false;
+
+            return attr;
+        }
+
+        std::vector<attribute_type> entries;
+        size_t count;
+    };
+
+    struct section_slot_type {
+        size_t offset;
+        std::string tag; // img or link, empty for the progress style
+        attribute_list_type attributes;
+    };
+
+    struct fragment_type {
+        std::string text;
+        std::shared_ptr<const std::vector<unsigned char>> blob;
+        bool progress; // the progress style follows the text
+    };
+
+    struct section_type {
+        std::string html;
+        std::vector<section_slot_type> slots;
+        std::string key; // empty if the section is not to be cached
+        std::vector<fragment_type> fragments; // once the slots are filled
+        bool repair; // raw HTML or an embedded video to be repaired by tidy
+    };
+
+    enum framework_slot_kind_type {
+        SLOT_ASSET,   // an img or link tag
+        SLOT_CONTENT,
+        SLOT_AGENDA,
+        SLOT_YEAR,
+        SLOT_STYLE,   // the generated style at the end of the head
+        SLOT_PROGRESS // the progress style after a heading anchor
+    };
+
+    struct framework_slot_type {
+        size_t offset;
+        framework_slot_kind_type kind;
+        std::string tag;
+        attribute_list_type attributes;
+    };
+
+    struct framework_type {
+        // The framework is compiled into its literal text and the places
+        // where the document is filled in, so that it never has to be parsed
+        // again to be assembled.
+
+        std::array<unsigned char, 32> digest; // of the source
+        std::string html;
+        std::vector<framework_slot_type> slots;
+        std::unordered_map<std::string, int> identifiers;
+    };
+
+    class markdown_type {
+        // Renders the markdown parser events straight into the sections. The
+        // images and links are left as slots to be filled in once the assets
+        // have been loaded.
+
+        public:
+        markdown_type(MDMA &mdma) :
+            mdma(mdma), open_headings(), links(), image(), title(), alt(),
+            raw_html(), html_skip(), heading_start(0), heading_slots(0),
+            depth(0), heading_level(0), image_nesting(0), in_section(false),
+            in_heading(false) {}
+
+        int enter_block(MD_BLOCKTYPE, void *detail);
+        int leave_block(MD_BLOCKTYPE, void *detail);
+        int enter_span(MD_SPANTYPE, void *detail);
+        int leave_span(MD_SPANTYPE, void *detail);
+        int text(MD_TEXTTYPE, std::string_view);
+
+        private:
+        struct link_type {
+            size_t start;
+            size_t slots;
+            std::string href;
+            size_t images;
+            bool other;
+        };
+
+        section_type &section() { return mdma.sections.back(); }
+
+        void insert(size_t offset, size_t first_slot, std::string_view);
+        void finish_heading();
+        void finish_link();
+        void flush_html();
+        void scan_html(std::string_view);
+
+        static std::string attribute(const MD_ATTRIBUTE &, bool url);
+        static void plain(MD_TEXTTYPE, std::string_view, std::string &);
+        static size_t parse_tag(
+            std::string_view, size_t pos, attribute_list_type &
+        );
+
+        MDMA &mdma;
+        std::vector<size_t> open_headings;
+        std::vector<link_type> links;
+        attribute_list_type image;
+        std::string title;
+        std::string alt;
+        std::string raw_html; // not yet scanned
+        std::string html_skip; // what ends a comment, script or style
+        size_t heading_start;
+        size_t heading_slots;
+        unsigned depth;
+        unsigned heading_level;
+        unsigned image_nesting;
+        bool in_section;
+        bool in_heading;
+    };
+
+    struct heading_type {
+        // The headings are kept in document order, so the descendants of a
+        // heading are the ones that follow it up to the end of its subtree.
+
+        int level;
+        unsigned depth;
+        size_t end;
+        std::string title;
+        std::string identifier;
+    };
+
+    struct blob_type {
+        std::string mime;
+        std::shared_ptr<const std::vector<unsigned char>> data;
+    };
+
+    struct timing_type {
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point end;
+        std::chrono::nanoseconds cpu;
+    };
+
+    class stage_timer_type {
+        // Reports the time spent in a stage of the assembly when it goes out
+        // of scope. The clocks are not read unless someone is listening.
+
+        public:
+        stage_timer_type(
+            const MDMA &mdma, const char *name, std::string_view detail = {}
+        ) : bytes_in(0)
+        , bytes_out(0)
+        , mdma(mdma)
+        , name(name)
+        , detail(detail)
+        , start()
+        , cpu_start()
+        , usage_start() {
+            if (mdma.stage_callback) {
+                mdma.sample(usage_start);
+                start = now();
+                cpu_start = cpu_now();
+            }
+        }
+
+        ~stage_timer_type() {
+            if (mdma.stage_callback) {
+                stage_type stage{
+                    .name        = name,
+                    .detail      = detail,
+                    .start       = start,
+                    .end         = now(),
+                    .cpu         = cpu_now() - cpu_start,
+                    .bytes_in    = bytes_in,
+                    .bytes_out   = bytes_out,
+                    .thread      = gettid(),
+                    .async       = false,
+                    .sampled     = bool(mdma.usage_probe),
+                    .usage_start = usage_start,
+                    .usage_end   = {}
+                };
+
+                mdma.sample(stage.usage_end);
+                mdma.stage_callback(stage);
+            }
+        }
+
+        static std::chrono::nanoseconds cpu_now() {
+            timespec ts{};
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+            return std::chrono::seconds(ts.tv_sec) + nanoseconds(ts.tv_nsec);
+        }
+
+        size_t bytes_in;
+        size_t bytes_out;
+
+        private:
+        using time_point = std::chrono::steady_clock::time_point;
+        using nanoseconds = std::chrono::nanoseconds;
+
+        static time_point now() { return std::chrono::steady_clock::now(); }
+
+        const MDMA &mdma;
+        const char *name;
+        std::string_view detail;
+        time_point start;
+        nanoseconds cpu_start;
+        usage_type usage_start;
+    };
+
+    struct spill_type {
+        // The encoded contents of a large blob are kept in an anonymous file,
+        // from where they can be copied to the output by the kernel.
+
+        spill_type(int fd, size_t size) : fd(fd), size(size) {}
+        spill_type(const spill_type &) = delete;
+        spill_type &operator=(const spill_type &) = delete;
+
+        ~spill_type() {
+            close(fd);
+        }
+
+        int fd;
+        size_t size;
+    };
+
+    struct image_type {
+        std::string width;
+        std::string height;
+        blob_type src;
+        blob_type style;
+    };
+
+    struct http_entry_type {
+        int64_t expires;
+        std::string etag;
+        std::string last_modified;
+        std::vector<unsigned char> body;
+    };
+
+    public:
+    class memory_type {
+        // Keeps the processed images and the downloaded files of the previous
+        // assemblies, so that the instances of a long running process can
+        // share them. The least recently used entries are dropped first when
+        // the size limit is exceeded.
+
+        public:
+        memory_type(size_t limit) :
+            mutex(), images(), http(), sections(), clock(0), size(0),
+            limit(limit) {}
+
+        private:
+        friend class MDMA;
+
+        template<class T> struct entry_type {
+            T value;
+            size_t size;
+            uint64_t used;
+        };
+
+        template<class T> bool recall(
+            std::map<std::string, entry_type<T>> &, const std::string &key,
+            T &value
+        );
+        template<class T> void remember(
+            std::map<std::string, entry_type<T>> &, const std::string &key,
+            const T &value
+        );
+        void trim();
+
+        static size_t size_of(const image_type &);
+        static size_t size_of(const http_entry_type &);
+        static size_t size_of(const std::vector<fragment_type> &);
+
+        std::mutex mutex;
+        std::map<std::string, entry_type<image_type>> images;
+        std::map<std::string, entry_type<http_entry_type>> http;
+        std::map<std::string, entry_type<std::vector<fragment_type>>> sections;
+        uint64_t clock;
+        size_t size;
+        size_t limit;
+    };
 
     private:
-    struct heading_data {
-        int *parent_id;
-        std::string *title;
-        std::string *identifier;
+    struct image_job_type {
+        std::string src;
+        std::shared_ptr<const std::vector<unsigned char>> data;
+        image_type result;
+        std::string key;
+        bool preview:1;
+        bool done:1;
     };
 
     void bug(const char * =__builtin_FILE(), int =__builtin_LINE()) const;
     void log(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
     void die(const char * =__builtin_FILE(), int =__builtin_LINE()) const;
 
+    bool load_framework(
+        const char *html, size_t html_len,
+        const std::array<unsigned char, 32> &digest
+    );
     bool deflate_framework(TidyDoc framework);
+    void compile_framework(const TidyDoc, framework_type &);
     bool parse_markdown(const char *str, size_t len);
-    bool inflate_framework(const TidyDoc framework);
+    bool inflate_framework();
 
-    void add_heading(
-        int id, int level, const char *title, std::map<int, int> &level_to_id
+    size_t add_heading(
+        int level, const char *title, std::vector<size_t> &open_headings
     );
 
     void setup(TidyDoc) const;
@@ -98,112 +601,375 @@ class MDMA {
         TidyNode root, std::function<bool(const TidyNode &, int)> fun
     ) const;
 
-    tinyxml2::XMLNode *find_if(
-        const tinyxml2::XMLNode &root,
-        std::function<bool(const tinyxml2::XMLNode &, int)> fun
-    ) const;
-
-    tinyxml2::XMLElement *find_element(
-        const tinyxml2::XMLNode &root, const char *id
+    void for_each_asset(
+        std::function<void(TidyTagId, const char *, bool)>
     ) const;
+    void prefetch();
+    void download(const std::vector<std::string> &urls);
 
-    void patch_tables(tinyxml2::XMLDocument &) const;
-    void embed_videos(tinyxml2::XMLDocument &) const;
+    static std::string http_cache_key(const std::string &url);
+    static bool update_http_entry(
+        http_entry_type &, const std::map<std::string, std::string> &headers,
+        int64_t now
+    );
+    void preload_images();
+    void process_images(std::vector<image_job_type> &);
+    image_type process_image(
+        const char *src,
+        const std::shared_ptr<const std::vector<unsigned char>> &,
+        bool preview
+    );
+    blob_type embed_image(
+        const std::shared_ptr<const std::vector<unsigned char>> &,
+        const char *fmt
+    );
+    bool process_scaled_image(
+        const std::shared_ptr<const std::vector<unsigned char>> &,
+        bool preview, image_type &
+    );
+    void modify_image_attributes(attribute_list_type &);
+
+    std::string cache_key(const image_job_type &) const;
+    std::string cache_key(const section_type &);
+    static std::string cache_key(const std::array<unsigned char, 32> &);
+    struct cache_usage_type {
+        std::mutex mutex;
+        bool known;      // whether the total has been measured yet
+        uintmax_t total; // bytes in the cache directory
+    };
 
-    void modify_image_attributes(std::map<std::string, std::string> &);
-    void modify_link_attributes(std::map<std::string, std::string> &);
+    static cache_usage_type &cache_usage(const std::filesystem::path &);
+    bool load_cache(const std::filesystem::path &, std::string &) const;
+    void save_cache(const std::filesystem::path &, const std::string &) const;
+    void trim_cache() const;
+    void modify_link_attributes(attribute_list_type &);
 
     std::vector<unsigned char> load_file(const char *);
     std::vector<unsigned char> decode_base64(const char *);
     std::vector<unsigned char> decode_base64(const char *, size_t);
     std::vector<unsigned char> dump(const Imlib_Image &) const;
 
-    std::string dump_inflated(const TidyDoc framework);
-    std::string dump_enhanced(const std::string &html);
+    void dump_inflated(std::string &output);
     std::string dump_repaired(const std::string &html);
-    std::string dump(const std::list<tinyxml2::XMLDocument> &) const;
-    std::string dump_agenda(
-        const std::map<
-            int, std::tuple<heading_data, int, std::string, std::string>
-        > &headings
-    ) const;
-    std::string dump_style(
-        const std::map<
-            int, std::tuple<heading_data, int, std::string, std::string>
-        > &headings
+    void dump(
+        std::vector<section_type> &, size_t &heading_counter,
+        std::string &output
+    );
+    void enhance(const section_type &, std::vector<fragment_type> &);
+    void recall_sections();
+    std::string dump_progress(size_t heading_counter) const;
+    void dump(
+        const std::vector<heading_type> &, std::string &agenda,
+        std::string &style
     ) const;
-    std::string dump(
-        const TidyDoc, const TidyNode,
+    void dump(
+        const TidyDoc, const TidyNode, std::string &output,
         std::function<
-            void(
-                const TidyNode &, std::string *,
-                std::map<std::string, std::string> &
+            bool(
+                const TidyNode &, dump_phase_type, std::string &output,
+                attribute_list_type &
             )
         > node_callback =[](
-            const TidyNode &, std::string *,
-            std::map<std::string, std::string> &
-        ) {}
+            const TidyNode &, dump_phase_type, std::string &,
+            attribute_list_type &
+        ) { return true; }
     ) const;
-    std::string dump(
-        const std::map<std::string, std::string> &attributes
+    void dump(attribute_list_type &, std::string &output) const;
+
+    static void escape(std::string &output, std::string_view, bool attribute);
+    static void escape_url(std::string &output, std::string_view);
+    static std::string decode_entity(std::string_view);
+    static std::string unescape(std::string_view);
+
+    std::string blob_uri(const blob_type &);
+    static size_t image_size(const image_type &);
+    void report(const stage_type &) const;
+    void sample(usage_type &) const;
+    std::shared_ptr<const spill_type> spill(
+        const std::vector<unsigned char> &blob
     ) const;
 
-    std::string encode_base64(const unsigned char *, size_t);
+    static void serialize(std::string &, size_t index, const image_type &);
+    static bool deserialize(std::string_view &, size_t &, image_type &);
+    static void serialize(std::string &, const http_entry_type &);
+    static bool deserialize(std::string_view &, http_entry_type &);
+    static void serialize(std::string &, const fragment_type &);
+    static bool deserialize(std::string_view &, fragment_type &);
+    static void serialize(std::string &, const framework_type &);
+    static bool deserialize(std::string_view &, framework_type &);
+    static size_t parse_reference(std::string_view, size_t &index);
 
-    static const char *imgfmt2mime(const char *fmt);
+    bool save_http_entry(const std::string &url, const http_entry_type &);
 
-    const heading_data *get_heading_data(int id) const;
+    static std::mutex &imlib_mutex();
+    static const char *imgfmt2mime(const char *fmt);
+    static bool is_remote(const char *src);
+    bool is_confined(const char *src) const;
 
     std::filesystem::path directory;
+    std::filesystem::path cache_directory;
     std::string assembly_buffer;
+    std::string blob_prefix;
     TidyBuffer  htmltidy_buffer;
-    CURL *curl;
+    std::shared_ptr<const framework_type> framework;
+    std::shared_ptr<memory_type> memory;
+    CURLM *curl;
     std::function<void(const char *text)> log_callback;
-    std::map<std::string, int> identifiers;
-    std::list<tinyxml2::XMLDocument> sections;
-    std::map<
-        int,
-        std::tuple<
-            heading_data,
-            int, std::string, std::string
-        >
-    > headings;
+    std::function<void(const stage_type &)> stage_callback;
+    std::function<void(usage_type &)> usage_probe;
+    std::unordered_map<std::string, int> identifiers;
+    std::unordered_map<std::string, size_t> next_suffix;
+    std::vector<section_type> sections;
+    std::set<std::filesystem::path> local_files;
+    std::map<std::string, image_type> images;
+    std::map<std::string, std::vector<unsigned char>> downloads;
+    std::vector<std::shared_ptr<const std::vector<unsigned char>>> blobs;
+    std::vector<heading_type> headings;
+    mutable std::map<
+        std::shared_ptr<const std::vector<unsigned char>>,
+        std::shared_ptr<const spill_type>
+    > spills;
 };
 
-inline const std::string *MDMA::assemble(
+inline bool MDMA::assemble(
     const char *html, size_t html_len, const char *md, size_t md_len
 ) {
-    const std::string *result = nullptr;
-
     if (!html || !md) {
         bug();
-        return result;
+        return false;
     }
 
-    assembly_buffer.assign(html, html_len);
-    identifiers.clear();
+    std::array<unsigned char, 32> digest{
+        SHA256().update(html, html_len).digest()
+    };
 
-    {
-        TidyDoc tdoc = tidyCreate();
+    // The framework is compiled again only when a different one is given.
+    if ((!framework || digest != framework->digest)
+    && !load_framework(html, html_len, digest)) {
+        return false;
+    }
 
-        {
-            setup(tdoc);
-            tidyParseString(tdoc, assembly_buffer.c_str());
+    identifiers = framework->identifiers;
+    next_suffix.clear();
+    local_files.clear();
+    images.clear();
+    downloads.clear();
+    blobs.clear();
+
+    return parse_markdown(md, md_len) && inflate_framework();
+}
+
+inline bool MDMA::compile_framework(
+    const char *html, size_t html_len, std::string &record
+) {
+    // The record can be given to set_compiled_framework by a later run, so
+    // that the framework does not have to be parsed at all.
+
+    if (!html) {
+        bug();
+        return false;
+    }
+
+    if (!load_framework(
+        html, html_len, SHA256().update(html, html_len).digest()
+    )) {
+        return false;
+    }
+
+    record.clear();
+    serialize(record, *framework);
+
+    return true;
+}
+
+inline bool MDMA::set_compiled_framework(
+    const char *record, size_t record_len
+) {
+    stage_timer_type timer(*this, "template");
+    auto compiled{std::make_shared<framework_type>()};
+
+    timer.bytes_in = record_len;
+
+    if (!record) {
+        bug();
+        return false;
+    }
+
+    std::string_view unread(record, record_len);
+
+    if (!deserialize(unread, *compiled) || !unread.empty()) {
+        log("%s", "corrupt compiled framework");
+        return false;
+    }
+
+    framework = std::move(compiled);
+
+    return true;
+}
+
+inline bool MDMA::write(
+    const std::function<bool(const char *, size_t)> &sink,
+    const std::function<bool(int fd, size_t size)> &splice
+) const {
+    // The embedded files are kept out of the assembled document as references
+    // to the blobs and get encoded into the sink in chunks as they are met.
+    // When the sink can splice files, the large blobs are encoded only once
+    // into anonymous files that are kept for as long as the following
+    // documents keep referring to them.
+
+    stage_timer_type timer(*this, "write");
+    std::string_view unread{assembly_buffer};
+    std::string chunk(base64_encoded_size(BLOB_CHUNK_SIZE), '\0');
+    decltype(spills) spilled;
+
+    const auto emit{
+        [&](const char *data, size_t len) {
+            timer.bytes_out += len;
+            return sink(data, len);
+        }
+    };
+
+    for (size_t pos; (pos = unread.find(blob_prefix)) != unread.npos;) {
+        size_t index;
+        size_t length{
+            parse_reference(unread.substr(pos + blob_prefix.size()), index)
+        };
+
+        if (!length || index >= blobs.size()) {
+            if (!emit(unread.data(), pos + blob_prefix.size())) {
+                return false;
+            }
+
+            unread.remove_prefix(pos + blob_prefix.size());
+            continue;
+        }
+
+        if (!emit(unread.data(), pos)) {
+            return false;
+        }
 
-            if (deflate_framework(tdoc)
-            &&  parse_markdown(md, md_len)
-            &&  inflate_framework(tdoc)) {
-                result = &assembly_buffer;
+        unread.remove_prefix(pos + blob_prefix.size() + length);
+
+        const std::vector<unsigned char> &blob = *blobs[index];
+
+        if (splice && blob.size() >= BLOB_SPILL_SIZE) {
+            auto &found = spilled[blobs[index]];
+
+            if (!found) {
+                auto it = spills.find(blobs[index]);
+                found = it != spills.end() ? it->second : spill(blob);
+            }
+
+            if (found) {
+                if (!splice(found->fd, found->size)) {
+                    return false;
+                }
+
+                timer.bytes_out += found->size;
+
+                continue;
+            }
+        }
+
+        for (size_t i=0; i<blob.size(); i += BLOB_CHUNK_SIZE) {
+            size_t len;
+
+            {
+                stage_timer_type base64_timer(*this, "base64");
+
+                base64_timer.bytes_in = std::min(
+                    BLOB_CHUNK_SIZE, blob.size() - i
+                );
+                base64_timer.bytes_out = len = base64_encode(
+                    blob.data() + i, base64_timer.bytes_in, chunk.data()
+                );
+            }
+
+            if (!emit(chunk.data(), len)) {
+                return false;
             }
         }
+    }
+
+    spills.swap(spilled);
+
+    return unread.empty() || emit(unread.data(), unread.size());
+}
 
-        tidyRelease(tdoc);
+inline bool MDMA::load_framework(
+    const char *html, size_t html_len,
+    const std::array<unsigned char, 32> &digest
+) {
+    // A custom framework is compiled once and then kept in the cache
+    // directory under the digest of its contents.
+
+    if (html_len > std::numeric_limits<uint>::max()) {
+        log("%s", "framework size limit exceeded");
+        return false;
     }
 
-    return result;
+    std::string key;
+    std::string record;
+
+    if (!cache_directory.empty()) {
+        key = cache_key(digest);
+
+        if (load_cache(cache_directory / "frameworks" / key, record)
+        &&  set_compiled_framework(record.data(), record.size())
+        &&  framework->digest == digest) {
+            return true;
+        }
+    }
+
+    TidyDoc doc = tidyCreate();
+
+    // The input is parsed in place, it may be a read-only mapping.
+    TidyBuffer input;
+
+    tidyBufInit(&input);
+    tidyBufAttach(&input, (byte *) html, uint(html_len));
+
+    setup(doc);
+
+    {
+        stage_timer_type timer(*this, "framework");
+        timer.bytes_in = html_len;
+        tidyParseBuffer(doc, &input);
+    }
+
+    tidyBufDetach(&input);
+    identifiers.clear();
+
+    auto compiled{std::make_shared<framework_type>()};
+    bool success = deflate_framework(doc);
+
+    if (success) {
+        compile_framework(doc, *compiled);
+    }
+
+    tidyRelease(doc);
+
+    if (!success) {
+        return false;
+    }
+
+    compiled->digest = digest;
+    compiled->identifiers = identifiers;
+    framework = std::move(compiled);
+
+    if (!key.empty()) {
+        record.clear();
+        serialize(record, *framework);
+        save_cache(cache_directory / "frameworks" / key, record);
+        trim_cache();
+    }
+
+    return true;
 }
 
 inline bool MDMA::deflate_framework(TidyDoc framework) {
+    stage_timer_type timer(*this, "deflate");
+
     do {
         TidyNode found = find_if(
             tidyGetBody(framework),
@@ -306,844 +1072,3116 @@ inline bool MDMA::deflate_framework(TidyDoc framework) {
     return true;
 }
 
-inline bool MDMA::parse_markdown(const char *md, size_t md_len) {
-    std::string xhtml;
+inline void MDMA::compile_framework(
+    const TidyDoc doc, framework_type &compiled
+) {
+    // The framework is dumped the way it used to be inflated, except that
+    // whatever depends on the document is left as a slot. The assets become
+    // slots too, since their attributes depend on the configuration.
+
+    stage_timer_type timer(*this, "compile");
+
+    compiled.html.clear();
+    compiled.slots.clear();
+
+    const auto add_slot{
+        [&compiled](framework_slot_kind_type kind) -> framework_slot_type & {
+            return compiled.slots.emplace_back(
+                framework_slot_type{
+                    .offset     = compiled.html.size(),
+                    .kind       = kind,
+                    .tag        = {},
+                    .attributes = {}
+                }
+            );
+        }
+    };
 
-    bool fail = md_html(
-        md, MD_SIZE(md_len),
-        [](const MD_CHAR *str, MD_SIZE len, void *userdata) {
-            std::string *dest = static_cast<std::string *>(userdata);
-            dest->append(str, len);
-        },
-        &xhtml,
-        cfg.github ? MD_DIALECT_GITHUB : MD_DIALECT_COMMONMARK,
-        MD_HTML_FLAG_XHTML
-    );
-
-    if (fail) {
-        bug();
-        return false;
-    }
+    dump(
+        doc, tidyGetRoot(doc), compiled.html,
+        [&](
+            const TidyNode &node, dump_phase_type phase, std::string &output,
+            attribute_list_type &attributes
+        ) {
+            TidyTagId node_id = tidyNodeGetId(node);
 
-    tinyxml2::XMLDocument doc;
-    doc.Parse(xhtml.c_str(), xhtml.size());
-    tinyxml2::XMLElement *parent = doc.RootElement();
+            if (phase == DUMP_ATTRIBUTES) {
+                if (node_id == TidyTag_LINK || node_id == TidyTag_IMG) {
+                    framework_slot_type &slot = add_slot(SLOT_ASSET);
 
-    if (!parent) {
-        bug();
-        return false;
-    }
+                    slot.tag.assign(tidyNodeGetName(node));
 
-    const tinyxml2::XMLNode *first_heading = find_if(
-        *parent,
-        [](const tinyxml2::XMLNode &node, int depth) {
-            const tinyxml2::XMLElement *el = node.ToElement();
-            const char *name = el ? el->Name() : nullptr;
+                    for (size_t i=0; i<attributes.size(); ++i) {
+                        const attribute_type &attr = attributes[i];
+                        std::string_view name{
+                            attribute_list_type::name_of(attr)
+                        };
 
-            if (name) {
-                if (!strcasecmp("h1", name)) {
-                    return true;
+                        if (attr.boolean) {
+                            slot.attributes.set_boolean(name);
+                        }
+                        else {
+                            slot.attributes.set(
+                                name, attribute_list_type::value_of(attr)
+                            );
+                        }
+                    }
                 }
+
+                return true;
             }
 
-            return false;
-        }
-    );
+            if (phase == DUMP_CLOSING) {
+                if (node_id == TidyTag_HEAD) {
+                    add_slot(SLOT_STYLE);
+                }
+                else if (node_id == TidyTag_BODY) {
+                    output.append(
+                        "<style class=\"MDMA-AUTOGENERATED\">:root {"
+                        "--MDMA-LOADER-OPACITY: 0%;}</style>"
+                    );
+                }
+                else if (node_id == TidyTag_A
+                && tidyNodeIsHeader(tidyGetParent(node))) {
+                    add_slot(SLOT_PROGRESS);
+                }
 
-    const tinyxml2::XMLNode *sibling = first_heading;
-    int next_id = 1;
-    std::map<int, int> level_to_id;
+                return true;
+            }
 
-    headings.clear();
-    sections.clear();
+            if (node_id == TidyTag_LINK || node_id == TidyTag_IMG) {
+                // The start tag is written by the slot.
+                output.resize(compiled.slots.back().offset);
 
-    for (; sibling; sibling = sibling->NextSibling()) {
-        const tinyxml2::XMLElement *sibling_element = sibling->ToElement();
+                return true;
+            }
 
-        bool new_tab = false;
-        bool new_anchor = false;
+            if (node_id == TidyTag_HEAD) {
+                output.append(
+                    "<meta name=\"generator\" content=\""
+                ).append(MDMA::CAPTION).append(" version ").append(
+                    MDMA::VERSION
+                ).append("\">");
 
-        if (sibling_element) {
-            const char *name = sibling_element->Name();
+                return true;
+            }
 
-            if (!name) {
-                continue;
+            const char *attr_val{
+                tidyAttrValue(tidyAttrGetById(node, TidyAttr_ID))
+            };
+
+            if (!attr_val) {
+                return true;
             }
 
-            new_tab = !strcasecmp("h1", name);
+            if (!strcmp("MDMA-CONTENT", attr_val)) {
+                add_slot(SLOT_CONTENT);
+            }
+            else if (!strcmp("MDMA-AGENDA", attr_val)) {
+                add_slot(SLOT_AGENDA);
+            }
+            else if (!strcmp("MDMA-YEAR", attr_val)) {
+                add_slot(SLOT_YEAR);
+            }
+            else {
+                return true;
+            }
 
-            new_anchor = (
-                new_tab
-                || !strcasecmp("h2", name)
-                || !strcasecmp("h3", name)
-                || !strcasecmp("h4", name)
-                || !strcasecmp("h5", name)
-                || !strcasecmp("h6", name)
-            );
+            return false;
         }
+    );
 
-        if (new_tab) {
-            tinyxml2::XMLNode *node = nullptr;
-            tinyxml2::XMLElement *elem = nullptr;
+    timer.bytes_out = compiled.html.size();
+}
 
-            sections.emplace_back();
+inline bool MDMA::parse_markdown(const char *md, size_t md_len) {
+    stage_timer_type timer(*this, "markdown");
+    markdown_type markdown(*this);
 
-            node = sections.back().InsertFirstChild(
-                sections.back().NewElement("article")
+    MD_PARSER parser{
+        .abi_version = 0,
+        .flags = unsigned(
+            cfg.github ? MD_DIALECT_GITHUB : MD_DIALECT_COMMONMARK
+        ),
+        .enter_block = [](MD_BLOCKTYPE type, void *detail, void *userdata) {
+            return static_cast<markdown_type *>(userdata)->enter_block(
+                type, detail
             );
+        },
+        .leave_block = [](MD_BLOCKTYPE type, void *detail, void *userdata) {
+            return static_cast<markdown_type *>(userdata)->leave_block(
+                type, detail
+            );
+        },
+        .enter_span = [](MD_SPANTYPE type, void *detail, void *userdata) {
+            return static_cast<markdown_type *>(userdata)->enter_span(
+                type, detail
+            );
+        },
+        .leave_span = [](MD_SPANTYPE type, void *detail, void *userdata) {
+            return static_cast<markdown_type *>(userdata)->leave_span(
+                type, detail
+            );
+        },
+        .text = [](
+            MD_TEXTTYPE type, const MD_CHAR *text, MD_SIZE size, void *userdata
+        ) {
+            return static_cast<markdown_type *>(userdata)->text(
+                type, std::string_view(text, size)
+            );
+        },
+        .debug_log = nullptr,
+        .syntax = nullptr
+    };
+
+    headings.clear();
+    sections.clear();
 
-            elem = node ? node->ToElement() : nullptr;
+    timer.bytes_in = md_len;
 
-            if (elem) {
-                elem->SetAttribute("class", "tab");
-            }
-        }
+    if (md_parse(md, MD_SIZE(md_len), &parser, &markdown)) {
+        bug();
+        return false;
+    }
+
+    for (const section_type &section : sections) {
+        timer.bytes_out += section.html.size();
+    }
 
-        if (sections.empty()) continue;
+    return true;
+}
 
-        tinyxml2::XMLElement *root = sections.back().RootElement();
+inline int MDMA::markdown_type::enter_block(MD_BLOCKTYPE type, void *detail) {
+    flush_html();
 
-        tinyxml2::XMLNode *node = (
-            new_anchor ? (
-                sibling->ShallowClone(&sections.back())
-            ) : sibling->DeepClone(&sections.back())
-        );
+    if (type == MD_BLOCK_DOC) {
+        return 0;
+    }
 
-        tinyxml2::XMLElement *elem = node ? node->ToElement() : nullptr;
+    if (++depth == 1 && type == MD_BLOCK_H
+    && static_cast<const MD_BLOCK_H_DETAIL *>(detail)->level == 1) {
+        // Every top level h1 begins a new tab, the content before the first
+        // one is left out.
 
-        if (!elem) {
-            die();
+        if (in_section) {
+            section().html.append("</article>");
         }
 
-        root->InsertEndChild(elem);
+        mdma.sections.emplace_back();
+        section().html.assign("<article class=\"tab\">");
+        in_section = true;
+    }
 
-        if (!new_anchor) {
-            continue;
+    if (!in_section) {
+        return 0;
+    }
+
+    std::string &html = section().html;
+
+    switch (type) {
+        case MD_BLOCK_QUOTE: html.append("<blockquote>\n"); break;
+        case MD_BLOCK_UL:    html.append("<ul>\n");         break;
+        case MD_BLOCK_HR:    html.append("<hr>\n");         break;
+        case MD_BLOCK_P:     html.append("<p>");            break;
+        case MD_BLOCK_TABLE: html.append("<table>\n");      break;
+        case MD_BLOCK_THEAD: html.append("<thead>\n");      break;
+        case MD_BLOCK_TBODY: html.append("<tbody>\n");      break;
+        case MD_BLOCK_TR:    html.append("<tr>\n");         break;
+        case MD_BLOCK_HTML:                                 break;
+        case MD_BLOCK_OL: {
+            unsigned start = static_cast<const MD_BLOCK_OL_DETAIL *>(
+                detail
+            )->start;
+
+            html.append(
+                start == 1 ? (
+                    "<ol>\n"
+                ) : std::format("<ol start=\"{}\">\n", start)
+            );
+
+            break;
         }
+        case MD_BLOCK_LI: {
+            const MD_BLOCK_LI_DETAIL *li{
+                static_cast<const MD_BLOCK_LI_DETAIL *>(detail)
+            };
+
+            if (!li->is_task) {
+                html.append("<li>");
+                break;
+            }
 
-        node = elem->InsertEndChild(sections.back().NewElement("a"));
+            html.append(
+                "<li class=\"task-list-item\">"
+                "<input type=\"checkbox\" class=\"task-list-item-checkbox\" "
+                "disabled"
+            ).append(
+                li->task_mark == 'x' || li->task_mark == 'X' ? " checked" : ""
+            ).append(">");
 
-        elem = node ? node->ToElement() : nullptr;
+            break;
+        }
+        case MD_BLOCK_H: {
+            heading_level = static_cast<const MD_BLOCK_H_DETAIL *>(
+                detail
+            )->level;
+
+            html.append(std::format("<h{}>", heading_level));
+
+            if (depth == 1) {
+                heading_start = html.size();
+                heading_slots = section().slots.size();
+                in_heading = true;
+                title.clear();
+            }
 
-        if (!elem) {
-            die();
+            break;
         }
+        case MD_BLOCK_CODE: {
+            const MD_ATTRIBUTE &lang{
+                static_cast<const MD_BLOCK_CODE_DETAIL *>(detail)->lang
+            };
 
-        int id = 0;
+            html.append("<pre><code");
 
-        {
-            const char *title = sibling_element->GetText();
-            const char *name = sibling_element->Name();
-
-            if (!title || !name) return 0;
-
-            int level = (
-                !strcasecmp("h1", name) ? 1 :
-                !strcasecmp("h2", name) ? 2 :
-                !strcasecmp("h3", name) ? 3 :
-                !strcasecmp("h4", name) ? 4 :
-                !strcasecmp("h5", name) ? 5 :
-                !strcasecmp("h6", name) ? 6 : 7
-            );
+            if (lang.text && lang.size) {
+                html.append(" class=\"language-");
+                escape(html, attribute(lang, false), true);
+                html.append("\"");
+            }
 
-            id = next_id++;
+            html.append(">");
 
-            add_heading(id, level, title, level_to_id);
+            break;
         }
+        case MD_BLOCK_TH:
+        case MD_BLOCK_TD: {
+            MD_ALIGN align = static_cast<const MD_BLOCK_TD_DETAIL *>(
+                detail
+            )->align;
+
+            html.append(type == MD_BLOCK_TH ? "<th" : "<td").append(
+                align == MD_ALIGN_LEFT   ? " style=\"text-align: left;\""   :
+                align == MD_ALIGN_CENTER ? " style=\"text-align: center;\"" :
+                align == MD_ALIGN_RIGHT  ? " style=\"text-align: right;\""  : ""
+            ).append(">");
 
-        if (id <= 0) {
-            die();
+            break;
         }
+        default: break;
+    }
 
-        if (!get_heading_data(id)) {
-            die();
-        }
+    return 0;
+}
 
-        std::string *anchor_id = get_heading_data(id)->identifier;
+inline int MDMA::markdown_type::leave_block(MD_BLOCKTYPE type, void *) {
+    flush_html();
 
-        elem->SetAttribute("id", anchor_id->c_str());
-        elem->SetAttribute(
-            "href", std::string("#").append(*anchor_id).c_str()
-        );
-        elem->SetAttribute("target", "_self");
+    if (type == MD_BLOCK_DOC) {
+        if (in_section) {
+            section().html.append("</article>");
+        }
 
-        const tinyxml2::XMLNode *child = sibling->FirstChild();
+        return 0;
+    }
 
-        for (; child; child = child->NextSibling()) {
-            tinyxml2::XMLNode *n = child->DeepClone(&sections.back());
+    if (in_section) {
+        std::string &html = section().html;
+
+        switch (type) {
+            case MD_BLOCK_QUOTE: html.append("</blockquote>\n");  break;
+            case MD_BLOCK_UL:    html.append("</ul>\n");          break;
+            case MD_BLOCK_OL:    html.append("</ol>\n");          break;
+            case MD_BLOCK_LI:    html.append("</li>\n");          break;
+            case MD_BLOCK_CODE:  html.append("</code></pre>\n");  break;
+            case MD_BLOCK_P:     html.append("</p>\n");           break;
+            case MD_BLOCK_TABLE: html.append("</table>\n");       break;
+            case MD_BLOCK_THEAD: html.append("</thead>\n");       break;
+            case MD_BLOCK_TBODY: html.append("</tbody>\n");       break;
+            case MD_BLOCK_TR:    html.append("</tr>\n");          break;
+            case MD_BLOCK_TH:    html.append("</th>\n");          break;
+            case MD_BLOCK_TD:    html.append("</td>\n");          break;
+            case MD_BLOCK_H: {
+                if (depth == 1 && in_heading) {
+                    finish_heading();
+                }
 
-            if (!n) {
-                die();
-            }
+                html.append(std::format("</h{}>\n", heading_level));
 
-            elem->InsertEndChild(n);
+                break;
+            }
+            default: break;
         }
     }
 
-    for (tinyxml2::XMLDocument &section : sections) {
-        patch_tables(section);
-        embed_videos(section);
-    }
+    --depth;
 
-    return true;
+    return 0;
 }
 
-inline bool MDMA::inflate_framework(const TidyDoc framework) {
-    dump_inflated(framework).swap(assembly_buffer);
-    dump_enhanced(assembly_buffer).swap(assembly_buffer);
-    dump_repaired(assembly_buffer).swap(assembly_buffer);
+inline int MDMA::markdown_type::enter_span(MD_SPANTYPE type, void *detail) {
+    flush_html();
 
-    return true;
-}
+    bool inside_image = image_nesting > 0;
 
-inline std::string MDMA::dump_inflated(const TidyDoc framework) {
-    return dump(
-        framework, tidyGetRoot(framework),
-        [&](
-            const TidyNode &node, std::string *value,
-            std::map<std::string, std::string> &
-        ) {
-            if (!value) return;
-
-            if (tidyNodeGetId(node) == TidyTag_HEAD) {
-                std::string buf(
-                    std::string(
-                        "<meta name=\"generator\" content=\""
-                    ).append(MDMA::CAPTION).append(" version ").append(
-                        MDMA::VERSION
-                    ).append("\">").append(*value)
-                );
+    if (type == MD_SPAN_IMG) {
+        ++image_nesting;
+    }
 
-                buf.append(
-                    "<style class=\"MDMA-AUTOGENERATED\">"
-                ).append(dump_style(headings)).append("</style>");
+    if (inside_image || !in_section) {
+        // Only the plain text of an image label goes into its alt attribute.
+        return 0;
+    }
 
-                value->swap(buf);
+    if (!links.empty() && type != MD_SPAN_IMG) {
+        links.back().other = true;
+    }
 
-                return;
+    std::string &html = section().html;
+
+    switch (type) {
+        case MD_SPAN_EM:     html.append("<em>");     break;
+        case MD_SPAN_STRONG: html.append("<strong>"); break;
+        case MD_SPAN_U:      html.append("<u>");      break;
+        case MD_SPAN_CODE:   html.append("<code>");   break;
+        case MD_SPAN_DEL:    html.append("<del>");    break;
+        case MD_SPAN_LATEXMATH: html.append("<x-equation>"); break;
+        case MD_SPAN_LATEXMATH_DISPLAY: {
+            html.append("<x-equation type=\"display\">");
+            break;
+        }
+        case MD_SPAN_WIKILINK: {
+            html.append("<x-wikilink data-target=\"");
+            escape(
+                html, attribute(
+                    static_cast<const MD_SPAN_WIKILINK_DETAIL *>(
+                        detail
+                    )->target, false
+                ), true
+            );
+            html.append("\">");
+            break;
+        }
+        case MD_SPAN_A: {
+            const MD_SPAN_A_DETAIL *a{
+                static_cast<const MD_SPAN_A_DETAIL *>(detail)
+            };
+
+            links.emplace_back(
+                link_type{
+                    .start  = html.size(),
+                    .slots  = section().slots.size(),
+                    .href   = attribute(a->href, true),
+                    .images = 0,
+                    .other  = false
+                }
+            );
+
+            html.append("<a href=\"");
+            escape(html, links.back().href, true);
+            html.append("\" target=\"").append(
+                links.back().href.starts_with('#') ? "_self" : "_blank"
+            ).append("\"");
+
+            if (a->title.text) {
+                html.append(" title=\"");
+                escape(html, attribute(a->title, false), true);
+                html.append("\"");
             }
 
-            const char *attr_val{
-                tidyAttrValue(tidyAttrGetById(node, TidyAttr_ID))
+            html.append(">");
+
+            break;
+        }
+        case MD_SPAN_IMG: {
+            const MD_SPAN_IMG_DETAIL *img{
+                static_cast<const MD_SPAN_IMG_DETAIL *>(detail)
             };
 
-            if (!attr_val) {
-                return;
+            if (!links.empty()) {
+                ++links.back().images;
             }
 
-            if (!strcmp("MDMA-CONTENT", attr_val)) {
-                dump(sections).swap(*value);
-            }
-            else if (!strcmp("MDMA-AGENDA", attr_val)) {
-                dump_agenda(headings).swap(*value);
-            }
-            else if (!strcmp("MDMA-YEAR", attr_val)) {
-                std::format("{:%Y}", std::chrono::system_clock::now()).swap(
-                    *value
-                );
+            image.clear();
+            image.set("src", attribute(img->src, true));
+
+            if (img->title.text) {
+                image.set("title", attribute(img->title, false));
             }
 
-            return;
+            alt.clear();
+
+            break;
         }
-    );
+        default: break;
+    }
+
+    return 0;
 }
 
-inline std::string MDMA::dump_enhanced(const std::string &html) {
-    size_t heading_counter = 0;
-    TidyDoc doc = tidyCreate();
+inline int MDMA::markdown_type::leave_span(MD_SPANTYPE type, void *) {
+    flush_html();
 
-    setup(doc);
-    tidyOptSetValue(
-        doc, TidyMuteReports,
-        std::string(tidyOptGetValue(doc, TidyMuteReports)).append(
-            ",DISCARDING_UNEXPECTED"
-        ).c_str()
-    );
-    tidyParseString(doc, html.c_str());
-
-    std::string enhanced{
-        dump(
-            doc, tidyGetRoot(doc),
-            [&](
-                const TidyNode &node, std::string *value,
-                std::map<std::string, std::string> &attributes
-            ) {
-                TidyTagId node_id = tidyNodeGetId(node);
-
-                switch (node_id) {
-                    case TidyTag_A: {
-                        if (value && tidyNodeIsHeader(tidyGetParent(node))) {
-                            value->append(
-                                "<style class=\"MDMA-AUTOGENERATED\">:root {"
-                                "--MDMA-PAGE-LOADED: "
-                            ).append(
-                                std::to_string(
-                                    (100*(++heading_counter)) / headings.size()
-                                )
-                            ).append("%;}</style>");
-                        }
+    if (type == MD_SPAN_IMG) {
+        --image_nesting;
+    }
 
-                        break;
-                    }
-                    case TidyTag_BODY: {
-                        if (value) {
-                            value->append(
-                                "<style class=\"MDMA-AUTOGENERATED\">:root {"
-                                "--MDMA-LOADER-OPACITY: 0%;}</style>"
-                            );
-                        }
+    if (image_nesting > 0 || !in_section) {
+        return 0;
+    }
 
-                        break;
-                    }
-                    case TidyTag_LINK: {
-                        modify_link_attributes(attributes);
-                        break;
-                    }
-                    case TidyTag_IMG: {
-                        modify_image_attributes(attributes);
-                        break;
-                    }
-                    default: break;
+    std::string &html = section().html;
+
+    switch (type) {
+        case MD_SPAN_EM:     html.append("</em>");     break;
+        case MD_SPAN_STRONG: html.append("</strong>"); break;
+        case MD_SPAN_U:      html.append("</u>");      break;
+        case MD_SPAN_CODE:   html.append("</code>");   break;
+        case MD_SPAN_DEL:    html.append("</del>");    break;
+        case MD_SPAN_WIKILINK: html.append("</x-wikilink>"); break;
+        case MD_SPAN_LATEXMATH:
+        case MD_SPAN_LATEXMATH_DISPLAY: html.append("</x-equation>"); break;
+        case MD_SPAN_A: {
+            finish_link();
+            break;
+        }
+        case MD_SPAN_IMG: {
+            image.set("alt", alt);
+
+            section().slots.emplace_back(
+                section_slot_type{
+                    .offset     = html.size(),
+                    .tag        = "img",
+                    .attributes = image
                 }
-            }
-        )
-    };
+            );
 
-    tidyRelease(doc);
+            break;
+        }
+        default: break;
+    }
 
-    return enhanced;
+    return 0;
 }
 
-inline std::string MDMA::dump_repaired(const std::string &html) {
-    TidyDoc doc = tidyCreate();
-
-    setup(doc);
-    tidyOptSetValue(
-        doc, TidyMuteReports,
-        std::string(tidyOptGetValue(doc, TidyMuteReports)).append(
-            ",DISCARDING_UNEXPECTED"
-        ).c_str()
-    );
+inline int MDMA::markdown_type::text(MD_TEXTTYPE type, std::string_view text) {
+    if (!in_section) {
+        return 0;
+    }
 
-    if (!cfg.minify) {
-        tidyOptSetInt(doc, TidyIndentContent, yes);
-        tidyOptSetInt(doc, TidyIndentSpaces, 2);
-        tidyOptSetInt(doc, TidyVertSpace, yes);
-        tidyOptSetInt(doc, TidyWrapLen, 68);
+    if (image_nesting > 0) {
+        plain(type, text, alt);
+        return 0;
     }
 
-    tidyParseString(doc, html.c_str());
-    tidyCleanAndRepair(doc);
 
-    tidyBufClear(&htmltidy_buffer);
-    tidySaveBuffer(doc, &htmltidy_buffer);
+    if (in_heading) {
+        plain(type, text, title);
+    }
 
-    tidyRelease(doc);
+    if (!links.empty() && type != MD_TEXT_SOFTBR
+    &&  text.find_first_not_of(" \t\r\n") != text.npos) {
+        links.back().other = true;
+    }
 
-    return std::string((const char *) htmltidy_buffer.bp, htmltidy_buffer.size);
-}
+    if (type == MD_TEXT_HTML) {
+        // The raw HTML comes line by line, so a tag may be split across the
+        // pieces. They are scanned together once something else comes.
+        raw_html.append(text);
+        return 0;
+    }
 
-inline std::string MDMA::dump(
-    const TidyDoc doc, const TidyNode parent,
-    std::function<
-        void(
-            const TidyNode &, std::string *,
-            std::map<std::string, std::string> &
-        )
-    > node_callback
-) const {
-    std::string result;
-	TidyAttr attr;
-	TidyNode child;
-    ctmbstr name;
+    flush_html();
 
-    std::map<std::string, std::string> attributes;
+    std::string &html = section().html;
 
-    for (child = tidyGetChild(parent); child; child = tidyGetNext(child)) {
-	    TidyNodeType node_type = tidyNodeGetType(child);
+    switch (type) {
+        case MD_TEXT_NULLCHAR: html.append("\xEF\xBF\xBD"); break;
+        case MD_TEXT_BR:       html.append("<br>\n");       break;
+        case MD_TEXT_SOFTBR:   html.append("\n");           break;
+        case MD_TEXT_ENTITY: {
+            std::string decoded{decode_entity(text)};
 
-        attributes.clear();
+            if (decoded == text) {
+                // The unknown entities are left for the browser to resolve.
+                html.append(text);
+            }
+            else escape(html, decoded, false);
 
-        switch (node_type) {
-            case TidyNode_Start:
-            case TidyNode_StartEnd: {
-                if ((name = tidyNodeGetName(child)) == nullptr) {
-                    break;
-                }
+            break;
+        }
+        default: {
+            escape(html, text, false);
+            break;
+        }
+    }
 
-                result.append("<").append((const char *) name);
+    return 0;
+}
 
-                attr = tidyAttrFirst(child);
+inline void MDMA::markdown_type::insert(
+    size_t offset, size_t first_slot, std::string_view str
+) {
+    section().html.insert(offset, str);
 
-                for (; attr; attr = tidyAttrNext(attr)) {
-                    if (!tidyAttrValue(attr)) {
-                        attributes[tidyAttrName(attr)].assign(1, '\0');
-                        continue;
-                    }
+    for (size_t i=first_slot; i<section().slots.size(); ++i) {
+        section().slots[i].offset += str.size();
+    }
+}
 
-                    attributes[tidyAttrName(attr)].assign(tidyAttrValue(attr));
-                }
+inline void MDMA::markdown_type::finish_heading() {
+    size_t index{
+        mdma.add_heading(int(heading_level), title.c_str(), open_headings)
+    };
 
-                if (node_type == TidyNode_StartEnd) {
-                    node_callback(child, nullptr, attributes);
+    const std::string &identifier = mdma.headings[index].identifier;
+    std::string anchor{"<a href=\"#"};
 
-                    result.append(dump(attributes)).append("></").append(
-                        name
-                    ).append(">");
-                }
-                else {
-                    std::string val{dump(doc, child, node_callback)};
+    escape(anchor, identifier, true);
+    anchor.append("\" id=\"");
+    escape(anchor, identifier, true);
+    anchor.append("\" target=\"_self\">");
 
-                    node_callback(child, &val, attributes);
+    insert(heading_start, heading_slots, anchor);
 
-                    result.append(dump(attributes)).append(">").append(
-                        val
-                    ).append("</").append(name).append(">");
-                }
+    section().slots.emplace_back(
+        section_slot_type{
+            .offset     = section().html.size(),
+            .tag        = {},
+            .attributes = {}
+        }
+    );
 
-                break;
-            }
-            case TidyNode_End: {
-                if ((name = tidyNodeGetName(child)) == nullptr) {
-                    break;
-                }
+    section().html.append("</a>");
+    in_heading = false;
+}
 
-                result.append("</").append(name).append(">");
+inline void MDMA::markdown_type::finish_link() {
+    static constexpr const std::string_view video_prefix{
+        "https://www.youtube.com/watch?"
+    };
 
-                break;
-            }
-            case TidyNode_Text: {
-                TidyTagId parent_node_id = tidyNodeGetId(parent);
-                TidyBuffer buf;
+    link_type link{std::move(links.back())};
 
-                tidyBufInit(&buf);
-                tidyNodeGetValue(doc, child, &buf);
+    links.pop_back();
+    section().html.append("</a>");
 
-                if (buf.bp) {
-                    if (parent_node_id == TidyTag_SCRIPT
-                    ||  parent_node_id == TidyTag_STYLE) {
-                        result.append((const char *) buf.bp, buf.size);
-                    }
-                    else {
-                        tinyxml2::XMLPrinter printer(nullptr, true);
-                        printer.PushText((const char *) buf.bp);
-                        result.append(printer.CStr());
-                    }
-                }
+    if (link.images != 1 || link.other
+    ||  link.href.size() < video_prefix.size()
+    ||  strncasecmp(
+            link.href.c_str(), video_prefix.data(), video_prefix.size()
+        )) {
+        return;
+    }
 
-                tidyBufFree(&buf);
+    std::string video_id{uri_param_value(link.href.c_str(), "v")};
 
-                break;
-            }
-            case TidyNode_Comment: {
-                TidyBuffer buf;
-                tidyBufInit(&buf);
+    if (video_id.empty()) {
+        return;
+    }
 
-                tidyNodeGetValue(doc, child, &buf);
+    insert(link.start, link.slots, "<div class=\"MDMA-VIDEO-CONTAINER\">");
+    section().repair = true;
 
-                if (buf.bp) {
-                    result.append("<!--").append(
-                        (const char *) buf.bp, buf.size
-                    ).append("-->");
-                }
+    section().html.append(
+        "<iframe allowfullscreen=\"\" loading=\"lazy\" "
+        "src=\"https://www.youtube-nocookie.com/embed/"
+    );
+    escape(section().html, video_id, true);
+    section().html.append(
+        "\" style=\"color-scheme: normal;\"></iframe></div>"
+    );
+}
 
-                tidyBufFree(&buf);
+inline void MDMA::markdown_type::flush_html() {
+    if (!raw_html.empty()) {
+        scan_html(raw_html);
+        raw_html.clear();
+    }
+}
+
+inline void MDMA::markdown_type::scan_html(std::string_view text) {
+    // Raw HTML is copied as it is, except for the images and stylesheets that
+    // become slots and the links that get a target like the markdown links.
+    // The tags in comments, scripts and styles are left alone.
+
+    std::string &html = section().html;
+    size_t done = 0;
+    size_t lt = 0;
+
+    section().repair = true;
+
+    while (lt < text.size()) {
+        if (!html_skip.empty()) {
+            auto it{
+                std::search(
+                    text.begin() + lt, text.end(),
+                    html_skip.begin(), html_skip.end(),
+                    [](char a, char b) {
+                        return tolower((unsigned char) a) == b;
+                    }
+                )
+            };
 
+            if (it == text.end()) {
                 break;
             }
-            case TidyNode_CDATA: {
-                TidyBuffer buf;
-                tidyBufInit(&buf);
-                tidyNodeGetValue(doc, child, &buf);
 
-                if (buf.bp) {
-                    result.append("<![CDATA[").append(
-                        (const char *) buf.bp, buf.size
-                    ).append("]]>");
-                }
+            lt = size_t(it - text.begin()) + html_skip.size();
+            html_skip.clear();
+            continue;
+        }
 
-                tidyBufFree(&buf);
-                break;
-            }
-            case TidyNode_DocType: {
-                result.append("<!DOCTYPE ").append(tidyNodeGetName(child));
+        if ((lt = text.find('<', lt)) == text.npos) {
+            break;
+        }
 
-                attr = tidyAttrFirst(child);
+        if (text.substr(lt).starts_with("<!--")) {
+            html_skip = "-->";
+            lt += 4;
+            continue;
+        }
 
-                for (; attr; attr = tidyAttrNext(attr)) {
-                    if (!tidyAttrValue(attr)) {
-                        attributes[tidyAttrName(attr)].assign(1, '\0');
-                        continue;
-                    }
+        size_t end = ++lt;
 
-                    attributes[tidyAttrName(attr)].assign(tidyAttrValue(attr));
-                }
+        while (end < text.size() && isalnum((unsigned char) text[end])) {
+            ++end;
+        }
 
-                node_callback(child, nullptr, attributes);
+        std::string name(text.substr(lt, end - lt));
 
-                result.append(dump(attributes)).append(">");
+        for (char &c : name) {
+            c = char(tolower((unsigned char) c));
+        }
 
-                break;
-            }
-            default: {
-                TidyBuffer buf;
-                tidyBufInit(&buf);
-                tidyNodeGetValue(doc, child, &buf);
+        if (end < text.size() && text[end] != '>' && text[end] != '/'
+        &&  !isspace((unsigned char) text[end])) {
+            continue;
+        }
 
-                if (buf.bp) {
-                    result.append((const char *) buf.bp, buf.size);
+        if (name == "script" || name == "style") {
+            html_skip = "</" + name;
+            lt = end;
+            continue;
+        }
+
+        if (name != "img" && name != "link" && name != "a") {
+            continue;
+        }
+
+        attribute_list_type attributes;
+        size_t gt = parse_tag(text, end, attributes);
+
+        if (gt == text.npos) {
+            break;
+        }
+
+        if (name != "a") {
+            html.append(text.substr(done, lt - 1 - done));
+
+            section().slots.emplace_back(
+                section_slot_type{
+                    .offset     = html.size(),
+                    .tag        = name,
+                    .attributes = attributes
                 }
+            );
 
-                tidyBufFree(&buf);
+            done = gt + 1;
+        }
+        else if (!attributes.contains("target") && text[gt - 1] != '/') {
+            html.append(text.substr(done, gt - done)).append(
+                attributes.get("href").starts_with('#') ? (
+                    " target=\"_self\""
+                ) : " target=\"_blank\""
+            );
+
+            done = gt;
+        }
+
+        lt = gt;
+    }
+
+    html.append(text.substr(done));
+}
+
+inline size_t MDMA::markdown_type::parse_tag(
+    std::string_view text, size_t pos, attribute_list_type &attributes
+) {
+    auto is_space{
+        [](char c) { return isspace((unsigned char) c) != 0; }
+    };
+
+    while (pos < text.size()) {
+        if (is_space(text[pos]) || text[pos] == '/') {
+            ++pos;
+            continue;
+        }
+
+        if (text[pos] == '>') {
+            return pos;
+        }
+
+        size_t name_end = pos;
+
+        while (name_end < text.size() && !is_space(text[name_end])
+        && text[name_end] != '=' && text[name_end] != '>'
+        && text[name_end] != '/') {
+            ++name_end;
+        }
+
+        if (name_end == pos) {
+            ++pos;
+            continue;
+        }
+
+        std::string name(text.substr(pos, name_end - pos));
+
+        for (char &c : name) {
+            c = char(tolower((unsigned char) c));
+        }
+
+        for (pos = name_end; pos < text.size() && is_space(text[pos]); ++pos);
+
+        if (pos >= text.size() || text[pos] != '=') {
+            attributes.set_boolean(name);
+            continue;
+        }
 
+        for (++pos; pos < text.size() && is_space(text[pos]); ++pos);
+
+        if (pos >= text.size()) {
+            break;
+        }
+
+        size_t value_end;
+        std::string_view value;
+
+        if (text[pos] == '"' || text[pos] == '\'') {
+            if ((value_end = text.find(text[pos], pos + 1)) == text.npos) {
                 break;
             }
+
+            value = text.substr(pos + 1, value_end - pos - 1);
+            pos = value_end + 1;
+        }
+        else {
+            for (value_end = pos; value_end < text.size()
+            && !is_space(text[value_end]) && text[value_end] != '>';
+            ++value_end);
+
+            value = text.substr(pos, value_end - pos);
+            pos = value_end;
         }
+
+        attributes.set(name, unescape(value));
     }
 
-    return result;
+    return text.npos;
 }
 
-inline std::string MDMA::dump(
-    const std::map<std::string, std::string> &attributes
-) const {
-    tinyxml2::XMLPrinter printer(nullptr, true);
+inline std::string MDMA::markdown_type::attribute(
+    const MD_ATTRIBUTE &attr, bool url
+) {
+    std::string result;
+
+    if (!attr.text || !attr.size) {
+        return result;
+    }
+
+    for (size_t i=0; attr.substr_offsets[i] < attr.size; ++i) {
+        std::string_view str(
+            attr.text + attr.substr_offsets[i],
+            attr.substr_offsets[i+1] - attr.substr_offsets[i]
+        );
 
-    std::string flags;
+        std::string decoded{
+            attr.substr_types[i] == MD_TEXT_NULLCHAR ? "\xEF\xBF\xBD" :
+            attr.substr_types[i] == MD_TEXT_ENTITY ? (
+                decode_entity(str)
+            ) : std::string(str)
+        };
 
-    for (const auto &[key, value] : attributes) {
-        if (value.size() == 1 && value.at(0) == '\0') {
-            flags.append(" ").append(key);
+        if (url) {
+            escape_url(result, decoded);
         }
         else {
-            printer.PushAttribute(key.c_str(), value.c_str());
+            result.append(decoded);
         }
     }
 
-    return std::string(printer.CStr()).append(flags);
+    return result;
 }
 
-inline std::string MDMA::dump_agenda(
-    const std::map<
-        int, std::tuple<heading_data, int, std::string, std::string>
-    > &headings
-) const {
-    tinyxml2::XMLDocument doc;
+inline void MDMA::markdown_type::plain(
+    MD_TEXTTYPE type, std::string_view text, std::string &dst
+) {
+    switch (type) {
+        case MD_TEXT_NULLCHAR: dst.append("\xEF\xBF\xBD");  break;
+        case MD_TEXT_BR:
+        case MD_TEXT_SOFTBR:   dst.append(" ");             break;
+        case MD_TEXT_ENTITY:   dst.append(decode_entity(text)); break;
+        case MD_TEXT_HTML:                                  break;
+        default:               dst.append(text);            break;
+    }
+}
 
-    doc.InsertFirstChild(doc.NewElement("div"));
+inline bool MDMA::inflate_framework() {
+    // The framework and the sections are enhanced while they are dumped, so
+    // the only document parsed after this point is the one to be repaired.
+    // The compiled framework and the rendered markdown are well formed, so
+    // that parse is skipped when the output is minified and no section has
+    // raw HTML or an embedded video, which tidy has to repair.
 
-    std::map<int, tinyxml2::XMLElement*> groups{{0, doc.RootElement()}};
+    auto start = std::chrono::steady_clock::now();
 
-    for (const auto &p : headings) {
-        int parent_id = *(std::get<0>(p.second).parent_id);
-        tinyxml2::XMLElement *container = std::prev(groups.end())->second;
+    {
+        stage_timer_type timer(*this, "assets");
 
-        if (groups.count(parent_id)) {
-            container = groups.at(parent_id);
+        recall_sections();
+        prefetch();
+        preload_images();
+    }
 
-            while (!groups.empty()) {
-                int group_id = std::prev(groups.end())->first;
+    auto loaded = std::chrono::steady_clock::now();
 
-                if (group_id != parent_id) {
-                    groups.erase(group_id);
-                    continue;
+    // The framework is kept compiled, so the buffer can be reused.
+    assembly_buffer.clear();
+    dump_inflated(assembly_buffer);
+
+    auto inflated = std::chrono::steady_clock::now();
+
+    if (!cfg.minify || std::any_of(
+        sections.begin(), sections.end(),
+        [](const section_type &section) { return section.repair; }
+    )) {
+        dump_repaired(assembly_buffer).swap(assembly_buffer);
+    }
+
+    auto repaired = std::chrono::steady_clock::now();
+
+    if (cfg.verbose) {
+        using milliseconds = std::chrono::duration<double, std::milli>;
+
+        log(
+            "Loaded assets in %.3f ms, inflated in %.3f ms, "
+            "repaired in %.3f ms.",
+            milliseconds(loaded - start).count(),
+            milliseconds(inflated - loaded).count(),
+            milliseconds(repaired - inflated).count()
+        );
+    }
+
+    return true;
+}
+
+inline void MDMA::dump_inflated(std::string &output) {
+    stage_timer_type timer(*this, "inflate");
+    size_t heading_counter = 0;
+    std::string agenda;
+    std::string style;
+    attribute_list_type attributes;
+    size_t offset = 0;
+
+    {
+        stage_timer_type agenda_timer(*this, "agenda");
+        dump(headings, agenda, style);
+        agenda_timer.bytes_out = agenda.size() + style.size();
+    }
+
+    for (const framework_slot_type &slot : framework->slots) {
+        output.append(framework->html, offset, slot.offset - offset);
+        offset = slot.offset;
+
+        switch (slot.kind) {
+            case SLOT_ASSET: {
+                attributes = slot.attributes;
+
+                if (slot.tag == "img") {
+                    modify_image_attributes(attributes);
                 }
+                else modify_link_attributes(attributes);
+
+                output.append("<").append(slot.tag);
+                dump(attributes, output);
+                output.append(">");
 
                 break;
             }
-        }
-        else {
-            tinyxml2::XMLNode *node = container->InsertEndChild(
-                doc.NewElement("div")
-            );
+            case SLOT_CONTENT: {
+                stage_timer_type sections_timer(*this, "sections");
+                size_t length = output.size();
 
-            tinyxml2::XMLElement *elem = node ? node->ToElement() : nullptr;
+                dump(sections, heading_counter, output);
+                sections_timer.bytes_out = output.size() - length;
 
-            if (elem) {
-                groups.emplace(parent_id, elem);
-                container = elem;
+                break;
+            }
+            case SLOT_AGENDA: output.append(agenda); break;
+            case SLOT_YEAR: {
+                output.append(
+                    std::format("{:%Y}", std::chrono::system_clock::now())
+                );
+
+                break;
+            }
+            case SLOT_STYLE: {
+                output.append(
+                    "<style class=\"MDMA-AUTOGENERATED\">"
+                ).append(style).append("</style>");
+
+                break;
+            }
+            case SLOT_PROGRESS: {
+                output.append(dump_progress(++heading_counter));
+                break;
             }
-            else die();
         }
+    }
 
-        tinyxml2::XMLNode *node = container->InsertEndChild(
-            doc.NewElement("a")
-        );
+    output.append(framework->html, offset);
+    timer.bytes_out = output.size();
+}
 
-        tinyxml2::XMLElement *elem = node ? node->ToElement() : nullptr;
+inline std::string MDMA::dump_repaired(const std::string &html) {
+    stage_timer_type timer(*this, "repair");
+    TidyDoc doc = tidyCreate();
 
-        if (elem) {
-            elem->SetAttribute("target", "_self");
-            elem->SetAttribute(
-                "href",
-                std::string("#").append(
-                    std::get<0>(p.second).identifier->c_str()
-                ).c_str()
-            );
+    timer.bytes_in = html.size();
 
-            elem->InsertNewText(std::get<0>(p.second).title->c_str());
-        }
-        else die();
+    setup(doc);
+    tidyOptSetValue(
+        doc, TidyMuteReports,
+        std::string(tidyOptGetValue(doc, TidyMuteReports)).append(
+            ",DISCARDING_UNEXPECTED"
+        ).c_str()
+    );
+
+    if (!cfg.minify) {
+        tidyOptSetInt(doc, TidyIndentContent, yes);
+        tidyOptSetInt(doc, TidyIndentSpaces, 2);
+        tidyOptSetInt(doc, TidyVertSpace, yes);
+        tidyOptSetInt(doc, TidyWrapLen, 68);
+    }
+
+    {
+        stage_timer_type parse_timer(*this, "repair.parse");
+        parse_timer.bytes_in = html.size();
+        tidyParseString(doc, html.c_str());
     }
 
-    tinyxml2::XMLPrinter printer(nullptr, true);
-    doc.Print(&printer);
+    {
+        stage_timer_type clean_timer(*this, "repair.clean");
+        tidyCleanAndRepair(doc);
+    }
+
+    {
+        stage_timer_type save_timer(*this, "repair.save");
+        tidyBufClear(&htmltidy_buffer);
+        tidySaveBuffer(doc, &htmltidy_buffer);
+        save_timer.bytes_out = htmltidy_buffer.size;
+    }
+
+    tidyRelease(doc);
+
+    // The copy is made while the stage lasts, so that its memory is
+    // accounted to it.
+    std::string xhtml(
+        (const char *) htmltidy_buffer.bp, htmltidy_buffer.size
+    );
+
+    timer.bytes_out = xhtml.size();
 
-    return std::string(printer.CStr());
+    return xhtml;
 }
 
-inline std::string MDMA::dump_style(
-    const std::map<
-        int, std::tuple<heading_data, int, std::string, std::string>
-    > &headings
+inline void MDMA::dump(
+    const TidyDoc doc, const TidyNode parent, std::string &output,
+    std::function<
+        bool(
+            const TidyNode &, dump_phase_type, std::string &,
+            attribute_list_type &
+        )
+    > node_callback
 ) const {
-    std::string agenda_css{
-        ":root {--MDMA-LOADER-OPACITY: 100%; --MDMA-PAGE-LOADED: 0%;}\n"
-    };
+    // The elements whose children are being dumped are kept on an explicit
+    // stack, so that deep documents neither copy every subtree once per level
+    // nor exhaust the call stack.
 
-    size_t heading_counter = 0;
-    std::map<int, std::vector<int>> heading_to_descendants;
+    std::vector<std::pair<TidyNode, ctmbstr>> stack;
+    attribute_list_type attributes;
+    TidyAttr attr;
+    ctmbstr name;
+
+    for (TidyNode child = tidyGetChild(parent); child || !stack.empty();) {
+        if (!child) {
+            auto [node, node_name] = stack.back();
 
-    for (const auto &p : headings) {
-        int parent_id = *(std::get<0>(p.second).parent_id);
+            stack.pop_back();
+            attributes.clear();
+            node_callback(node, DUMP_CLOSING, output, attributes);
+            output.append("</").append(node_name).append(">");
 
-        if (parent_id) {
-            heading_to_descendants[parent_id].emplace_back(p.first);
+            child = tidyGetNext(node);
+            continue;
         }
 
-        std::string *anchor_id = std::get<0>(p.second).identifier;
+        TidyNodeType node_type = tidyNodeGetType(child);
 
-        ++heading_counter;
+        attributes.clear();
 
-        agenda_css.append("body:has(#").append(*anchor_id).append(
-            ":target) #MDMA-AGENDA a[href=\"#"
-        ).append(*anchor_id).append("\"]");
+        switch (node_type) {
+            case TidyNode_Start:
+            case TidyNode_StartEnd: {
+                if ((name = tidyNodeGetName(child)) == nullptr) {
+                    break;
+                }
 
-        if (heading_counter == headings.size()) {
-            agenda_css.append(" {\n").append(
-                "    color: var(--MDMA-AGENDA-TARGET-COLOR);\n}\n"
-            );
-        }
-        else {
-            agenda_css.append(",\n");
-        }
-    }
+                attr = tidyAttrFirst(child);
+
+                for (; attr; attr = tidyAttrNext(attr)) {
+                    attributes.add(tidyAttrName(attr), tidyAttrValue(attr));
+                }
 
-    for (auto &p : heading_to_descendants) {
-        std::vector<int> &descendants = p.second;
+                node_callback(child, DUMP_ATTRIBUTES, output, attributes);
+
+                output.append("<").append((const char *) name);
+                dump(attributes, output);
+                output.append(">");
+
+                attributes.clear();
+
+                if (node_callback(child, DUMP_CONTENT, output, attributes)
+                && node_type == TidyNode_Start && tidyGetChild(child)) {
+                    stack.emplace_back(child, name);
+                    child = tidyGetChild(child);
+                    continue;
+                }
 
-        for (size_t i=0; i<descendants.size(); ++i) {
-            int descendant_id = descendants[i];
+                node_callback(child, DUMP_CLOSING, output, attributes);
+                output.append("</").append(name).append(">");
 
-            if (heading_to_descendants.count(descendant_id)) {
-                for (int id : heading_to_descendants[descendant_id]) {
-                    descendants.emplace_back(id);
+                break;
+            }
+            case TidyNode_End: {
+                if ((name = tidyNodeGetName(child)) == nullptr) {
+                    break;
                 }
+
+                output.append("</").append(name).append(">");
+
+                break;
             }
-        }
-    }
+            case TidyNode_Text: {
+                TidyTagId parent_node_id = tidyNodeGetId(
+                    stack.empty() ? parent : stack.back().first
+                );
+                TidyBuffer buf;
+
+                tidyBufInit(&buf);
+                tidyNodeGetValue(doc, child, &buf);
 
-    while (!heading_to_descendants.empty()) {
-        int heading_id = heading_to_descendants.begin()->first;
-        std::vector<int> &descendants = heading_to_descendants.at(heading_id);
+                if (buf.bp) {
+                    if (parent_node_id == TidyTag_SCRIPT
+                    ||  parent_node_id == TidyTag_STYLE) {
+                        output.append((const char *) buf.bp, buf.size);
+                    }
+                    else {
+                        escape(
+                            output,
+                            std::string_view((const char *) buf.bp, buf.size),
+                            false
+                        );
+                    }
+                }
 
-        if (!get_heading_data(heading_id)) die();
+                tidyBufFree(&buf);
 
-        agenda_css.append("body:not(\n");
-        agenda_css.append("    :has(#").append(
-            *(get_heading_data(heading_id)->identifier)
-        ).append(":target),\n");
+                break;
+            }
+            case TidyNode_Comment: {
+                TidyBuffer buf;
+                tidyBufInit(&buf);
+
+                tidyNodeGetValue(doc, child, &buf);
+
+                if (buf.bp) {
+                    output.append("<!--").append(
+                        (const char *) buf.bp, buf.size
+                    ).append("-->");
+                }
+
+                tidyBufFree(&buf);
+
+                break;
+            }
+            case TidyNode_CDATA: {
+                TidyBuffer buf;
+                tidyBufInit(&buf);
+                tidyNodeGetValue(doc, child, &buf);
+
+                if (buf.bp) {
+                    output.append("<![CDATA[").append(
+                        (const char *) buf.bp, buf.size
+                    ).append("]]>");
+                }
+
+                tidyBufFree(&buf);
+                break;
+            }
+            case TidyNode_DocType: {
+                output.append("<!DOCTYPE ").append(tidyNodeGetName(child));
+
+                attr = tidyAttrFirst(child);
+
+                for (; attr; attr = tidyAttrNext(attr)) {
+                    attributes.add(tidyAttrName(attr), tidyAttrValue(attr));
+                }
+
+                node_callback(child, DUMP_ATTRIBUTES, output, attributes);
+
+                dump(attributes, output);
+                output.append(">");
+
+                break;
+            }
+            default: {
+                TidyBuffer buf;
+                tidyBufInit(&buf);
+                tidyNodeGetValue(doc, child, &buf);
+
+                if (buf.bp) {
+                    output.append((const char *) buf.bp, buf.size);
+                }
+
+                tidyBufFree(&buf);
+
+                break;
+            }
+        }
+
+        child = tidyGetNext(child);
+    }
+}
+
+inline void MDMA::dump(
+    attribute_list_type &attributes, std::string &output
+) const {
+    attributes.sort();
+
+    for (size_t i=0; i<attributes.size(); ++i) {
+        const attribute_type &attr = attributes[i];
+
+        output.append(" ").append(attribute_list_type::name_of(attr));
+
+        if (attr.boolean) {
+            continue;
+        }
+
+        output.append("=\"");
+        escape(output, attribute_list_type::value_of(attr), true);
+        output.append("\"");
+    }
+}
+
+inline void MDMA::escape(
+    std::string &output, std::string_view text, bool attribute
+) {
+    size_t begin = 0;
+
+    for (size_t i=0; i<text.size(); ++i) {
+        const char *entity = nullptr;
+
+        switch (text[i]) {
+            case '&': entity = "&amp;"; break;
+            case '<': entity = "&lt;";  break;
+            case '>': entity = "&gt;";  break;
+            case '"': entity = attribute ? "&quot;" : nullptr; break;
+            case '\'': entity = attribute ? "&apos;" : nullptr; break;
+            default: break;
+        }
+
+        if (entity) {
+            output.append(text.substr(begin, i - begin)).append(entity);
+            begin = i + 1;
+        }
+    }
+
+    output.append(text.substr(begin));
+}
+
+inline void MDMA::escape_url(std::string &output, std::string_view url) {
+    // The ampersands are kept, they get escaped along with the attribute.
+    static constexpr const std::string_view safe{"~-_.+!*(),%#@?=;:/$&"};
+    static constexpr const char *hex = "0123456789ABCDEF";
+
+    for (char c : url) {
+        if (isalnum((unsigned char) c) || safe.find(c) != safe.npos) {
+            output.append(1, c);
+            continue;
+        }
+
+        output.append(1, '%').append(
+            1, hex[((unsigned char) c) >> 4]
+        ).append(1, hex[((unsigned char) c) & 0xf]);
+    }
+}
+
+inline std::string MDMA::decode_entity(std::string_view entity) {
+    // The references that HTML does not define are returned as they are.
+
+    if (entity.size() < 3 || entity.front() != '&' || entity.back() != ';') {
+        return std::string(entity);
+    }
+
+    std::string_view name{entity.substr(1, entity.size() - 2)};
+
+    if (name.front() != '#') {
+        std::string_view text{html_entity(name)};
+
+        return std::string(text.empty() ? entity : text);
+    }
+
+    bool hex = name.size() > 1 && (name[1] == 'x' || name[1] == 'X');
+    std::string_view digits{name.substr(hex ? 2 : 1)};
+    uint32_t cp = 0;
+
+    if (digits.empty()) {
+        return std::string(entity);
+    }
+
+    for (char c : digits) {
+        uint32_t digit = (
+            c >= '0' && c <= '9' ? uint32_t(c - '0') :
+            c >= 'a' && c <= 'f' ? uint32_t(c - 'a' + 10) :
+            c >= 'A' && c <= 'F' ? uint32_t(c - 'A' + 10) : 16
+        );
+
+        if (digit >= (hex ? 16 : 10)) {
+            return std::string(entity);
+        }
+
+        cp = std::min(cp * (hex ? 16 : 10) + digit, uint32_t{0x110000});
+    }
+
+    if (!cp || cp >= 0x110000 || (cp >= 0xD800 && cp <= 0xDFFF)) {
+        cp = 0xFFFD;
+    }
+
+    std::string result;
+
+    if (cp < 0x80) {
+        result.append(1, char(cp));
+    }
+    else if (cp < 0x800) {
+        result.append(1, char(0xC0 | (cp >> 6)));
+        result.append(1, char(0x80 | (cp & 0x3F)));
+    }
+    else if (cp < 0x10000) {
+        result.append(1, char(0xE0 | (cp >> 12)));
+        result.append(1, char(0x80 | ((cp >> 6) & 0x3F)));
+        result.append(1, char(0x80 | (cp & 0x3F)));
+    }
+    else {
+        result.append(1, char(0xF0 | (cp >> 18)));
+        result.append(1, char(0x80 | ((cp >> 12) & 0x3F)));
+        result.append(1, char(0x80 | ((cp >> 6) & 0x3F)));
+        result.append(1, char(0x80 | (cp & 0x3F)));
+    }
+
+    return result;
+}
+
+inline std::string MDMA::unescape(std::string_view text) {
+    std::string result;
+
+    for (size_t i=0; i<text.size();) {
+        size_t semicolon = text[i] == '&' ? text.find(';', i) : text.npos;
+
+        if (semicolon != text.npos && semicolon - i <= 32) {
+            result.append(decode_entity(text.substr(i, semicolon - i + 1)));
+            i = semicolon + 1;
+            continue;
+        }
+
+        result.append(1, text[i++]);
+    }
+
+    return result;
+}
+
+inline void MDMA::dump(
+    const std::vector<heading_type> &headings, std::string &agenda,
+    std::string &style
+) const {
+    // The links to the descendants of a heading are nested in a div right
+    // after its own link in the agenda. The style keeps that div collapsed
+    // unless the target is the heading itself or one of its descendants.
+
+    std::string collapsed;
+
+    agenda.append("<div>");
+    style.append(
+        ":root {--MDMA-LOADER-OPACITY: 100%; --MDMA-PAGE-LOADED: 0%;}\n"
+    );
+
+    for (size_t i=0; i<headings.size(); ++i) {
+        const heading_type &heading = headings[i];
+
+        agenda.append("<a href=\"#");
+        escape(agenda, heading.identifier, true);
+        agenda.append("\" target=\"_self\">");
+        escape(agenda, heading.title, false);
+        agenda.append("</a>");
+
+        if (i) {
+            style.append(",\n");
+        }
+
+        style.append("body:has(#").append(heading.identifier).append(
+            ":target) #MDMA-AGENDA a[href=\"#"
+        ).append(heading.identifier).append("\"]");
+
+        if (heading.end == i + 1) {
+            unsigned next_depth{
+                heading.end < headings.size() ? headings[heading.end].depth : 0
+            };
+
+            for (unsigned depth = next_depth; depth < heading.depth; ++depth) {
+                agenda.append("</div>");
+            }
+
+            continue;
+        }
+
+        agenda.append("<div>");
+
+        if (!collapsed.empty()) {
+            collapsed.append(",\n");
+        }
+
+        collapsed.append("body:not(\n    :has(#").append(
+            heading.identifier
+        ).append(":target),\n");
+
+        // The descendants are listed from the deepest level up and each level
+        // from the last heading back. There are at most six levels, so every
+        // subtree is scanned only a few times.
+
+        unsigned max_depth = heading.depth;
+
+        for (size_t j=i+1; j<heading.end; ++j) {
+            max_depth = std::max(max_depth, headings[j].depth);
+        }
+
+        for (unsigned depth = max_depth; depth > heading.depth; --depth) {
+            for (size_t j = heading.end; j-- > i + 1;) {
+                if (headings[j].depth != depth) {
+                    continue;
+                }
+
+                collapsed.append("    :has(#").append(
+                    headings[j].identifier
+                ).append(":target),\n");
+            }
+        }
+
+        collapsed.erase(collapsed.size() - 2, 1);
+        collapsed.append(") #MDMA-AGENDA a[href=\"#").append(
+            heading.identifier
+        ).append("\"] + div");
+    }
+
+    agenda.append("</div>");
+
+    if (!headings.empty()) {
+        style.append(" {\n    color: var(--MDMA-AGENDA-TARGET-COLOR);\n}\n");
+    }
+
+    if (!collapsed.empty()) {
+        style.append(collapsed).append(
+            " {\n"
+            "    font-size: 0;\n"
+            "    transition: font-size 0.2s ease-out;\n"
+            "}\n"
+        );
+    }
+}
+
+inline void MDMA::dump(
+    std::vector<section_type> &sections, size_t &heading_counter,
+    std::string &output
+) {
+    bool cache_modified = false;
+
+    for (section_type &section : sections) {
+        if (section.fragments.empty()) {
+            enhance(section, section.fragments);
+
+            if (!section.key.empty() && memory) {
+                memory->remember(
+                    memory->sections, section.key, section.fragments
+                );
+            }
+
+            if (!section.key.empty() && !cache_directory.empty()) {
+                std::string record;
+
+                for (const fragment_type &fragment : section.fragments) {
+                    serialize(record, fragment);
+                }
+
+                save_cache(cache_directory / "sections" / section.key, record);
+                cache_modified = true;
+            }
+        }
+
+        for (const fragment_type &fragment : section.fragments) {
+            output.append(fragment.text);
+
+            if (fragment.progress) {
+                output.append(dump_progress(++heading_counter));
+            }
+            else if (fragment.blob) {
+                blobs.emplace_back(fragment.blob);
+                output.append(blob_prefix).append(
+                    std::to_string(blobs.size() - 1)
+                ).append("-");
+            }
+        }
+    }
+
+    if (cache_modified) {
+        trim_cache();
+    }
+}
+
+inline void MDMA::enhance(
+    const section_type &section, std::vector<fragment_type> &fragments
+) {
+    // The section is dumped on its own and then split at the progress styles
+    // and at the references to the blobs it has registered, so that it can be
+    // spliced into any document regardless of the heading count and of the
+    // blobs that come before it.
+
+    attribute_list_type attributes;
+    std::vector<size_t> progress;
+    std::string html;
+    size_t first_blob = blobs.size();
+    size_t offset = 0;
+
+    for (const section_slot_type &slot : section.slots) {
+        html.append(section.html, offset, slot.offset - offset);
+        offset = slot.offset;
+
+        if (slot.tag.empty()) {
+            progress.emplace_back(html.size());
+            continue;
+        }
+
+        attributes = slot.attributes;
+
+        if (slot.tag == "img") {
+            modify_image_attributes(attributes);
+        }
+        else modify_link_attributes(attributes);
+
+        html.append("<").append(slot.tag);
+        dump(attributes, html);
+        html.append(">");
+    }
+
+    html.append(section.html, offset);
+
+    fragments.clear();
+    fragments.emplace_back();
+
+    size_t next_progress = 0;
+
+    for (size_t pos = 0;;) {
+        size_t ref = html.find(blob_prefix, pos);
+        size_t end{
+            next_progress < progress.size() ? (
+                progress[next_progress]
+            ) : html.npos
+        };
+
+        if (end <= ref && end != html.npos) {
+            fragments.back().text.append(html, pos, end - pos);
+            fragments.back().progress = true;
+            fragments.emplace_back();
+            pos = end;
+            ++next_progress;
+            continue;
+        }
+
+        if (ref == html.npos) {
+            fragments.back().text.append(html, pos);
+            break;
+        }
+
+        size_t index;
+        size_t length{
+            parse_reference(
+                std::string_view(html).substr(ref + blob_prefix.size()), index
+            )
+        };
+
+        if (!length || index < first_blob || index >= blobs.size()) {
+            fragments.back().text.append(
+                html, pos, ref + blob_prefix.size() - pos
+            );
+            pos = ref + blob_prefix.size();
+            continue;
+        }
+
+        fragments.back().text.append(html, pos, ref - pos);
+        fragments.back().blob = blobs[index];
+        fragments.emplace_back();
+        pos = ref + blob_prefix.size() + length;
+    }
+
+    blobs.resize(first_blob);
+}
+
+inline void MDMA::recall_sections() {
+    for (section_type &section : sections) {
+        section.key = cache_key(section);
+        section.fragments.clear();
+
+        if (section.key.empty()) {
+            continue;
+        }
+
+        if (memory && memory->recall(
+            memory->sections, section.key, section.fragments
+        )) {
+            continue;
+        }
+
+        std::string record;
+
+        if (cache_directory.empty()
+        || !load_cache(cache_directory / "sections" / section.key, record)) {
+            continue;
+        }
+
+        std::string_view unread{record};
+        fragment_type fragment;
+
+        while (!unread.empty() && deserialize(unread, fragment)) {
+            section.fragments.emplace_back(std::move(fragment));
+        }
+
+        if (!unread.empty() || section.fragments.empty()) {
+            log("%s: %s", section.key.c_str(), "corrupt cache entry");
+            section.fragments.clear();
+        }
+        else if (memory) {
+            memory->remember(memory->sections, section.key, section.fragments);
+        }
+    }
+}
+
+inline std::string MDMA::dump_progress(size_t heading_counter) const {
+    if (headings.empty()) {
+        return "";
+    }
+
+    return std::string(
+        "<style class=\"MDMA-AUTOGENERATED\">:root {--MDMA-PAGE-LOADED: "
+    ).append(
+        std::to_string((100 * heading_counter) / headings.size())
+    ).append("%;}</style>");
+}
+
+inline void MDMA::for_each_asset(
+    std::function<void(TidyTagId, const char *url, bool styled)> fun
+) const {
+    for (const framework_slot_type &slot : framework->slots) {
+        const attribute_list_type &attributes = slot.attributes;
+
+        if (slot.kind != SLOT_ASSET) {
+            continue;
+        }
+
+        if (slot.tag == "img" && attributes.contains("src")) {
+            fun(
+                TidyTag_IMG, std::string(attributes.get("src")).c_str(),
+                attributes.contains("style")
+            );
+        }
+        else if (slot.tag == "link" && attributes.contains("href")
+        && (attributes.get("rel") == "icon"
+        ||  attributes.get("rel") == "stylesheet")) {
+            fun(
+                TidyTag_LINK, std::string(attributes.get("href")).c_str(),
+                false
+            );
+        }
+    }
+
+    for (const section_type &section : sections) {
+        if (!section.fragments.empty()) {
+            // The assets of a recalled section are already embedded.
+            continue;
+        }
+
+        for (const section_slot_type &slot : section.slots) {
+            const attribute_list_type &attributes = slot.attributes;
+
+            if (slot.tag == "img" && attributes.contains("src")) {
+                fun(
+                    TidyTag_IMG, std::string(attributes.get("src")).c_str(),
+                    attributes.contains("style")
+                );
+            }
+            else if (slot.tag == "link" && attributes.contains("href")
+            && (attributes.get("rel") == "icon"
+            ||  attributes.get("rel") == "stylesheet")) {
+                fun(
+                    TidyTag_LINK, std::string(attributes.get("href")).c_str(),
+                    false
+                );
+            }
+        }
+    }
+}
+
+inline void MDMA::prefetch() {
+    std::vector<std::string> urls;
+
+    for_each_asset(
+        [&](TidyTagId tag, const char *url, bool) {
+            if ((tag == TidyTag_IMG && cfg.preview > 0)
+            ||  (tag == TidyTag_LINK && cfg.monolith)) {
+                if (is_remote(url) && !cfg.offline) {
+                    urls.emplace_back(url);
+                }
+            }
+        }
+    );
+
+    download(urls);
+}
+
+inline void MDMA::download(const std::vector<std::string> &urls) {
+    struct transfer_type {
+        CURL *easy;
+        const std::string *url;
+        std::vector<unsigned char> data;
+        std::array<char, CURL_ERROR_SIZE> errbuf;
+        std::map<std::string, std::string> headers;
+        curl_slist *conditions;
+        http_entry_type cached;
+        std::chrono::steady_clock::time_point started;
+        bool revalidate;
+    };
+
+    size_t (*cb)(void *, size_t, size_t, void *){
+        [](void *contents, size_t size, size_t nmemb, void *userp) {
+            std::vector<unsigned char> *v{
+                (std::vector<unsigned char> *) userp
+            };
+
+            v->insert(
+                v->end(),
+                (unsigned char *) contents,
+                ((unsigned char *) contents) + (size * nmemb)
+            );
+
+            return size * nmemb;
+        }
+    };
+
+    size_t (*header_cb)(char *, size_t, size_t, void *){
+        [](char *buffer, size_t size, size_t nitems, void *userp) {
+            std::map<std::string, std::string> *headers{
+                (std::map<std::string, std::string> *) userp
+            };
+
+            std::string_view line(buffer, size * nitems);
+
+            if (line.starts_with("HTTP/")) {
+                // A new response begins, for example after 100 Continue.
+                headers->clear();
+            }
+
+            size_t colon = line.find(':');
+
+            if (colon != std::string_view::npos) {
+                std::string key(line.substr(0, colon));
+                std::string_view value = line.substr(colon + 1);
+
+                std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+
+                while (!value.empty() && isspace(value.front())) {
+                    value.remove_prefix(1);
+                }
+
+                while (!value.empty() && isspace(value.back())) {
+                    value.remove_suffix(1);
+                }
+
+                (*headers)[key].assign(value);
+            }
+
+            return size * nitems;
+        }
+    };
+
+    if (!curl) {
+        return;
+    }
+
+    curl_multi_setopt(curl, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(
+        curl, CURLMOPT_MAX_TOTAL_CONNECTIONS, long{cfg.connections}
+    );
+
+    int64_t now{
+        std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()
+        ).count()
+    };
+
+    bool cache_modified = false;
+
+    // Transfers are referred to by their easy handles, so their addresses must
+    // remain stable, hence the use of a list.
+    std::list<transfer_type> transfers;
+
+    for (const std::string &url : urls) {
+        if (downloads.count(url)) {
+            continue;
+        }
+
+        // Reserve the entry to avoid downloading the same file twice.
+        downloads[url];
+
+        http_entry_type cached{};
+        bool revalidate = false;
+
+        if (memory && memory->recall(memory->http, url, cached)) {
+            revalidate = true;
+        }
+        else if (!cache_directory.empty()) {
+            std::string record;
+
+            std::filesystem::path path(
+                cache_directory / "http" / http_cache_key(url)
+            );
+
+            if (load_cache(path, record)) {
+                std::string_view unread{record};
+
+                revalidate = deserialize(unread, cached) && unread.empty();
+            }
+
+            if (revalidate && memory) {
+                memory->remember(memory->http, url, cached);
+            }
+        }
+
+        if (revalidate && cached.expires > now) {
+            if (cfg.verbose) {
+                log(
+                    "Reusing %lu cached byte%s.", cached.body.size(),
+                    cached.body.size() == 1 ? "" : "s"
+                );
+            }
+
+            downloads[url].swap(cached.body);
+            continue;
+        }
+
+        CURL *easy = curl_easy_init();
+
+        if (!easy) {
+            log("%s: %s", url.c_str(), "curl_easy_init failed");
+            continue;
+        }
+
+        transfer_type &transfer = transfers.emplace_back(
+            transfer_type{
+                .easy       = easy,
+                .url        = &url,
+                .data       = {},
+                .errbuf     = {},
+                .headers    = {},
+                .conditions = nullptr,
+                .cached     = std::move(cached),
+                .started    = std::chrono::steady_clock::now(),
+                .revalidate = revalidate
+            }
+        );
+
+        if (transfer.revalidate) {
+            if (!transfer.cached.etag.empty()) {
+                transfer.conditions = curl_slist_append(
+                    transfer.conditions,
+                    std::string("If-None-Match: ").append(
+                        transfer.cached.etag
+                    ).c_str()
+                );
+            }
+
+            if (!transfer.cached.last_modified.empty()) {
+                transfer.conditions = curl_slist_append(
+                    transfer.conditions,
+                    std::string("If-Modified-Since: ").append(
+                        transfer.cached.last_modified
+                    ).c_str()
+                );
+            }
+        }
+
+        curl_easy_setopt(easy, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, cb);
+        curl_easy_setopt(easy, CURLOPT_WRITEDATA, &transfer.data);
+        curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, header_cb);
+        curl_easy_setopt(easy, CURLOPT_HEADERDATA, &transfer.headers);
+        curl_easy_setopt(easy, CURLOPT_HTTPHEADER, transfer.conditions);
+        curl_easy_setopt(easy, CURLOPT_ERRORBUFFER, transfer.errbuf.data());
+        curl_easy_setopt(easy, CURLOPT_PRIVATE, &transfer);
+        curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+
+        // Waiting to share a connection only pays off where HTTP/2 may be
+        // negotiated, otherwise the transfers to a host run one at a time.
+        curl_easy_setopt(
+            easy, CURLOPT_PIPEWAIT,
+            long{!strncasecmp(url.c_str(), "https:", strlen("https:"))}
+        );
+
+        CURLMcode mc = curl_multi_add_handle(curl, easy);
+
+        if (mc != CURLM_OK) {
+            log("%s: %s", url.c_str(), curl_multi_strerror(mc));
+            curl_easy_cleanup(easy);
+            transfer.easy = nullptr;
+        }
+    }
+
+    for (int running = !transfers.empty(); running;) {
+        CURLMcode mc = curl_multi_perform(curl, &running);
+
+        if (mc == CURLM_OK && running) {
+            mc = curl_multi_poll(curl, nullptr, 0, 1000, nullptr);
+        }
+
+        if (mc != CURLM_OK) {
+            log("%s", curl_multi_strerror(mc));
+            break;
+        }
+
+        int msgs_left;
+
+        for (CURLMsg *msg; (msg = curl_multi_info_read(curl, &msgs_left));) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+
+            char *userp = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &userp);
+
+            transfer_type *transfer = (transfer_type *) userp;
+
+            if (!transfer) {
+                die();
+            }
+
+            CURLcode res = msg->data.result;
+            long status = 0;
+
+            curl_easy_getinfo(transfer->easy, CURLINFO_RESPONSE_CODE, &status);
+
+            if (res != CURLE_OK) {
+                transfer->data.clear();
+
+                size_t len = strlen(transfer->errbuf.data());
+
+                // The logger ends the lines itself.
+                if (len && transfer->errbuf[len - 1] == '\n') {
+                    --len;
+                }
+
+                if (len) {
+                    log("%.*s", int(len), transfer->errbuf.data());
+                }
+                else {
+                    log("%s", curl_easy_strerror(res));
+                }
+
+                if (transfer->revalidate) {
+                    log("Using a stale copy of %s", transfer->url->c_str());
+                    transfer->data.swap(transfer->cached.body);
+                }
+            }
+            else if (status == 304 && transfer->revalidate) {
+                if (cfg.verbose) {
+                    log(
+                        "Revalidated %lu cached byte%s.",
+                        transfer->cached.body.size(),
+                        transfer->cached.body.size() == 1 ? "" : "s"
+                    );
+                }
+
+                http_entry_type &entry = transfer->cached;
+
+                if (update_http_entry(entry, transfer->headers, now)) {
+                    cache_modified |= save_http_entry(*transfer->url, entry);
+                }
+
+                transfer->data.swap(entry.body);
+            }
+            else {
+                if (cfg.verbose) {
+                    log(
+                        "Downloaded %lu byte%s.", transfer->data.size(),
+                        transfer->data.size() == 1 ? "" : "s"
+                    );
+                }
+
+                if (status == 200 && (!cache_directory.empty() || memory)) {
+                    http_entry_type entry{};
+
+                    if (update_http_entry(entry, transfer->headers, now)) {
+                        entry.body.swap(transfer->data);
+                        cache_modified |= save_http_entry(
+                            *transfer->url, entry
+                        );
+                        transfer->data.swap(entry.body);
+                    }
+                }
+            }
+
+            // The transfers overlap, and their time is mostly spent waiting.
+            report(
+                stage_type{
+                    .name        = "download",
+                    .detail      = *transfer->url,
+                    .start       = transfer->started,
+                    .end         = std::chrono::steady_clock::now(),
+                    .cpu         = {},
+                    .bytes_in    = 0,
+                    .bytes_out   = transfer->data.size(),
+                    .thread      = gettid(),
+                    .async       = true,
+                    .sampled     = false,
+                    .usage_start = {},
+                    .usage_end   = {}
+                }
+            );
+
+            downloads[*transfer->url].swap(transfer->data);
+
+            curl_multi_remove_handle(curl, transfer->easy);
+            curl_easy_cleanup(transfer->easy);
+            transfer->easy = nullptr;
+        }
+    }
+
+    for (transfer_type &transfer : transfers) {
+        curl_slist_free_all(transfer.conditions);
+
+        if (!transfer.easy) continue;
+
+        curl_multi_remove_handle(curl, transfer.easy);
+        curl_easy_cleanup(transfer.easy);
+    }
+
+    if (cache_modified) {
+        trim_cache();
+    }
+}
+
+inline bool MDMA::save_http_entry(
+    const std::string &url, const http_entry_type &entry
+) {
+    if (memory) {
+        memory->remember(memory->http, url, entry);
+    }
+
+    if (cache_directory.empty()) {
+        return false;
+    }
+
+    std::string record;
+    serialize(record, entry);
+    save_cache(cache_directory / "http" / http_cache_key(url), record);
+
+    return true;
+}
+
+inline std::string MDMA::http_cache_key(const std::string &url) {
+    return SHA256().update("http:1:").update(url).hexdigest();
+}
+
+inline bool MDMA::update_http_entry(
+    http_entry_type &entry, const std::map<std::string, std::string> &headers,
+    int64_t now
+) {
+    std::string cache_control;
+
+    if (headers.count("cache-control")) {
+        cache_control = headers.at("cache-control");
+
+        std::transform(
+            cache_control.begin(), cache_control.end(), cache_control.begin(),
+            ::tolower
+        );
+    }
+
+    if (cache_control.find("no-store") != std::string::npos) {
+        return false;
+    }
+
+    if (headers.count("etag")) {
+        entry.etag = headers.at("etag");
+    }
+
+    if (headers.count("last-modified")) {
+        entry.last_modified = headers.at("last-modified");
+    }
+
+    size_t max_age = cache_control.find("max-age=");
+
+    if (cache_control.find("no-cache") != std::string::npos) {
+        entry.expires = 0;
+    }
+    else if (max_age != std::string::npos) {
+        entry.expires = now + strtoll(
+            cache_control.c_str() + max_age + strlen("max-age="), nullptr, 10
+        );
+    }
+    else if (headers.count("expires")) {
+        entry.expires = int64_t(
+            std::max(curl_getdate(headers.at("expires").c_str(), nullptr), 0L)
+        );
+    }
+    else {
+        entry.expires = 0;
+    }
+
+    return (
+        entry.expires > now ||
+        !entry.etag.empty() || !entry.last_modified.empty()
+    );
+}
+
+inline void MDMA::preload_images() {
+    if (cfg.preview <= 0) {
+        return;
+    }
+
+    std::vector<image_job_type> jobs;
+    std::map<std::string, size_t> src_to_job;
+
+    for_each_asset(
+        [&](TidyTagId tag, const char *src, bool styled) {
+            if (tag != TidyTag_IMG) {
+                return;
+            }
+
+            bool preview = !styled;
+            auto p = src_to_job.emplace(src, jobs.size());
+
+            if (p.second) {
+                jobs.emplace_back(
+                    image_job_type{
+                        .src    = src,
+                        .data   = {},
+                        .result = {},
+                        .key    = {},
+                        .preview= preview,
+                        .done   = false
+                    }
+                );
+            }
+            else if (preview) {
+                jobs[p.first->second].preview = true;
+            }
+        }
+    );
+
+    for (image_job_type &job : jobs) {
+        job.data = std::make_shared<const std::vector<unsigned char>>(
+            load_file(job.src.c_str())
+        );
+        job.done = job.data->empty();
+
+        if (job.done || (cache_directory.empty() && !memory)) {
+            continue;
+        }
+
+        job.key = cache_key(job);
+
+        std::string record;
+
+        if (memory && memory->recall(memory->images, job.key, job.result)) {
+            job.done = true;
+        }
+        else if (!cache_directory.empty()
+        && load_cache(cache_directory / "images" / job.key, record)) {
+            std::string_view unread{record};
+            size_t index;
+
+            job.done = deserialize(unread, index, job.result) && unread.empty();
+
+            if (!job.done) {
+                log("%s: %s", job.key.c_str(), "corrupt cache entry");
+                job.result = {};
+            }
+            else if (memory) {
+                memory->remember(memory->images, job.key, job.result);
+            }
+        }
+
+        if (job.done) {
+            // The result is already stored in the cache.
+            job.key.clear();
+        }
+    }
+
+    {
+        stage_timer_type timer(*this, "images");
+        process_images(jobs);
+    }
+
+    bool cache_modified = false;
+
+    for (image_job_type &job : jobs) {
+        if (!job.key.empty() && !job.result.width.empty()) {
+            if (!cache_directory.empty()) {
+                std::string record;
+                serialize(record, 0, job.result);
+                save_cache(cache_directory / "images" / job.key, record);
+                cache_modified = true;
+            }
+
+            if (memory) {
+                memory->remember(memory->images, job.key, job.result);
+            }
+        }
+
+        images[job.src] = std::move(job.result);
+    }
+
+    if (cache_modified) {
+        trim_cache();
+    }
+}
+
+inline void MDMA::process_images(std::vector<image_job_type> &jobs) {
+    size_t pending{
+        size_t(
+            std::count_if(
+                jobs.begin(), jobs.end(),
+                [](const image_job_type &job) { return !job.done; }
+            )
+        )
+    };
+
+    size_t workers = std::min(size_t{cfg.jobs}, pending);
+
+    std::atomic<size_t> *next_job{
+        workers > 1 ? static_cast<std::atomic<size_t> *>(
+            mmap(
+                nullptr, sizeof(std::atomic<size_t>), PROT_READ|PROT_WRITE,
+                MAP_SHARED|MAP_ANONYMOUS, -1, 0
+            )
+        ) : nullptr
+    };
+
+    if (next_job == MAP_FAILED) {
+        log("mmap: %s", strerror(errno));
+        next_job = nullptr;
+    }
+
+    std::vector<std::pair<pid_t, int>> children;
+
+    if (next_job) {
+        // Imlib2 is not thread safe, so the images are processed by a pool of
+        // forked workers instead. The workers claim jobs from a shared counter
+        // and write their results into a memory file of their own.
+
+        new (next_job) std::atomic<size_t>(0);
+        fflush(nullptr);
+
+        // The server and the concurrent batches never fork the workers since
+        // their other threads could hold locks, but the lock of Imlib2 is
+        // taken anyway so that nothing else could be using it meanwhile.
+        std::lock_guard<std::mutex> imlib_lock(imlib_mutex());
+
+        for (size_t i=0; i<workers; ++i) {
+            int fd = memfd_create("mdma-images", 0);
+
+            if (fd == -1) {
+                log("memfd_create: %s", strerror(errno));
+                break;
+            }
+
+            pid_t pid = fork();
+
+            if (pid == -1) {
+                log("fork: %s", strerror(errno));
+                close(fd);
+                break;
+            }
+
+            if (pid == 0) {
+                std::string record;
+
+                for (size_t j; (j = next_job->fetch_add(1)) < jobs.size();) {
+                    image_job_type &job = jobs[j];
+
+                    if (job.done) continue;
+
+                    // The stages of the workers are reported by the parent,
+                    // so every result is preceded by its timing.
+                    timing_type timing{
+                        .start = std::chrono::steady_clock::now(),
+                        .end   = {},
+                        .cpu   = stage_timer_type::cpu_now()
+                    };
+
+                    image_type result{
+                        process_image(job.src.c_str(), job.data, job.preview)
+                    };
+
+                    timing.end = std::chrono::steady_clock::now();
+                    timing.cpu = stage_timer_type::cpu_now() - timing.cpu;
+
+                    // The parent already has the file that is embedded as
+                    // it is, so it is not sent back.
+                    bool original = result.src.data == job.data;
+
+                    if (original) {
+                        result.src.data.reset();
+                    }
+
+                    record.assign(
+                        reinterpret_cast<const char *>(&timing), sizeof(timing)
+                    ).append(
+                        reinterpret_cast<const char *>(&original),
+                        sizeof(original)
+                    );
+                    serialize(record, j, result);
+
+                    for (size_t written = 0; written < record.size();) {
+                        ssize_t nb{
+                            ::write(
+                                fd, record.data() + written,
+                                record.size() - written
+                            )
+                        };
+
+                        if (nb == -1 && errno == EINTR) continue;
+                        if (nb <= 0) _exit(EXIT_FAILURE);
+
+                        written += size_t(nb);
+                    }
+                }
+
+                _exit(EXIT_SUCCESS);
+            }
+
+            children.emplace_back(pid, fd);
+        }
+    }
+
+    for (const auto &[pid, fd] : children) {
+        int status = 0;
+
+        while (waitpid(pid, &status, 0) == -1) {
+            if (errno == EINTR) continue;
+
+            log("waitpid(%d): %s", int(pid), strerror(errno));
+            break;
+        }
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            log("Image worker %d failed.", int(pid));
+        }
+
+        // The records are read from a mapping of the memory file, and the
+        // pages already read are released from the file as the results are
+        // taken, so that the images are not held twice by the parent.
+        struct stat st;
+        size_t size = 0;
+        void *records = MAP_FAILED;
+
+        if (fstat(fd, &st) == -1) {
+            log("fstat(%d): %s", fd, strerror(errno));
+        }
+        else if ((size = size_t(st.st_size)) > 0) {
+            records = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+
+            if (records == MAP_FAILED) {
+                log("mmap(%d): %s", fd, strerror(errno));
+            }
+        }
+
+        std::string_view unread{
+            records == MAP_FAILED ? nullptr : (const char *) records,
+            records == MAP_FAILED ? 0 : size
+        };
+        size_t index;
+        size_t released = 0;
+        size_t page = size_t(sysconf(_SC_PAGESIZE));
+        image_type result;
+        timing_type timing;
+        bool original;
+
+        while (unread.size() >= sizeof(timing) + sizeof(original)) {
+            memcpy(&timing, unread.data(), sizeof(timing));
+            unread.remove_prefix(sizeof(timing));
+            memcpy(&original, unread.data(), sizeof(original));
+            unread.remove_prefix(sizeof(original));
+
+            if (!deserialize(unread, index, result)) {
+                break;
+            }
+
+            if (index >= jobs.size()) {
+                bug();
+                break;
+            }
+
+            if (original) {
+                result.src.data = jobs[index].data;
+            }
+
+            report(
+                stage_type{
+                    .name        = "decode",
+                    .detail      = jobs[index].src,
+                    .start       = timing.start,
+                    .end         = timing.end,
+                    .cpu         = timing.cpu,
+                    .bytes_in    = jobs[index].data->size(),
+                    .bytes_out   = image_size(result),
+                    .thread      = pid,
+                    .async       = false,
+                    .sampled     = false,
+                    .usage_start = {},
+                    .usage_end   = {}
+                }
+            );
+
+            jobs[index].result = std::move(result);
+            jobs[index].done = true;
+
+            size_t consumed = (size - unread.size()) / page * page;
+
+            if (consumed > released) {
+                fallocate(
+                    fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+                    off_t(released), off_t(consumed - released)
+                );
+                released = consumed;
+            }
+        }
+
+        if (records != MAP_FAILED) {
+            munmap(records, size);
+        }
+
+        if (close(fd) == -1) {
+            log("close(%d): %s", fd, strerror(errno));
+        }
+    }
+
+    if (next_job) {
+        munmap(next_job, sizeof(std::atomic<size_t>));
+    }
+
+    for (image_job_type &job : jobs) {
+        if (job.done) continue;
+
+        std::lock_guard<std::mutex> imlib_lock(imlib_mutex());
+        stage_timer_type timer(*this, "decode", job.src);
+
+        job.result = process_image(job.src.c_str(), job.data, job.preview);
+        job.done = true;
+
+        timer.bytes_in = job.data->size();
+        timer.bytes_out = image_size(job.result);
+    }
+}
+
+inline MDMA::image_type MDMA::process_image(
+    const char *src,
+    const std::shared_ptr<const std::vector<unsigned char>> &data,
+    bool preview
+) {
+    image_type result;
+
+    if (!data || data->empty()) {
+        return result;
+    }
+
+    if (!cfg.full_decode && process_scaled_image(data, preview, result)) {
+        return result;
+    }
+
+    const std::vector<unsigned char> &rawsrc = *data;
+
+    Imlib_Image img_src{
+        imlib_load_image_mem("memimg", rawsrc.data(), rawsrc.size())
+    };
+
+    int src_w;
+    int src_h;
+
+    if (!img_src) {
+        if (WebPGetInfo(rawsrc.data(), rawsrc.size(), &src_w, &src_h)) {
+            result.width  = std::to_string(src_w);
+            result.height = std::to_string(src_h);
+
+            if (cfg.preview == 1 || cfg.monolith) {
+                // do not shrink, just use data-uri
+                result.src = { .mime = "image/webp", .data = data };
+            }
+        }
+        else {
+            log("Error loading image: %.50s", src);
+        }
+
+        return result;
+    }
+
+    imlib_context_set_image(img_src);
+
+    src_w = imlib_image_get_width();
+    src_h = imlib_image_get_height();
+    const char *src_fmt = imlib_image_format();
+
+    result.width  = std::to_string(src_w);
+    result.height = std::to_string(src_h);
+
+    if (cfg.preview == 1 || (cfg.monolith && imlib_image_has_alpha())) {
+        // do not shrink, just use data-uri
+        result.src = embed_image(data, src_fmt);
+    }
+    else if (cfg.preview > 1 && src_w > 0 && src_h > 0
+    && preview && !imlib_image_has_alpha()) {
+        // shrink and use it as background image
+
+        int dst_w = std::max(src_w / cfg.preview, 1);
+        int dst_h = std::max(src_h / cfg.preview, 1);
+
+        Imlib_Image img_dst{
+            imlib_create_cropped_scaled_image(0, 0, src_w, src_h, dst_w, dst_h)
+        };
+
+        if (img_dst) {
+            imlib_context_set_image(img_dst);
+            imlib_image_set_format(src_fmt);
+
+            std::vector<unsigned char> rawdst{ dump(img_dst) };
+
+            imlib_context_set_image(img_dst);
+            imlib_free_image();
+
+            if (!rawdst.empty()) {
+                result.style = {
+                    .mime = std::string("image/").append(imgfmt2mime(src_fmt)),
+                    .data = std::make_shared<const std::vector<unsigned char>>(
+                        std::move(rawdst)
+                    )
+                };
+            }
+        }
+    }
+
+    imlib_context_set_image(img_src);
+    imlib_free_image();
+
+    return result;
+}
+
+inline MDMA::blob_type MDMA::embed_image(
+    const std::shared_ptr<const std::vector<unsigned char>> &data,
+    const char *fmt
+) {
+    // Encodes the current image of Imlib2 in the format to embed, unless the
+    // original file is smaller. GIF files are kept for their animations and
+    // JPEG drops the alpha channel, so the images having one are kept too.
+
+    blob_type original{
+        .mime = std::string("image/").append(imgfmt2mime(fmt)),
+        .data = data
+    };
+
+    if (cfg.embed_format == EMBED_KEEP
+    || !strcasecmp(fmt, "gif")
+    || (cfg.embed_format == EMBED_JPEG && imlib_image_has_alpha())) {
+        return original;
+    }
+
+    int w = imlib_image_get_width();
+    int h = imlib_image_get_height();
+    const uint32_t *argb = imlib_image_get_data_for_reading_only();
+    std::vector<unsigned char> encoded;
+
+    if (!argb || w <= 0 || h <= 0 || !(
+        cfg.embed_format == EMBED_WEBP ? (
+            encode_webp(argb, w, h, cfg.embed_quality, encoded)
+        ) : encode_jpeg(argb, w, h, cfg.embed_quality, encoded)
+    ) || encoded.size() >= data->size()) {
+        return original;
+    }
+
+    return {
+        .mime = cfg.embed_format == EMBED_WEBP ? "image/webp" : "image/jpeg",
+        .data = std::make_shared<const std::vector<unsigned char>>(
+            std::move(encoded)
+        )
+    };
+}
+
+inline bool MDMA::process_scaled_image(
+    const std::shared_ptr<const std::vector<unsigned char>> &data,
+    bool preview, image_type &result
+) {
+    // Makes the preview of a JPEG or WebP image without decoding it at full
+    // size. Everything else, including the images not shrunk at all, is left
+    // to process_image.
+
+    scaled_info_type info;
+
+    if (cfg.preview <= 1 || !preview
+    || !scaled_info(data->data(), data->size(), info)
+    ||  info.alpha || info.width <= 0 || info.height <= 0) {
+        return false;
+    }
+
+    int dst_w = std::max(info.width / cfg.preview, 1);
+    int dst_h = std::max(info.height / cfg.preview, 1);
+    int w;
+    int h;
+    std::vector<uint32_t> pixels;
+
+    if (!scaled_decode(
+        data->data(), data->size(), dst_w, dst_h, pixels, w, h
+    )) {
+        return false;
+    }
+
+    Imlib_Image img_tmp{
+        imlib_create_image_using_copied_data(w, h, (DATA32 *) pixels.data())
+    };
+
+    if (!img_tmp) {
+        return false;
+    }
+
+    std::vector<uint32_t>().swap(pixels);
+
+    Imlib_Image img_dst = img_tmp;
+
+    if (w != dst_w || h != dst_h) {
+        // The decoders only get close to the size, the rest is up to Imlib2.
+        imlib_context_set_image(img_tmp);
+        img_dst = imlib_create_cropped_scaled_image(0, 0, w, h, dst_w, dst_h);
+        imlib_free_image();
+
+        if (!img_dst) {
+            return false;
+        }
+    }
+
+    imlib_context_set_image(img_dst);
+    imlib_image_set_format("jpg");
+
+    std::vector<unsigned char> rawdst{ dump(img_dst) };
+
+    imlib_context_set_image(img_dst);
+    imlib_free_image();
+
+    if (rawdst.empty()) {
+        return false;
+    }
+
+    result.width  = std::to_string(info.width);
+    result.height = std::to_string(info.height);
+    result.style = {
+        .mime = "image/jpeg",
+        .data = std::make_shared<const std::vector<unsigned char>>(
+            std::move(rawdst)
+        )
+    };
+
+    return true;
+}
+
+inline void MDMA::modify_image_attributes(attribute_list_type &attributes) {
+    if (!attributes.contains("loading")) {
+        attributes.set("loading", "lazy");
+    }
+
+    if (!attributes.contains("src") || cfg.preview <= 0) {
+        return;
+    }
+
+    const std::string src(attributes.get("src"));
+    bool preview = !attributes.contains("style");
+
+    if (!images.count(src)) {
+        // The file may have to be downloaded, so it is loaded before the lock
+        // of Imlib2 is taken.
+        auto data{
+            std::make_shared<const std::vector<unsigned char>>(
+                load_file(src.c_str())
+            )
+        };
+
+        std::lock_guard<std::mutex> imlib_lock(imlib_mutex());
+        stage_timer_type timer(*this, "decode", src);
+        const image_type &image{
+            images.emplace(
+                src, process_image(src.c_str(), data, preview)
+            ).first->second
+        };
+
+        timer.bytes_in = data->size();
+        timer.bytes_out = image_size(image);
+    }
+
+    const image_type &image = images.at(src);
+
+    if (!image.width.empty()) {
+        attributes.set("width",  image.width);
+        attributes.set("height", image.height);
+    }
+
+    if (image.style.data && preview) {
+        attributes.set("style").assign(
+            "background-size: cover;background-image: url('"
+        ).append(blob_uri(image.style)).append("');");
+    }
+
+    if (image.src.data) {
+        attributes.set("src", blob_uri(image.src));
+    }
+}
+
+inline std::string MDMA::cache_key(const image_job_type &job) const {
+    SHA256 sha;
+
+    // The key covers everything that affects the outcome of process_image.
+    sha.update(
+        std::format(
+            "image:4:{}:{}:{}:{}:{}:{}:",
+            int(cfg.preview), cfg.monolith ? 1 : 0, job.preview ? 1 : 0,
+            cfg.full_decode ? 1 : 0, int(cfg.embed_format),
+            int(cfg.embed_quality)
+        )
+    );
+    sha.update(job.data->data(), job.data->size());
+
+    return sha.hexdigest();
+}
+
+inline std::string MDMA::cache_key(const section_type &section) {
+    // The key covers the rendered section and the identity of every local
+    // file that it embeds, so that editing an image invalidates the sections
+    // showing it. The remote files may change without notice, so a section
+    // embedding any of them is not cached at all, and neither is a section
+    // embedding a file that a confined instance may not read.
+
+    if (cache_directory.empty() && !memory) {
+        return {};
+    }
+
+    SHA256 sha;
+
+    sha.update(
+        std::format(
+            "section:4:{}:{}:{}:{}:{}:{}:{}:{}:", int(cfg.preview),
+            cfg.monolith ? 1 : 0, cfg.full_decode ? 1 : 0,
+            cfg.confined ? 1 : 0, cfg.offline ? 1 : 0,
+            int(cfg.embed_format), int(cfg.embed_quality), section.html.size()
+        )
+    ).update(section.html);
+
+    for (const section_slot_type &slot : section.slots) {
+        const attribute_list_type &attributes = slot.attributes;
+
+        sha.update(
+            std::format("{}:{}:{}:", slot.offset, slot.tag, attributes.size())
+        );
+
+        for (size_t i=0; i<attributes.size(); ++i) {
+            std::string_view name{attribute_list_type::name_of(attributes[i])};
+            std::string_view value{
+                attribute_list_type::value_of(attributes[i])
+            };
+
+            sha.update(
+                std::format(
+                    "{}:{}:{}:", attributes[i].boolean ? 1 : 0, name.size(),
+                    value.size()
+                )
+            ).update(name).update(value);
+        }
+
+        std::string_view rel{attributes.get("rel")};
+        std::string url;
+
+        if (slot.tag == "img" && cfg.preview > 0) {
+            url.assign(attributes.get("src"));
+        }
+        else if (slot.tag == "link" && cfg.monolith
+        && (rel == "icon" || rel == "stylesheet")) {
+            url.assign(attributes.get("href"));
+        }
+
+        if (url.empty() || !strncasecmp(url.c_str(), "data:", 5)) {
+            continue;
+        }
+
+        if (is_remote(url.c_str())
+        || (cfg.confined && !is_confined(url.c_str()))) {
+            return {};
+        }
+
+        std::filesystem::path path{
+            std::filesystem::absolute(directory / url).lexically_normal()
+        };
+
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(path, ec);
+        auto time = std::filesystem::last_write_time(path, ec);
+
+        sha.update(
+            std::format(
+                "{}:{}:{}:", ec ? -1 : int64_t(size),
+                ec ? 0 : time.time_since_epoch().count(), path.native().size()
+            )
+        ).update(path.native());
+
+        // The recalled sections do not load their files, but those files are
+        // still a part of the document.
+        local_files.emplace(std::move(path));
+    }
+
+    return sha.hexdigest();
+}
+
+inline std::string MDMA::cache_key(
+    const std::array<unsigned char, 32> &digest
+) {
+    // The compiled framework embeds the version in its generator tag.
+    return SHA256().update(
+        std::format("framework:{}:{}:", FRAMEWORK_FORMAT, MDMA::VERSION)
+    ).update(digest.data(), digest.size()).hexdigest();
+}
+
+inline bool MDMA::load_cache(
+    const std::filesystem::path &path, std::string &record
+) const {
+    std::ifstream input(path.string(), std::ios::binary);
+
+    if (!input) {
+        return false;
+    }
+
+    record.assign(std::istreambuf_iterator<char>(input), {});
+    input.close();
+
+    // Mark the entry as recently used.
+    std::error_code ec;
+    std::filesystem::last_write_time(
+        path, std::filesystem::file_time_type::clock::now(), ec
+    );
+
+    return true;
+}
+
+inline void MDMA::save_cache(
+    const std::filesystem::path &path, const std::string &record
+) const {
+    // The temporary name is unique within the process, so that threads
+    // saving the same entry never write into the same file.
+    static std::atomic<unsigned> counter{0};
+
+    std::filesystem::path tmp_path(
+        std::filesystem::path(path).concat(
+            std::format(".{}-{}.tmp", getpid(), counter++)
+        )
+    );
+
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    if (ec) {
+        log("%s: %s", path.parent_path().c_str(), ec.message().c_str());
+        return;
+    }
+
+    {
+        std::ofstream output(tmp_path.string(), std::ios::binary);
+
+        if (!output) {
+            log("%s: %s", tmp_path.c_str(), strerror(errno));
+            return;
+        }
+
+        output << record;
+
+        if (!output.flush()) {
+            log("%s: %s", tmp_path.c_str(), strerror(errno));
+            output.close();
+            std::filesystem::remove(tmp_path, ec);
+
+            return;
+        }
+    }
+
+    cache_usage_type &usage = cache_usage(cache_directory);
+    std::lock_guard<std::mutex> lock(usage.mutex);
+
+    uintmax_t replaced = std::filesystem::file_size(path, ec);
+
+    if (ec) {
+        replaced = 0;
+    }
+
+    // Renaming is atomic, so concurrent builds never see partial entries.
+    std::filesystem::rename(tmp_path, path, ec);
+
+    if (ec) {
+        log("%s: %s", path.c_str(), ec.message().c_str());
+        std::filesystem::remove(tmp_path, ec);
+    }
+    else if (usage.known) {
+        usage.total = usage.total + record.size() - std::min(
+            replaced, usage.total + record.size()
+        );
+    }
+}
+
+inline MDMA::cache_usage_type &MDMA::cache_usage(
+    const std::filesystem::path &directory
+) {
+    // The size of a cache directory is shared by all the instances in the
+    // process, since they may use the same one.
+    static std::mutex mutex;
+    static std::map<std::filesystem::path, cache_usage_type> usages;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return usages[directory];
+}
+
+inline void MDMA::trim_cache() const {
+    // The directory is scanned once to learn its size, which the saves keep
+    // up to date. It is scanned again only when the size exceeds the limit,
+    // and then trimmed by a tenth more, so that the next saves fit as well.
+    // Other processes may add to it unseen until then.
+
+    cache_usage_type &usage = cache_usage(cache_directory);
+    std::lock_guard<std::mutex> lock(usage.mutex);
+
+    uintmax_t limit = uintmax_t{cfg.cache_size} * 1024 * 1024;
+
+    if (usage.known && usage.total <= limit) {
+        return;
+    }
+
+    std::vector<
+        std::tuple<
+            std::filesystem::file_time_type, uintmax_t, std::filesystem::path
+        >
+    > entries;
+
+    uintmax_t total = 0;
+    std::error_code ec;
+    auto stale{
+        std::filesystem::file_time_type::clock::now() - std::chrono::hours(24)
+    };
+
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(
+        cache_directory, ec
+    )) {
+        if (!entry.is_regular_file(ec)) {
+            continue;
+        }
 
-        while (!descendants.empty()) {
-            int descendant_id = descendants.back();
+        uintmax_t size = entry.file_size(ec);
 
-            if (!get_heading_data(descendant_id)) die();
+        if (ec) continue;
 
-            agenda_css.append("    :has(#").append(
-                *(get_heading_data(descendant_id)->identifier)
-            ).append(":target)");
+        std::filesystem::file_time_type time = entry.last_write_time(ec);
 
-            descendants.pop_back();
+        if (ec) continue;
 
-            if (descendants.empty()) {
-                agenda_css.append("\n");
-            }
-            else {
-                agenda_css.append(",\n");
+        // The temporary files are being written by someone, unless they
+        // were left behind long ago.
+        if (entry.path().extension() == ".tmp") {
+            if (time < stale) {
+                std::filesystem::remove(entry.path(), ec);
             }
+
+            continue;
         }
 
-        agenda_css.append(") #MDMA-AGENDA a[href=\"#").append(
-            *(get_heading_data(heading_id)->identifier)
-        ).append("\"] + div");
+        total += size;
+        entries.emplace_back(time, size, entry.path());
+    }
 
-        heading_to_descendants.erase(heading_id);
+    usage.known = true;
+    usage.total = total;
 
-        if (heading_to_descendants.empty()) {
-            agenda_css.append(
-                " {\n"
-                "    font-size: 0;\n"
-                "    transition: font-size 0.2s ease-out;\n"
-                "}\n"
-            );
-        }
-        else {
-            agenda_css.append(",\n");
-        }
+    if (total <= limit) {
+        return;
     }
 
-    return agenda_css;
-}
+    limit -= limit / 10;
 
-inline std::string MDMA::dump(
-    const std::list<tinyxml2::XMLDocument> &docs
-) const {
-    tinyxml2::XMLPrinter printer(nullptr, true);
+    // Evict the least recently used entries first.
+    std::sort(entries.begin(), entries.end());
 
-    for (const tinyxml2::XMLDocument &section : sections) {
-        section.Print(&printer);
-    }
+    for (const auto &[time, size, path] : entries) {
+        if (usage.total <= limit) break;
 
-    return std::string(printer.CStr());
+        if (std::filesystem::remove(path, ec)) {
+            usage.total -= size;
+        }
+    }
 }
 
-inline void MDMA::modify_image_attributes(
-    std::map<std::string, std::string> &attributes
+template<class T> inline bool MDMA::memory_type::recall(
+    std::map<std::string, entry_type<T>> &entries, const std::string &key,
+    T &value
 ) {
-    if (!attributes.count("loading")) {
-        attributes["loading"] = "lazy";
-    }
+    std::lock_guard<std::mutex> lock(mutex);
 
-    if (!attributes.count("src") || cfg.preview <= 0) {
-        return;
+    auto it = entries.find(key);
+
+    if (it == entries.end()) {
+        return false;
     }
 
-    const char *src = attributes.at("src").c_str();
-    std::vector<unsigned char> rawsrc{ load_file(src) };
+    it->second.used = ++clock;
+    value = it->second.value;
 
-    if (rawsrc.empty()) {
-        return;
-    }
+    return true;
+}
 
-    Imlib_Image img_src{
-        imlib_load_image_mem("memimg", rawsrc.data(), rawsrc.size())
-    };
+template<class T> inline void MDMA::memory_type::remember(
+    std::map<std::string, entry_type<T>> &entries, const std::string &key,
+    const T &value
+) {
+    std::lock_guard<std::mutex> lock(mutex);
 
-    int src_w;
-    int src_h;
+    entry_type<T> &entry = entries[key];
 
-    if (!img_src) {
-        if (WebPGetInfo(rawsrc.data(), rawsrc.size(), &src_w, &src_h)) {
-            attributes["width" ] = std::to_string(src_w);
-            attributes["height"] = std::to_string(src_h);
+    size -= entry.size;
+    entry = { .value = value, .size = size_of(value), .used = ++clock };
+    size += entry.size;
 
-            if (cfg.preview == 1 || cfg.monolith) {
-                // do not shrink, just use data-uri
-                std::string base64{encode_base64(rawsrc.data(), rawsrc.size())};
+    if (size > limit) {
+        trim();
+    }
+}
 
-                if (!base64.empty()) {
-                    attributes["src"].assign(
-                        std::string("data:image/webp;base64,").append(base64)
-                    );
-                }
-            }
-        }
-        else {
-            log("Error loading image: %.50s", src);
-        }
+inline void MDMA::memory_type::trim() {
+    std::vector<std::pair<uint64_t, size_t>> entries;
 
-        return;
+    for (const auto &[key, entry] : images) {
+        entries.emplace_back(entry.used, entry.size);
     }
 
-    imlib_context_set_image(img_src);
+    for (const auto &[key, entry] : http) {
+        entries.emplace_back(entry.used, entry.size);
+    }
 
-    src_w = imlib_image_get_width();
-    src_h = imlib_image_get_height();
-    const char *src_fmt = imlib_image_format();
+    for (const auto &[key, entry] : sections) {
+        entries.emplace_back(entry.used, entry.size);
+    }
 
-    attributes["width" ] = std::to_string(src_w);
-    attributes["height"] = std::to_string(src_h);
+    // Find the most recent use among the entries to be dropped.
+    std::sort(entries.begin(), entries.end());
 
-    if (cfg.preview == 1 || (cfg.monolith && imlib_image_has_alpha())) {
-        // do not shrink, just use data-uri
-        std::string base64{
-            encode_base64(rawsrc.data(), rawsrc.size())
-        };
+    uint64_t last_used = 0;
+    size_t remaining = size;
 
-        if (!base64.empty()) {
-            attributes["src"].assign(
-                std::string("data:image/").append(
-                    imgfmt2mime(src_fmt)
-                ).append(";base64,").append(base64)
-            );
-        }
-    }
-    else if (cfg.preview > 1 && src_w > 0 && src_h > 0
-    && !attributes.count("style") && !imlib_image_has_alpha()) {
-        // shrink and use it as background image
+    for (const auto &[used, entry_size] : entries) {
+        if (remaining <= limit) break;
 
-        int dst_w = std::max(src_w / cfg.preview, 1);
-        int dst_h = std::max(src_h / cfg.preview, 1);
+        remaining -= entry_size;
+        last_used = used;
+    }
 
-        Imlib_Image img_dst{
-            imlib_create_cropped_scaled_image(0, 0, src_w, src_h, dst_w, dst_h)
-        };
+    auto expired = [&](const auto &p) { return p.second.used <= last_used; };
 
-        if (img_dst) {
-            imlib_context_set_image(img_dst);
-            imlib_image_set_format(src_fmt);
+    std::erase_if(images, expired);
+    std::erase_if(http, expired);
+    std::erase_if(sections, expired);
+    size = remaining;
+}
 
-            std::vector<unsigned char> rawdst{ dump(img_dst) };
+inline size_t MDMA::memory_type::size_of(const image_type &image) {
+    return (
+        sizeof(image) + image.width.size() + image.height.size() + (
+            image.src.data ? image.src.data->size() : 0
+        ) + (
+            image.style.data ? image.style.data->size() : 0
+        )
+    );
+}
 
-            imlib_context_set_image(img_dst);
-            imlib_free_image();
+inline size_t MDMA::memory_type::size_of(const http_entry_type &entry) {
+    return (
+        sizeof(entry) + entry.etag.size() + entry.last_modified.size() +
+        entry.body.size()
+    );
+}
 
-            if (!rawdst.empty()) {
-                std::string base64{
-                    encode_base64(rawdst.data(), rawdst.size())
-                };
+inline size_t MDMA::memory_type::size_of(
+    const std::vector<fragment_type> &fragments
+) {
+    size_t size = 0;
 
-                if (!base64.empty()) {
-                    attributes["style"].assign(
-                        std::string(
-                            "background-size: cover;background-image: url('"
-                        ).append(
-                            "data:image/"
-                        ).append(imgfmt2mime(src_fmt)).append(
-                            ";base64,"
-                        ).append(base64).append("');")
-                    );
-                }
-            }
-        }
+    for (const fragment_type &fragment : fragments) {
+        size += sizeof(fragment) + fragment.text.size() + (
+            fragment.blob ? fragment.blob->size() : 0
+        );
     }
 
-    imlib_context_set_image(img_src);
-    imlib_free_image();
+    return size;
 }
 
-inline void MDMA::modify_link_attributes(
-    std::map<std::string, std::string> &attributes
-) {
+inline void MDMA::modify_link_attributes(attribute_list_type &attributes) {
     if (!cfg.monolith
-    || !attributes.count("href")
-    || !attributes.count("rel")) {
+    || !attributes.contains("href")
+    || !attributes.contains("rel")) {
         return;
     }
 
-    if (attributes["rel"].compare("icon")
-    &&  attributes["rel"].compare("stylesheet")) {
+    std::string_view rel{attributes.get("rel")};
+
+    if (rel != "icon" && rel != "stylesheet") {
         return;
     }
 
-    const char *src = attributes.at("href").c_str();
-    std::vector<unsigned char> rawsrc{ load_file(src) };
+    const std::string href(attributes.get("href"));
+    const char *src = href.c_str();
+    auto data{
+        std::make_shared<const std::vector<unsigned char>>(load_file(src))
+    };
+    const std::vector<unsigned char> &rawsrc = *data;
 
     if (rawsrc.empty()) {
         return;
     }
 
-    if (!attributes["rel"].compare("icon")) {
+    if (rel == "icon") {
+        std::lock_guard<std::mutex> imlib_lock(imlib_mutex());
+
         Imlib_Image img_src{
             imlib_load_image_mem("memimg", rawsrc.data(), rawsrc.size())
         };
@@ -1156,86 +4194,82 @@ inline void MDMA::modify_link_attributes(
         imlib_context_set_image(img_src);
         const char *src_fmt = imlib_image_format();
 
-        std::string base64{encode_base64(rawsrc.data(), rawsrc.size())};
-
-        if (!base64.empty()) {
-            attributes["href"].assign(
-                std::string("data:image/").append(imgfmt2mime(src_fmt)).append(
-                    ";base64,"
-                ).append(base64)
-            );
-        }
+        attributes.set(
+            "href", blob_uri(
+                {
+                    .mime = std::string("image/").append(imgfmt2mime(src_fmt)),
+                    .data = data
+                }
+            )
+        );
 
         imlib_context_set_image(img_src);
         imlib_free_image();
     }
-    else if (!attributes["rel"].compare("stylesheet")) {
-        std::string base64{encode_base64(rawsrc.data(), rawsrc.size())};
-
-        if (!base64.empty()) {
-            attributes["href"].assign(
-                std::string("data:text/css;base64,").append(base64)
-            );
-        }
+    else if (rel == "stylesheet") {
+        attributes.set("href", blob_uri({ .mime = "text/css", .data = data }));
     }
 }
 
-inline void MDMA::add_heading(
-    int id, int level, const char *title, std::map<int, int> &level_to_id
+inline size_t MDMA::add_heading(
+    int level, const char *title, std::vector<size_t> &open_headings
 ) {
-    int parent_id = 0;
-
-    while (!level_to_id.empty()) {
-        int last_level = std::prev(level_to_id.end())->first;
+    while (!open_headings.empty()
+    && headings[open_headings.back()].level >= level) {
+        open_headings.pop_back();
+    }
 
-        if (last_level >= level) {
-            level_to_id.erase(last_level);
-            continue;
-        }
+    size_t index = headings.size();
 
-        parent_id = level_to_id.at(last_level);
-        break;
+    for (size_t ancestor : open_headings) {
+        headings[ancestor].end = index + 1;
     }
 
-    level_to_id[level] = id;
+    std::string slug;
 
-    std::string slug{slugify(title)};
-    std::string suffix;
+    {
+        stage_timer_type timer(*this, "slugify");
+        slug = slugify(title);
+        timer.bytes_in = strlen(title);
+        timer.bytes_out = slug.size();
+    }
 
     if (slug.empty()) {
         slug.assign("anchor");
     }
 
-    for (size_t i=1; i<10000; ++i) {
-        if (!identifiers.emplace(std::string(slug).append(suffix), id).second) {
-            if (slug.back() != '-') {
-                slug.append("-");
-            }
+    if (!identifiers.emplace(slug, int(index + 1)).second) {
+        // The suffixes below the counter of this slug are known to be taken,
+        // so the search resumes from where it ended the last time.
 
-            suffix.assign(std::to_string(i));
+        size_t &suffix = next_suffix.try_emplace(slug, 1).first->second;
 
-            continue;
+        if (slug.back() != '-') {
+            slug.append("-");
         }
 
-        slug.assign(std::string(slug).append(suffix));
+        size_t length = slug.size();
 
-        auto p = headings.emplace(
-            id,
-            std::make_tuple(heading_data{}, parent_id, std::string(title), slug)
-        );
+        do {
+            slug.resize(length);
+            slug.append(std::to_string(suffix++));
+        }
+        while (!identifiers.emplace(slug, int(index + 1)).second);
+    }
 
-        if (p.second) {
-            heading_data *data = &std::get<0>(p.first->second);
-            data->parent_id    = &std::get<1>(p.first->second);
-            data->title        = &std::get<2>(p.first->second);
-            data->identifier   = &std::get<3>(p.first->second);
+    headings.emplace_back(
+        heading_type{
+            .level      = level,
+            .depth      = unsigned(open_headings.size()),
+            .end        = index + 1,
+            .title      = title,
+            .identifier = std::move(slug)
         }
-        else break;
+    );
 
-        return;
-    }
+    open_headings.emplace_back(index);
 
-    die();
+    return index;
 }
 
 inline void MDMA::setup(TidyDoc doc) const {
@@ -1259,20 +4293,19 @@ inline void MDMA::setup(TidyDoc doc) const {
     tidyOptSetInt(doc, TidyWrapLen, 0);
 }
 
-inline tinyxml2::XMLNode *MDMA::find_if(
-    const tinyxml2::XMLNode &root,
-    std::function<bool(const tinyxml2::XMLNode &, int)> fun
+inline TidyNode MDMA::find_if(
+    const TidyNode root, std::function<bool(const TidyNode &, int)> fun
 ) const {
     int depth = 0;
 
-    const tinyxml2::XMLNode *parent = &root;
+    TidyNode parent = root;
 
     while (parent) {
-        if (fun(*parent, depth)) {
-            return const_cast<tinyxml2::XMLNode *>(parent);
+        if (fun(parent, depth)) {
+            return const_cast<TidyNode>(parent);
         }
 
-        const tinyxml2::XMLNode *child = parent->FirstChild();
+        const TidyNode child = tidyGetChild(parent);
 
         if (child) {
             parent = child;
@@ -1280,7 +4313,7 @@ inline tinyxml2::XMLNode *MDMA::find_if(
             continue;
         }
 
-        const tinyxml2::XMLNode *sibling = parent->NextSibling();
+        TidyNode sibling = tidyGetNext(parent);
 
         if (sibling) {
             parent = sibling;
@@ -1288,378 +4321,579 @@ inline tinyxml2::XMLNode *MDMA::find_if(
         }
 
         do {
-            parent = parent->Parent();
+            parent = tidyGetParent(parent);
 
             if (!parent) break;
 
-            sibling = parent->NextSibling();
+            sibling = tidyGetNext(parent);
+
+            --depth;
+        }
+        while (!sibling);
+
+        parent = sibling;
+    }
+
+    return {};
+}
+
+inline void MDMA::set_logger(const std::function<void(const char *)>& log_cb) {
+    log_callback = log_cb;
+}
+
+inline void MDMA::set_stage_callback(
+    const std::function<void(const stage_type &)> &stage_cb
+) {
+    stage_callback = stage_cb;
+}
+
+inline void MDMA::set_usage_probe(
+    const std::function<void(usage_type &)> &usage_cb
+) {
+    usage_probe = usage_cb;
+}
+
+inline void MDMA::sample(usage_type &usage) const {
+    // The process wide figures come from the probe, the sizes of the buffers
+    // of this instance are filled in here.
+
+    if (!usage_probe) {
+        return;
+    }
+
+    usage_probe(usage);
+
+    usage.assembly_buffer = assembly_buffer.capacity();
+    usage.tidy_buffer = htmltidy_buffer.allocated;
+    usage.sections = 0;
+
+    for (const section_type &section : sections) {
+        usage.sections += section.html.capacity();
+
+        for (const fragment_type &fragment : section.fragments) {
+            usage.sections += fragment.text.capacity();
+        }
+    }
+}
+
+inline void MDMA::report(const stage_type &stage) const {
+    if (stage_callback) {
+        stage_callback(stage);
+    }
+}
+
+inline void MDMA::set_directory(const std::filesystem::path &path) {
+    directory = path;
+}
+
+inline void MDMA::set_cache_directory(const std::filesystem::path &path) {
+    cache_directory = path;
+}
+
+inline void MDMA::set_memory(const std::shared_ptr<memory_type> &mem) {
+    memory = mem;
+}
+
+inline const std::set<std::filesystem::path> &MDMA::get_local_files() const {
+    return local_files;
+}
+
+inline void MDMA::log(const char *fmt, ...) const {
+    va_list args;
+    va_start(args, fmt);
+    vlog(log_callback, fmt, args);
+    va_end(args);
+}
+
+inline void MDMA::vlog(
+    const std::function<void(const char *text)> &callback,
+    const char *fmt, va_list args
+) {
+    if (!callback) return;
+
+    char stackbuf[256];
+    char *bufptr = stackbuf;
+    size_t bufsz = sizeof(stackbuf);
+
+    for (size_t i=0; i<2 && bufptr; ++i) {
+        va_list copy;
+        va_copy(copy, args);
+        int cx = vsnprintf(bufptr, bufsz, fmt, copy);
+        va_end(copy);
+
+        if ((cx >= 0 && (size_t)cx < bufsz) || cx < 0) {
+            callback(bufptr);
+            break;
+        }
+
+        if (bufptr == stackbuf) {
+            bufsz = size_t(cx) + 1;
+            bufptr = new (std::nothrow) char[bufsz];
+            if (!bufptr) callback("out of memory");
+        }
+        else {
+            callback(bufptr);
+            break;
+        }
+    }
+
+    if (bufptr && bufptr != stackbuf) delete [] bufptr;
+}
+
+inline void MDMA::bug(const char *file, int line) const {
+    log("Forbidden condition met in %s on line %d.", file, line);
+}
+
+inline void MDMA::die(const char *file, int line) const {
+    bug(file, line);
+    fflush(nullptr);
+    raise(SIGSEGV);
+}
+
+inline std::mutex &MDMA::imlib_mutex() {
+    // Imlib2 keeps its context in global state, so it is used by one thread
+    // at a time.
+    static std::mutex mutex;
+
+    return mutex;
+}
+
+inline const char *MDMA::imgfmt2mime(const char *fmt) {
+    return (
+        !strcasecmp("jpg", fmt) ? "jpeg"    :
+        !strcasecmp("svg", fmt) ? "svg+xml" : fmt
+    );
+}
+
+inline std::string MDMA::blob_uri(const blob_type &blob) {
+    blobs.emplace_back(blob.data);
+
+    return std::format(
+        "data:{};base64,{}{}-", blob.mime, blob_prefix, blobs.size() - 1
+    );
+}
+
+inline size_t MDMA::image_size(const image_type &image) {
+    return (
+        (image.src.data ? image.src.data->size() : 0) +
+        (image.style.data ? image.style.data->size() : 0)
+    );
+}
+
+inline std::shared_ptr<const MDMA::spill_type> MDMA::spill(
+    const std::vector<unsigned char> &blob
+) const {
+    int fd = memfd_create("mdma-blob", MFD_CLOEXEC);
+
+    if (fd == -1) {
+        log("memfd_create: %s", strerror(errno));
+        return nullptr;
+    }
+
+    auto spilled{
+        std::make_shared<const spill_type>(fd, base64_encoded_size(blob.size()))
+    };
+
+    stage_timer_type timer(*this, "base64");
+    std::string chunk(base64_encoded_size(BLOB_CHUNK_SIZE), '\0');
+
+    timer.bytes_in = blob.size();
+    timer.bytes_out = spilled->size;
+
+    for (size_t i=0; i<blob.size(); i += BLOB_CHUNK_SIZE) {
+        size_t len{
+            base64_encode(
+                blob.data() + i, std::min(BLOB_CHUNK_SIZE, blob.size() - i),
+                chunk.data()
+            )
+        };
+
+        for (size_t done = 0; done < len;) {
+            ssize_t nb = ::write(fd, chunk.data() + done, len - done);
+
+            if (nb == -1) {
+                if (errno == EINTR) continue;
+
+                log("memfd: %s", strerror(errno));
+                return nullptr;
+            }
+
+            done += size_t(nb);
+        }
+    }
+
+    return spilled;
+}
+
+inline std::vector<unsigned char> MDMA::decode_base64(
+    const char *str, size_t len
+) {
+    return base64_decode(str, len);
+}
+
+inline std::vector<unsigned char> MDMA::decode_base64(const char *str) {
+    return decode_base64(str, strlen(str));
+}
 
-            --depth;
-        }
-        while (!sibling);
+inline void MDMA::serialize(
+    std::string &dst, size_t index, const image_type &image
+) {
+    const std::vector<unsigned char> none;
+    const std::vector<unsigned char> &src{
+        image.src.data ? *image.src.data : none
+    };
+    const std::vector<unsigned char> &style{
+        image.style.data ? *image.style.data : none
+    };
 
-        parent = sibling;
+    for (size_t value : {
+        index, image.width.size(), image.height.size(), image.src.mime.size(),
+        src.size(), image.style.mime.size(), style.size()
+    }) {
+        dst.append((const char *) &value, sizeof(value));
     }
 
-    return nullptr;
+    dst.append(image.width).append(image.height).append(image.src.mime).append(
+        (const char *) src.data(), src.size()
+    ).append(image.style.mime).append(
+        (const char *) style.data(), style.size()
+    );
 }
 
-inline tinyxml2::XMLElement *MDMA::find_element(
-    const tinyxml2::XMLNode &root, const char *id
-) const {
-    tinyxml2::XMLNode *found = find_if(
-        root, [&id](const tinyxml2::XMLNode &node, int) {
-            const tinyxml2::XMLElement *e = node.ToElement();
-            const char *eid = "";
+inline bool MDMA::deserialize(
+    std::string_view &src, size_t &index, image_type &image
+) {
+    std::array<size_t, 7> header;
 
-            if (e == nullptr
-            ||  e->QueryStringAttribute("id", &eid) != tinyxml2::XML_SUCCESS) {
-                return false;
-            }
+    if (src.size() < sizeof(header)) {
+        return false;
+    }
 
-            return eid && id && !strcmp(eid, id);
-        }
-    );
+    memcpy(header.data(), src.data(), sizeof(header));
 
-    return found ? found->ToElement() : nullptr;
-}
+    size_t payload = 0;
 
-inline TidyNode MDMA::find_if(
-    const TidyNode root, std::function<bool(const TidyNode &, int)> fun
-) const {
-    int depth = 0;
+    for (size_t i=1; i<header.size(); ++i) {
+        if (header[i] > src.size()) return false;
 
-    TidyNode parent = root;
+        payload += header[i];
+    }
 
-    while (parent) {
-        if (fun(parent, depth)) {
-            return const_cast<TidyNode>(parent);
-        }
+    if (src.size() - sizeof(header) < payload) {
+        return false;
+    }
 
-        const TidyNode child = tidyGetChild(parent);
+    src.remove_prefix(sizeof(header));
+    index = header[0];
 
-        if (child) {
-            parent = child;
-            ++depth;
-            continue;
-        }
+    auto take_bytes{
+        [&src](
+            size_t len
+        ) -> std::shared_ptr<const std::vector<unsigned char>> {
+            const unsigned char *bytes = (const unsigned char *) src.data();
+            src.remove_prefix(len);
 
-        TidyNode sibling = tidyGetNext(parent);
+            if (!len) return nullptr;
 
-        if (sibling) {
-            parent = sibling;
-            continue;
+            return std::make_shared<const std::vector<unsigned char>>(
+                bytes, bytes + len
+            );
         }
+    };
 
-        do {
-            parent = tidyGetParent(parent);
+    image.width.assign(src.data(), header[1]);
+    src.remove_prefix(header[1]);
 
-            if (!parent) break;
+    image.height.assign(src.data(), header[2]);
+    src.remove_prefix(header[2]);
 
-            sibling = tidyGetNext(parent);
+    image.src.mime.assign(src.data(), header[3]);
+    src.remove_prefix(header[3]);
+    image.src.data = take_bytes(header[4]);
 
-            --depth;
-        }
-        while (!sibling);
+    image.style.mime.assign(src.data(), header[5]);
+    src.remove_prefix(header[5]);
+    image.style.data = take_bytes(header[6]);
 
-        parent = sibling;
+    return true;
+}
+
+inline void MDMA::serialize(std::string &dst, const http_entry_type &entry) {
+    for (size_t value : {
+        size_t(entry.expires), entry.etag.size(), entry.last_modified.size(),
+        entry.body.size()
+    }) {
+        dst.append((const char *) &value, sizeof(value));
     }
 
-    return {};
+    dst.append(entry.etag).append(entry.last_modified).append(
+        (const char *) entry.body.data(), entry.body.size()
+    );
 }
 
-inline void MDMA::patch_tables(tinyxml2::XMLDocument &doc) const {
-    find_if(
-        *doc.RootElement(),
-        [](const tinyxml2::XMLNode &node, int) {
-            const tinyxml2::XMLElement *el = node.ToElement();
-            const char *name = el ? el->Name() : nullptr;
-
-            if (!name || (strcasecmp("td", name) && strcasecmp("th", name))) {
-                return false;
-            }
+inline bool MDMA::deserialize(std::string_view &src, http_entry_type &entry) {
+    std::array<size_t, 4> header;
 
-            const char *align = "";
-            tinyxml2::XMLError err = el->QueryStringAttribute("align", &align);
+    if (src.size() < sizeof(header)) {
+        return false;
+    }
 
-            if (err != tinyxml2::XML_SUCCESS) {
-                return false;
-            }
+    memcpy(header.data(), src.data(), sizeof(header));
 
-            if (align
-            && strcasecmp("left", align)
-            && strcasecmp("right", align)
-            && strcasecmp("center", align)) {
-                return false;
-            }
+    size_t payload = 0;
 
-            tinyxml2::XMLElement *fix_el{
-                const_cast<tinyxml2::XMLElement *>(el)
-            };
+    for (size_t i=1; i<header.size(); ++i) {
+        if (header[i] > src.size()) return false;
 
-            fix_el->SetAttribute(
-                "style",
-                std::string("text-align: ").append(align).append(";").c_str()
-            );
+        payload += header[i];
+    }
 
-            fix_el->DeleteAttribute("align");
+    if (src.size() - sizeof(header) < payload) {
+        return false;
+    }
 
-            return false;
-        }
-    );
-}
+    src.remove_prefix(sizeof(header));
+    entry.expires = int64_t(header[0]);
 
-inline void MDMA::embed_videos(tinyxml2::XMLDocument &doc) const {
-    static constexpr const std::string_view anchor_prefix{"#"};
-    static constexpr const std::string_view video_prefix{
-        "https://www.youtube.com/watch?"
-    };
+    entry.etag.assign(src.data(), header[1]);
+    src.remove_prefix(header[1]);
 
-    std::vector<tinyxml2::XMLNode *> video_links;
+    entry.last_modified.assign(src.data(), header[2]);
+    src.remove_prefix(header[2]);
 
-    find_if(
-        *doc.RootElement(),
-        [&video_links](const tinyxml2::XMLNode &node, int) {
-            const tinyxml2::XMLElement *el = node.ToElement();
-            const char *name = el ? el->Name() : nullptr;
+    entry.body.assign(src.data(), src.data() + header[3]);
+    src.remove_prefix(header[3]);
 
-            if (!name || strcasecmp("a", name)) {
-                return false;
-            }
+    return true;
+}
 
-            const char *href = el->Attribute("href");
+inline void MDMA::serialize(std::string &dst, const fragment_type &fragment) {
+    const std::vector<unsigned char> none;
+    const std::vector<unsigned char> &blob{
+        fragment.blob ? *fragment.blob : none
+    };
 
-            if (!href) {
-                return false;
-            }
+    for (size_t value : {
+        size_t(fragment.progress ? 1 : fragment.blob ? 2 : 0),
+        fragment.text.size(), blob.size()
+    }) {
+        dst.append((const char *) &value, sizeof(value));
+    }
 
-            if (href
-            && !strncasecmp(href, video_prefix.data(), video_prefix.size())) {
-                const tinyxml2::XMLNode *child = node.FirstChild();
+    dst.append(fragment.text).append((const char *) blob.data(), blob.size());
+}
 
-                if (child && child == node.LastChild()) {
-                    const tinyxml2::XMLElement *child_el = child->ToElement();
-                    const char *child_name{
-                        child_el ? child_el->Name() : nullptr
-                    };
+inline bool MDMA::deserialize(std::string_view &src, fragment_type &fragment) {
+    std::array<size_t, 3> header;
 
-                    if (child_name
-                    && !strcasecmp("img", child_name)
-                    && child->NoChildren()) {
-                        video_links.emplace_back(
-                            const_cast<tinyxml2::XMLNode *>(&node)
-                        );
-                    }
-                }
-            }
+    if (src.size() < sizeof(header)) {
+        return false;
+    }
 
-            if (el->Attribute("target")) {
-                return false;
-            }
+    memcpy(header.data(), src.data(), sizeof(header));
 
-            tinyxml2::XMLElement *fix_el{
-                const_cast<tinyxml2::XMLElement *>(el)
-            };
+    if (header[0] > 2
+    ||  header[1] > src.size() || header[2] > src.size()
+    ||  src.size() - sizeof(header) < header[1] + header[2]) {
+        return false;
+    }
 
-            if (strncasecmp(href, anchor_prefix.data(), anchor_prefix.size())) {
-                fix_el->SetAttribute("target", "_blank");
-            }
-            else {
-                fix_el->SetAttribute("target", "_self");
-            }
+    src.remove_prefix(sizeof(header));
 
-            return false;
-        }
-    );
+    fragment.text.assign(src.data(), header[1]);
+    src.remove_prefix(header[1]);
 
-    while (!video_links.empty()) {
-        tinyxml2::XMLNode *link = video_links.back();
-        tinyxml2::XMLNode *link_parent = link->Parent();
-        tinyxml2::XMLElement *link_el = link->ToElement();
+    const unsigned char *bytes = (const unsigned char *) src.data();
 
-        const char *link_href{
-            link_el ? link_el->Attribute("href") : nullptr
-        };
+    fragment.progress = header[0] == 1;
+    fragment.blob = header[0] == 2 ? (
+        std::make_shared<const std::vector<unsigned char>>(
+            bytes, bytes + header[2]
+        )
+    ) : nullptr;
 
-        std::string video_id{link_href ? uri_param_value(link_href, "v") : ""};
+    src.remove_prefix(header[2]);
 
-        tinyxml2::XMLNode *div{
-            !video_id.empty() ? (
-                link_parent->InsertAfterChild(link, doc.NewElement("div"))
-            ) : nullptr
-        };
+    return true;
+}
 
-        tinyxml2::XMLElement *div_el = div ? div->ToElement() : nullptr;
+inline void MDMA::serialize(
+    std::string &dst, const framework_type &framework
+) {
+    for (size_t value : {
+        FRAMEWORK_FORMAT, framework.html.size(), framework.slots.size(),
+        framework.identifiers.size()
+    }) {
+        dst.append((const char *) &value, sizeof(value));
+    }
 
-        if (div_el) {
-            tinyxml2::XMLNode *node = link->DeepClone(&doc);
+    dst.append(
+        (const char *) framework.digest.data(), framework.digest.size()
+    ).append(framework.html);
 
-            if (node) {
-                div->InsertEndChild(node);
-            }
+    for (const framework_slot_type &slot : framework.slots) {
+        const attribute_list_type &attributes = slot.attributes;
 
-            div_el->SetAttribute("class", "MDMA-VIDEO-CONTAINER");
+        for (size_t value : {
+            slot.offset, size_t(slot.kind), slot.tag.size(), attributes.size()
+        }) {
+            dst.append((const char *) &value, sizeof(value));
+        }
 
-            tinyxml2::XMLNode *iframe{
-                div->InsertAfterChild(node, doc.NewElement("iframe"))
-            };
+        dst.append(slot.tag);
 
-            tinyxml2::XMLElement *iframe_el{
-                iframe ? iframe->ToElement() : nullptr
+        for (size_t i=0; i<attributes.size(); ++i) {
+            std::string_view name{attribute_list_type::name_of(attributes[i])};
+            std::string_view value{
+                attribute_list_type::value_of(attributes[i])
             };
 
-            if (iframe_el) {
-                iframe_el->SetAttribute(
-                    "src",
-                    std::string(
-                        "https://www.youtube-nocookie.com/embed/"
-                    ).append(video_id).c_str()
-                );
-
-                iframe_el->SetAttribute("loading", "lazy");
-                iframe_el->SetAttribute("allowfullscreen", "");
-                iframe_el->SetAttribute("style", "color-scheme: normal;");
+            for (size_t field : {
+                size_t(attributes[i].boolean ? 1 : 0), name.size(),
+                value.size()
+            }) {
+                dst.append((const char *) &field, sizeof(field));
             }
 
-            doc.DeleteNode(link);
+            dst.append(name).append(value);
         }
+    }
 
-        video_links.pop_back();
+    for (const auto &[id, value] : framework.identifiers) {
+        size_t len = id.size();
+
+        dst.append((const char *) &len, sizeof(len)).append(id);
     }
 }
 
-inline void MDMA::set_logger(const std::function<void(const char *)>& log_cb) {
-    log_callback = log_cb;
-}
+inline bool MDMA::deserialize(
+    std::string_view &src, framework_type &framework
+) {
+    const auto take_size{
+        [&src](size_t &value) {
+            if (src.size() < sizeof(value)) {
+                return false;
+            }
 
-inline void MDMA::set_directory(const std::filesystem::path &path) {
-    directory = path;
-}
+            memcpy(&value, src.data(), sizeof(value));
+            src.remove_prefix(sizeof(value));
 
-inline void MDMA::log(const char *fmt, ...) const {
-    if (!log_callback) return;
+            return true;
+        }
+    };
 
-    char stackbuf[256];
-    char *bufptr = stackbuf;
-    size_t bufsz = sizeof(stackbuf);
+    const auto take_text{
+        [&src](size_t len, std::string_view &text) {
+            if (src.size() < len) {
+                return false;
+            }
 
-    for (size_t i=0; i<2 && bufptr; ++i) {
-        va_list args;
-        va_start(args, fmt);
-        int cx = vsnprintf(bufptr, bufsz, fmt, args);
-        va_end(args);
+            text = src.substr(0, len);
+            src.remove_prefix(len);
 
-        if ((cx >= 0 && (size_t)cx < bufsz) || cx < 0) {
-            log_callback(bufptr);
-            break;
+            return true;
         }
+    };
 
-        if (bufptr == stackbuf) {
-            bufsz = cx + 1;
-            bufptr = new (std::nothrow) char[bufsz];
-            if (!bufptr) log_callback("out of memory");
-        }
-        else {
-            log_callback(bufptr);
-            break;
-        }
+    std::array<size_t, 4> header;
+    std::string_view text;
+
+    for (size_t &value : header) {
+        if (!take_size(value)) return false;
     }
 
-    if (bufptr && bufptr != stackbuf) delete [] bufptr;
-}
+    if (header[0] != FRAMEWORK_FORMAT
+    || !take_text(framework.digest.size(), text)) {
+        return false;
+    }
 
-inline void MDMA::bug(const char *file, int line) const {
-    log("Forbidden condition met in %s on line %d.", file, line);
-}
+    memcpy(framework.digest.data(), text.data(), text.size());
 
-inline void MDMA::die(const char *file, int line) const {
-    bug(file, line);
-    fflush(nullptr);
-    raise(SIGSEGV);
-}
+    if (!take_text(header[1], text)) {
+        return false;
+    }
 
-inline const char *MDMA::imgfmt2mime(const char *fmt) {
-    return (
-        !strcasecmp("jpg", fmt) ? "jpeg"    :
-        !strcasecmp("svg", fmt) ? "svg+xml" : fmt
-    );
-}
+    framework.html.assign(text);
+    framework.slots.clear();
+    framework.identifiers.clear();
 
-inline std::string MDMA::encode_base64(
-    const unsigned char *bytes, size_t len
-) {
-    if (std::numeric_limits<int>::max() < len) die();
+    size_t offset = 0;
 
-    std::array<char, 256> buffer;
-    base64::base64_encodestate b64e;
-    base64::base64_init_encodestate(&b64e);
-    std::string encoded;
+    for (size_t i=0; i<header[2]; ++i) {
+        std::array<size_t, 4> fields; // offset, kind, tag, attributes
 
-    for (; len > 0;) {
-        int inlen = static_cast<int>(std::min(size_t{64}, len));
+        for (size_t &value : fields) {
+            if (!take_size(value)) return false;
+        }
 
-        int written = base64::base64_encode_block(
-            (const char *) bytes, inlen, buffer.data(), &b64e
-        );
+        if (fields[0] < offset || fields[0] > framework.html.size()
+        ||  fields[1] > SLOT_PROGRESS || !take_text(fields[2], text)) {
+            return false;
+        }
 
-        if (written < 0) die();
-        if (written == 0) break;
+        offset = fields[0];
 
-        bytes += inlen;
-        len -= inlen;
-        encoded.append(buffer.data(), written);
-    }
+        framework_slot_type &slot = framework.slots.emplace_back(
+            framework_slot_type{
+                .offset     = offset,
+                .kind       = framework_slot_kind_type(fields[1]),
+                .tag        = std::string(text),
+                .attributes = {}
+            }
+        );
 
-    int written = base64::base64_encode_blockend(buffer.data(), &b64e);
+        for (size_t j=0; j<fields[3]; ++j) {
+            std::array<size_t, 3> attribute; // boolean, name, value
+            std::string_view name;
+            std::string_view value;
 
-    if (written < 0) {
-        die();
-    }
-    else if (written > 0) {
-        encoded.append(buffer.data(), written);
-    }
+            for (size_t &field : attribute) {
+                if (!take_size(field)) return false;
+            }
 
-    encoded.erase(
-        std::remove_if(
-            encoded.begin(), encoded.end(), ::isspace
-        ),
-        encoded.end()
-    );
+            if (attribute[0] > 1
+            || !take_text(attribute[1], name)
+            || !take_text(attribute[2], value)) {
+                return false;
+            }
 
-    return encoded;
-}
+            if (attribute[0]) {
+                slot.attributes.set_boolean(name);
+            }
+            else slot.attributes.set(name, value);
+        }
+    }
 
-inline std::vector<unsigned char> MDMA::decode_base64(
-    const char *str, size_t len
-) {
-    if (len > std::numeric_limits<int>::max()) die();
+    for (size_t i=0; i<header[3]; ++i) {
+        size_t len;
 
-    size_t decoded_maxlen = len / 4 * 3 + 2;
+        if (!take_size(len) || !take_text(len, text)) {
+            return false;
+        }
 
-    base64::base64_decodestate b64d;
-    base64::base64_init_decodestate(&b64d);
+        framework.identifiers.emplace(text, 0);
+    }
 
-    std::vector<unsigned char> decoded(decoded_maxlen);
+    return true;
+}
 
-    int decoded_len{
-        base64::base64_decode_block(
-            str, int(len), (char *) decoded.data(), &b64d
-        )
-    };
+inline size_t MDMA::parse_reference(std::string_view ref, size_t &index) {
+    // Returns the length of the blob index and its terminating dash that
+    // follow the blob prefix, or zero if there is no valid reference.
 
-    decoded[decoded_len] = 0;
+    size_t digits = 0;
 
-    return decoded;
-}
+    index = 0;
 
-inline std::vector<unsigned char> MDMA::decode_base64(const char *str) {
-    return decode_base64(str, strlen(str));
-}
+    while (digits < ref.size() && isdigit((unsigned char) ref[digits])) {
+        index = index * 10 + size_t(ref[digits++] - '0');
+    }
 
-inline const MDMA::heading_data *MDMA::get_heading_data(int id) const {
-    if (!headings.count(id)) return nullptr;
+    if (!digits || digits >= ref.size() || ref[digits] != '-') {
+        return 0;
+    }
 
-    return &(std::get<0>(headings.at(id)));
+    return digits + 1;
 }
 
 inline std::string MDMA::uri_param_value(const char *uri_str, const char *key) {
@@ -1697,17 +4931,68 @@ inline std::string MDMA::uri_param_value(const char *uri_str, const char *key) {
     return result;
 }
 
-inline std::vector<unsigned char> MDMA::load_file(const char *src) {
+inline bool MDMA::is_remote(const char *src) {
     static constexpr struct prefix_type{
-        const std::string_view data;
         const std::string_view http;
         const std::string_view https;
     } prefixes{
-        .data { "data:"    },
         .http { "http://"  },
         .https{ "https://" }
     };
 
+    return (
+        !strncasecmp(src, prefixes.http.data(),  prefixes.http.size()) ||
+        !strncasecmp(src, prefixes.https.data(), prefixes.https.size())
+    );
+}
+
+inline bool MDMA::is_confined(const char *src) const {
+    // The path must be relative and stay within the directory, also after
+    // the symbolic links in it have been followed.
+
+    std::filesystem::path relative(src);
+
+    if (relative.empty() || relative.has_root_path()) {
+        return false;
+    }
+
+    for (const std::filesystem::path &part : relative) {
+        if (part == "..") return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::path root{
+        std::filesystem::weakly_canonical(
+            directory.empty() ? std::filesystem::current_path(ec) : directory,
+            ec
+        )
+    };
+
+    if (!ec && root.empty()) {
+        ec = std::make_error_code(std::errc::no_such_file_or_directory);
+    }
+
+    if (ec) {
+        return false;
+    }
+
+    std::filesystem::path path{
+        std::filesystem::weakly_canonical(root / relative, ec)
+    };
+
+    return !ec && std::mismatch(
+        root.begin(), root.end(), path.begin(), path.end()
+    ).first == root.end();
+}
+
+inline std::vector<unsigned char> MDMA::load_file(const char *src) {
+    static constexpr const std::string_view data_prefix{ "data:" };
+
+    bool is_data = !strncasecmp(src, data_prefix.data(), data_prefix.size());
+
+    // The data URIs are left out of the reports, since they can be long.
+    stage_timer_type timer(*this, "load", is_data ? data_prefix : src);
+
     if (cfg.verbose) {
         static constexpr const int max_src_len = 50;
         log(
@@ -1716,74 +5001,53 @@ inline std::vector<unsigned char> MDMA::load_file(const char *src) {
         );
     }
 
-    if (!strncasecmp(src, prefixes.data.data(), prefixes.data.size())) {
+    if (is_data) {
         for (char c = *src; c; c = *(++src)) {
             if (c != ',') continue;
 
-            return decode_base64(++src);
+            std::vector<unsigned char> data{decode_base64(++src)};
+
+            timer.bytes_out = data.size();
+
+            return data;
         }
 
         return std::vector<unsigned char>{};
     }
 
-    if (!strncasecmp(src, prefixes.http.data(),  prefixes.http.size())
-    ||  !strncasecmp(src, prefixes.https.data(), prefixes.https.size())) {
-        size_t (*cb)(void *, size_t, size_t, void *){
-            [](void *contents, size_t size, size_t nmemb, void *userp) {
-                std::vector<unsigned char> *v{
-                    (std::vector<unsigned char> *) userp
-                };
-
-                v->insert(
-                    v->end(),
-                    (unsigned char *) contents,
-                    ((unsigned char *) contents) + (size * nmemb)
-                );
-
-                return size * nmemb;
-            }
-        };
-
-        // Download the file from the Internet.
-        std::vector<unsigned char> file;
+    if (is_remote(src)) {
+        if (cfg.offline) {
+            log("%.50s: %s", src, "remote files are not loaded");
+            return {};
+        }
 
-        if (curl) {
-            CURLcode res;
-            std::array<char, CURL_ERROR_SIZE> errbuf;
+        if (!downloads.count(src)) {
+            download({src});
+        }
 
-            curl_easy_setopt(curl, CURLOPT_URL, src);
-            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, cb);
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &file);
-            curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf.data());
+        // The download is kept until the next assembly, since the same file
+        // may be referred to more than once.
+        auto it = downloads.find(src);
 
-            if ((res = curl_easy_perform(curl)) != CURLE_OK) {
-                file.clear();
+        if (it == downloads.end()) {
+            return {};
+        }
 
-                size_t len = strlen(errbuf.data());
+        timer.bytes_out = it->second.size();
 
-                if (len) {
-                    log(
-                        "%s%s", errbuf.data(),
-                        ((errbuf[len - 1] != '\n') ? "\n" : "")
-                    );
-                }
-                else {
-                    log("%s\n", curl_easy_strerror(res));
-                }
-            }
-            else if (cfg.verbose) {
-                log(
-                    "Downloaded %lu byte%s.", file.size(),
-                    file.size() == 1 ? "" : "s"
-                );
-            }
-        }
+        return it->second;
+    }
 
-        return file;
+    if (cfg.confined && !is_confined(src)) {
+        log("%.50s: %s", src, "outside of the directory");
+        return {};
     }
 
     std::filesystem::path path(directory / src);
 
+    // The missing files are recorded too, since they may appear later.
+    local_files.emplace(std::filesystem::absolute(path).lexically_normal());
+
     if (!std::filesystem::exists(path)) {
         return {};
     }
@@ -1802,6 +5066,7 @@ inline std::vector<unsigned char> MDMA::load_file(const char *src) {
     );
 
     input.close();
+    timer.bytes_out = buffer.size();
 
     return buffer;
 }
@@ -7,22 +7,41 @@
 #include <functional>
 #include <cstring>
 #include <cstdarg>
+#include <thread>
+#include <algorithm>
+#include <limits>
 
 class OPTIONS {
     public:
     static constexpr const char *usage_format{
         "Usage: %s [OPTION]... [FILE]\n"
         "General options:\n"
+        "      --batch         Assemble the documents of a list or directory.\n"
+        "      --body-size     Set the request size limit in megabytes (%d).\n"
         "      --brief         Print brief messages (default).\n"
+        "      --cache-dir     Cache processed images in the given directory.\n"
+        "      --cache-size    Set the cache size limit in megabytes (%d).\n"
+        "      --concurrency   Set the number of concurrent assemblies (%d).\n"
+        "      --connections   Set the maximum number of connections (%d).\n"
         "      --debug         Print debugging messages.\n"
+        "      --embed-format  Re-encode embedded images (keep, webp, jpeg).\n"
+        "      --embed-quality Set the quality of re-encoded images (%d).\n"
+        "      --footprint     Also report the memory used per stage.\n"
         "  -f  --framework     Use a custom HTML framework file.\n"
         "  -h  --help          Display this usage information.\n"
+        "  -j  --jobs          Set the number of image processing jobs (%d).\n"
         "      --minify        Disable HTML indentation and wrapping.\n"
         "      --monolith      Embed images and styles within the output.\n"
         "  -o  --output        Specify the output file (standard output).\n"
         "  -p  --preview       Set the image preview shrinking factor (%d).\n"
+        "      --profile[=FMT] Report the time spent per stage (text, json).\n"
+        "      --remote        Let the server download the remote assets.\n"
+        "      --root          Serve the local assets from a directory.\n"
+        "      --serve         Serve on the given unix socket or local port.\n"
+        "      --trace         Write a Chrome trace of the stages to a file.\n"
         "      --verbose       Print verbose messages.\n"
         "  -v  --version       Show version information.\n"
+        "      --watch         Assemble again whenever the input changes.\n"
         "\n"
         "Markdown dialect options:\n"
         "      --commonmark    Use the CommonMark syntax.\n"
@@ -33,30 +52,89 @@ class OPTIONS {
         DIALECT_COMMONMARK = 0,
         DIALECT_GITHUB     = 1;
 
+    static constexpr const int
+        PROFILE_NONE = 0,
+        PROFILE_TEXT = 1,
+        PROFILE_JSON = 2;
+
+    static constexpr const int
+        EMBED_KEEP = 0,
+        EMBED_WEBP = 1,
+        EMBED_JPEG = 2;
+
+    static constexpr const int
+        OPTION_CONNECTIONS   = 256,
+        OPTION_CACHE_DIR     = 257,
+        OPTION_CACHE_SIZE    = 258,
+        OPTION_SERVE         = 259,
+        OPTION_CONCURRENCY   = 260,
+        OPTION_BATCH         = 261,
+        OPTION_PROFILE       = 262,
+        OPTION_TRACE         = 263,
+        OPTION_EMBED_FORMAT  = 264,
+        OPTION_EMBED_QUALITY = 265,
+        OPTION_ROOT          = 266,
+        OPTION_BODY_SIZE     = 267;
+
     struct flagset_type {
         int verbose;
         int debug;
         int minify;
         int monolith;
         int dialect;
+        int watch;
+        int profile;
+        int footprint;
+        int embed_format;
+        int remote;
         int exit;
     };
 
     OPTIONS(const char *caption, const char *version, const char *copyright)
         : flags(
             {
-                .verbose  = 0,
-                .debug    = 0,
-                .minify   = 0,
-                .monolith = 0,
-                .dialect  = DIALECT_GITHUB,
-                .exit     = 0
+                .verbose      = 0,
+                .debug        = 0,
+                .minify       = 0,
+                .monolith     = 0,
+                .dialect      = DIALECT_GITHUB,
+                .watch        = 0,
+                .profile      = PROFILE_NONE,
+                .footprint    = 0,
+                .embed_format = EMBED_KEEP,
+                .remote       = 0,
+                .exit         = 0
             }
         )
         , file         (        "" )
         , framework    (        "" )
         , output       (        "" )
+        , cache_dir    (        "" )
+        , serve        (        "" )
+        , batch        (        "" )
+        , trace        (        "" )
+        , root         (        "" )
         , preview      (         8 )
+        , embed_quality(        80 )
+        , jobs         (
+            uint16_t(
+                std::clamp(
+                    std::thread::hardware_concurrency(), 1u,
+                    unsigned{std::numeric_limits<uint16_t>::max()}
+                )
+            )
+        )
+        , connections  (        16 )
+        , concurrency  (
+            uint16_t(
+                std::clamp(
+                    std::thread::hardware_concurrency(), 1u,
+                    unsigned{std::numeric_limits<uint16_t>::max()}
+                )
+            )
+        )
+        , cache_size   (       256 )
+        , body_size    (         4 )
         , caption      (   caption )
         , version      (   version )
         , copyright    ( copyright )
@@ -69,7 +147,18 @@ class OPTIONS {
     std::string  file;
     std::string  framework;
     std::string  output;
+    std::string  cache_dir;
+    std::string  serve;
+    std::string  batch;
+    std::string  trace;
+    std::string  root;
     uint8_t      preview;
+    uint8_t      embed_quality;
+    uint16_t     jobs;
+    uint16_t     connections;
+    uint16_t     concurrency;
+    uint32_t     cache_size;
+    uint32_t     body_size;
 
     std::string caption;
     std::string version;
@@ -88,14 +177,30 @@ class OPTIONS {
             { "monolith",   no_argument, &flags.monolith,                 1 },
             { "commonmark", no_argument, &flags.dialect, DIALECT_COMMONMARK },
             { "github",     no_argument, &flags.dialect,     DIALECT_GITHUB },
+            { "watch",      no_argument, &flags.watch,                    1 },
+            { "footprint",  no_argument, &flags.footprint,                1 },
+            { "remote",     no_argument, &flags.remote,                   1 },
 
             // These options don't set a flag. We distinguish them by indices:
-            { "framework",   required_argument, 0, 'f'},
-            { "output",      required_argument, 0, 'o'},
-            { "preview",     required_argument, 0, 'p'},
-            { "help",        no_argument,       0, 'h'},
-            { "version",     no_argument,       0, 'v'},
-            { 0,             0,                 0,  0 }
+            { "framework",     required_argument, 0, 'f'},
+            { "output",        required_argument, 0, 'o'},
+            { "preview",       required_argument, 0, 'p'},
+            { "help",          no_argument,       0, 'h'},
+            { "jobs",          required_argument, 0, 'j'},
+            { "connections",   required_argument, 0, OPTION_CONNECTIONS   },
+            { "cache-dir",     required_argument, 0, OPTION_CACHE_DIR     },
+            { "cache-size",    required_argument, 0, OPTION_CACHE_SIZE    },
+            { "serve",         required_argument, 0, OPTION_SERVE         },
+            { "concurrency",   required_argument, 0, OPTION_CONCURRENCY   },
+            { "batch",         required_argument, 0, OPTION_BATCH         },
+            { "profile",       optional_argument, 0, OPTION_PROFILE       },
+            { "trace",         required_argument, 0, OPTION_TRACE         },
+            { "embed-format",  required_argument, 0, OPTION_EMBED_FORMAT  },
+            { "embed-quality", required_argument, 0, OPTION_EMBED_QUALITY },
+            { "root",          required_argument, 0, OPTION_ROOT          },
+            { "body-size",     required_argument, 0, OPTION_BODY_SIZE     },
+            { "version",       no_argument,       0, 'v'},
+            { 0,               0,                 0,  0 }
         };
 
         this->log_callback = log_callback;
@@ -105,7 +210,7 @@ class OPTIONS {
             int option_index = -1;
 
             int c = getopt_long(
-                argc, argv, "f:o:p:hv", long_options, &option_index
+                argc, argv, "f:o:p:j:hv", long_options, &option_index
             );
 
             // Detect the end of the options.
@@ -148,11 +253,149 @@ class OPTIONS {
                     break;
                 }
                 case 'h': {
-                    fprintf(stdout, usage_format, argv[0], int(preview));
+                    fprintf(
+                        stdout, usage_format, argv[0], int(body_size),
+                        int(cache_size), int(concurrency), int(connections),
+                        int(embed_quality), int(jobs), int(preview)
+                    );
                     flags.exit = 1;
 
                     break;
                 }
+                case 'j': {
+                    int i = atoi(optarg);
+
+                    if (i < 1 || i > std::numeric_limits<uint16_t>::max()) {
+                        log(
+                            "invalid %s: %s",
+                            long_options[option_index].name, optarg
+                        );
+                    }
+                    else jobs = uint16_t(i);
+
+                    break;
+                }
+                case OPTION_CONNECTIONS: {
+                    int i = atoi(optarg);
+
+                    if (i < 1 || i > std::numeric_limits<uint16_t>::max()) {
+                        log(
+                            "invalid %s: %s",
+                            long_options[option_index].name, optarg
+                        );
+                    }
+                    else connections = uint16_t(i);
+
+                    break;
+                }
+                case OPTION_CONCURRENCY: {
+                    int i = atoi(optarg);
+
+                    if (i < 1 || i > std::numeric_limits<uint16_t>::max()) {
+                        log(
+                            "invalid %s: %s",
+                            long_options[option_index].name, optarg
+                        );
+                    }
+                    else concurrency = uint16_t(i);
+
+                    break;
+                }
+                case OPTION_CACHE_DIR: {
+                    cache_dir.assign(optarg);
+                    break;
+                }
+                case OPTION_CACHE_SIZE: {
+                    long i = atol(optarg);
+
+                    if (i < 1 || i > std::numeric_limits<uint32_t>::max()) {
+                        log(
+                            "invalid %s: %s",
+                            long_options[option_index].name, optarg
+                        );
+                    }
+                    else cache_size = uint32_t(i);
+
+                    break;
+                }
+                case OPTION_BODY_SIZE: {
+                    long i = atol(optarg);
+
+                    if (i < 1 || i > std::numeric_limits<uint32_t>::max()) {
+                        log(
+                            "invalid %s: %s",
+                            long_options[option_index].name, optarg
+                        );
+                    }
+                    else body_size = uint32_t(i);
+
+                    break;
+                }
+                case OPTION_BATCH: {
+                    batch.assign(optarg);
+                    break;
+                }
+                case OPTION_SERVE: {
+                    serve.assign(optarg);
+                    break;
+                }
+                case OPTION_PROFILE: {
+                    if (!optarg || !strcmp(optarg, "text")) {
+                        flags.profile = PROFILE_TEXT;
+                    }
+                    else if (!strcmp(optarg, "json")) {
+                        flags.profile = PROFILE_JSON;
+                    }
+                    else {
+                        log(
+                            "invalid %s: %s",
+                            long_options[option_index].name, optarg
+                        );
+                    }
+
+                    break;
+                }
+                case OPTION_TRACE: {
+                    trace.assign(optarg);
+                    break;
+                }
+                case OPTION_ROOT: {
+                    root.assign(optarg);
+                    break;
+                }
+                case OPTION_EMBED_FORMAT: {
+                    if (!strcmp(optarg, "keep")) {
+                        flags.embed_format = EMBED_KEEP;
+                    }
+                    else if (!strcmp(optarg, "webp")) {
+                        flags.embed_format = EMBED_WEBP;
+                    }
+                    else if (!strcmp(optarg, "jpeg")) {
+                        flags.embed_format = EMBED_JPEG;
+                    }
+                    else {
+                        log(
+                            "invalid %s: %s",
+                            long_options[option_index].name, optarg
+                        );
+                    }
+
+                    break;
+                }
+                case OPTION_EMBED_QUALITY: {
+                    int i = atoi(optarg);
+
+                    if ((i == 0 && (optarg[0] != '0' || optarg[1] != '\0'))
+                    ||  (i < 0 || i > 100)) {
+                        log(
+                            "invalid %s: %s",
+                            long_options[option_index].name, optarg
+                        );
+                    }
+                    else embed_quality = uint8_t(i);
+
+                    break;
+                }
                 case 'o': {
                     output.assign(optarg);
                     break;
@@ -201,6 +444,11 @@ class OPTIONS {
 
         if (flags.exit) return true;
 
+        // The memory is reported along with the times.
+        if (flags.footprint && flags.profile == PROFILE_NONE) {
+            flags.profile = PROFILE_TEXT;
+        }
+
         if (optind < argc) {
             file.assign(argv[optind++]);
 
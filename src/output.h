@@ -0,0 +1,296 @@
+// SPDX-License-Identifier: MIT
+#ifndef OUTPUT_H_16_10_2026
+#define OUTPUT_H_16_10_2026
+
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <format>
+#include <cerrno>
+#include <cstring>
+#include <climits>
+#include <cstdlib>
+
+class OUTPUT {
+    // Buffers the output and writes it to a file descriptor. A regular file is
+    // written under a temporary name next to it and renamed over it once it
+    // is committed, so that it is never seen incomplete. Anything else, such
+    // as a device or a pipe, is written directly. Files may also be
+    // spliced in, which lets the kernel copy them without passing their
+    // contents through the process. On failure errno tells the reason.
+
+    public:
+    OUTPUT() : fd(-1), owned(false), path(), temporary(), buffer(), used(0) {}
+
+    OUTPUT(const OUTPUT &) = delete;
+    OUTPUT &operator=(const OUTPUT &) = delete;
+
+    ~OUTPUT() {
+        if (owned) {
+            close(fd);
+
+            if (!temporary.empty()) {
+                unlink(temporary.c_str());
+            }
+        }
+    }
+
+    bool open(const std::string &path);
+    void attach(int fd);
+    bool write(const char *data, size_t size);
+    bool splice(int from, size_t size);
+    bool commit();
+
+    private:
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+    bool flush();
+    bool write_all(const char *data, size_t size);
+
+    int fd;
+    bool owned;
+    std::string path;
+    std::string temporary;
+    std::vector<char> buffer;
+    size_t used;
+};
+
+inline bool OUTPUT::open(const std::string &destination) {
+    // An empty path stands for the standard output. The temporary file goes
+    // next to the file that a symbolic link points to, so that the link is
+    // kept, and it gets the mode of the file it replaces. Its name is unique
+    // within the process and it is created exclusively, so that concurrent
+    // writers never share it.
+
+    static std::atomic<unsigned> counter{0};
+
+    if (destination.empty()) {
+        attach(STDOUT_FILENO);
+        return true;
+    }
+
+    struct stat st;
+    bool exists = stat(destination.c_str(), &st) == 0;
+
+    if (!exists && errno != ENOENT) {
+        return false;
+    }
+
+    bool direct{
+        // The names under /dev and /proc, such as /dev/stdout, may stand for
+        // a descriptor already open, which a rename would not reach.
+        destination.starts_with("/dev/") || destination.starts_with("/proc/")
+    };
+
+    if (exists) {
+        direct = direct || !S_ISREG(st.st_mode);
+    }
+    else {
+        // A dangling symbolic link is followed by creating its target.
+        struct stat lst;
+
+        direct = direct || lstat(destination.c_str(), &lst) == 0;
+    }
+
+    if (direct) {
+        fd = ::open(
+            destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666
+        );
+
+        if (fd == -1) {
+            return false;
+        }
+
+        owned = true;
+        buffer.resize(BUFFER_SIZE);
+
+        return true;
+    }
+
+    if (exists) {
+        char resolved[PATH_MAX];
+
+        if (!realpath(destination.c_str(), resolved)) {
+            return false;
+        }
+
+        path = resolved;
+    }
+    else path = destination;
+
+    temporary = std::format("{}.{}-{}.tmp", path, getpid(), counter++);
+
+    fd = ::open(
+        temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666
+    );
+
+    if (fd == -1) {
+        temporary.clear();
+        return false;
+    }
+
+    owned = true;
+
+    if (exists && fchmod(fd, st.st_mode & 07777) == -1) {
+        return false;
+    }
+
+    buffer.resize(BUFFER_SIZE);
+
+    return true;
+}
+
+inline void OUTPUT::attach(int descriptor) {
+    fd = descriptor;
+    buffer.resize(BUFFER_SIZE);
+}
+
+inline bool OUTPUT::write(const char *data, size_t size) {
+    if (used + size <= buffer.size()) {
+        memcpy(buffer.data() + used, data, size);
+        used += size;
+
+        return true;
+    }
+
+    if (!flush()) {
+        return false;
+    }
+
+    if (size < buffer.size()) {
+        memcpy(buffer.data(), data, size);
+        used = size;
+
+        return true;
+    }
+
+    return write_all(data, size);
+}
+
+inline bool OUTPUT::splice(int from, size_t size) {
+    // The file is copied from its beginning. The copy falls back from
+    // copy_file_range to sendfile and then to plain reads and writes, as the
+    // faster ones are refused for some pairs of file types.
+
+    if (!flush()) {
+        return false;
+    }
+
+    bool copy_file = true;
+    bool send_file = true;
+    off_t offset = 0;
+
+    while (size_t(offset) < size) {
+        size_t len = size - size_t(offset);
+        ssize_t nb;
+
+        if (copy_file) {
+            nb = copy_file_range(from, &offset, fd, nullptr, len, 0);
+
+            if (nb == -1 && (
+                errno == EXDEV || errno == EINVAL || errno == EBADF
+            ||  errno == ENOSYS || errno == EOPNOTSUPP
+            )) {
+                copy_file = false;
+                continue;
+            }
+        }
+        else if (send_file) {
+            nb = sendfile(fd, from, &offset, len);
+
+            if (nb == -1 && (errno == EINVAL || errno == ENOSYS)) {
+                send_file = false;
+                continue;
+            }
+        }
+        else {
+            nb = pread(
+                from, buffer.data(), std::min(len, buffer.size()), offset
+            );
+
+            if (nb > 0 && !write_all(buffer.data(), size_t(nb))) {
+                return false;
+            }
+
+            if (nb > 0) {
+                offset += nb;
+            }
+        }
+
+        if (nb == -1 && errno == EINTR) continue;
+
+        if (nb == 0) {
+            errno = EIO;
+            return false;
+        }
+
+        if (nb == -1) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+inline bool OUTPUT::commit() {
+    if (!flush()) {
+        return false;
+    }
+
+    if (!owned) {
+        return true;
+    }
+
+    owned = false;
+
+    if (temporary.empty()) {
+        return close(fd) == 0;
+    }
+
+    if (close(fd) == -1 || rename(temporary.c_str(), path.c_str()) == -1) {
+        int error = errno;
+
+        unlink(temporary.c_str());
+        errno = error;
+
+        return false;
+    }
+
+    return true;
+}
+
+inline bool OUTPUT::flush() {
+    if (!used) {
+        return true;
+    }
+
+    size_t size = used;
+
+    used = 0;
+
+    return write_all(buffer.data(), size);
+}
+
+inline bool OUTPUT::write_all(const char *data, size_t size) {
+    while (size) {
+        ssize_t nb = ::write(fd, data, size);
+
+        if (nb == -1) {
+            if (errno == EINTR) continue;
+
+            return false;
+        }
+
+        data += nb;
+        size -= size_t(nb);
+    }
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,446 @@
+// SPDX-License-Identifier: MIT
+#ifndef PROFILER_H_16_10_2026
+#define PROFILER_H_16_10_2026
+
+#include "mdma.h"
+////////////////////////////////////////////////////////////////////////////////
+#include <unistd.h>
+#include <fstream>
+#include <functional>
+#include <chrono>
+#include <format>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdint>
+
+class PROFILER {
+    // Collects the stages reported by the assemblers of every thread. The
+    // stages are summed up by name, the ones that concern an asset are also
+    // kept one by one, and every stage may be written to a trace file in the
+    // trace event format of Chrome as soon as it ends. When the stages come
+    // with samples of the memory usage, the largest figures of every stage
+    // are kept as well.
+
+    public:
+    PROFILER(bool summarize)
+        : summarize(summarize)
+        , mutex()
+        , totals()
+        , indices()
+        , assets()
+        , trace()
+        , trace_events(0)
+        , epoch(std::chrono::steady_clock::now())
+        , flushed(epoch) {}
+
+    PROFILER(const PROFILER &) = delete;
+    PROFILER &operator=(const PROFILER &) = delete;
+
+    ~PROFILER() {
+        if (trace.is_open()) {
+            trace << "\n]\n";
+        }
+    }
+
+    bool open_trace(const std::string &path);
+    void record(const MDMA::stage_type &);
+    std::vector<std::string> report(bool json);
+
+    private:
+    struct footprint_type {
+        size_t peak_rss;
+        size_t peak_children_rss;
+        int64_t rss_growth;
+        int64_t heap_growth;
+        size_t allocations;
+        size_t assembly_buffer;
+        size_t tidy_buffer;
+        size_t sections;
+    };
+
+    struct total_type {
+        std::string name;
+        size_t calls;
+        std::chrono::nanoseconds wall;
+        std::chrono::nanoseconds cpu;
+        size_t bytes_in;
+        size_t bytes_out;
+        bool sampled;
+        footprint_type footprint; // the largest of the calls
+    };
+
+    struct asset_type {
+        std::string stage;
+        std::string name;
+        std::chrono::nanoseconds wall;
+        std::chrono::nanoseconds cpu;
+        size_t bytes_in;
+        size_t bytes_out;
+    };
+
+    void write_event(const MDMA::stage_type &);
+    static void measure(
+        footprint_type &, const MDMA::stage_type &, bool first
+    );
+    static std::string &escape(std::string &output, std::string_view text);
+
+    bool summarize; // a trace alone needs no totals
+    std::mutex mutex;
+    std::vector<total_type> totals;
+    std::map<std::string, size_t, std::less<>> indices;
+    std::vector<asset_type> assets;
+    std::ofstream trace;
+    size_t trace_events;
+    std::chrono::steady_clock::time_point epoch;
+    std::chrono::steady_clock::time_point flushed;
+};
+
+inline bool PROFILER::open_trace(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    trace.open(path, std::ios::binary | std::ios::trunc);
+
+    if (!trace) {
+        return false;
+    }
+
+    // The closing bracket is optional in this format, so the file remains
+    // readable even if the program is killed before it is written.
+    trace << "[\n";
+
+    return bool(trace);
+}
+
+inline void PROFILER::record(const MDMA::stage_type &stage) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (trace.is_open()) {
+        write_event(stage);
+    }
+
+    if (!summarize) {
+        return;
+    }
+
+    auto found = indices.find(std::string_view{stage.name});
+
+    if (found == indices.end()) {
+        found = indices.emplace(stage.name, totals.size()).first;
+        totals.emplace_back(
+            total_type{
+                .name      = stage.name,
+                .calls     = 0,
+                .wall      = {},
+                .cpu       = {},
+                .bytes_in  = 0,
+                .bytes_out = 0,
+                .sampled   = false,
+                .footprint = {}
+            }
+        );
+    }
+
+    total_type &total = totals[found->second];
+
+    ++total.calls;
+    total.wall += stage.end - stage.start;
+    total.cpu += stage.cpu;
+    total.bytes_in += stage.bytes_in;
+    total.bytes_out += stage.bytes_out;
+
+    if (stage.sampled) {
+        measure(total.footprint, stage, !total.sampled);
+        total.sampled = true;
+    }
+
+    if (!stage.detail.empty()) {
+        assets.emplace_back(
+            asset_type{
+                .stage     = stage.name,
+                .name      = std::string(stage.detail),
+                .wall      = stage.end - stage.start,
+                .cpu       = stage.cpu,
+                .bytes_in  = stage.bytes_in,
+                .bytes_out = stage.bytes_out
+            }
+        );
+    }
+}
+
+inline std::vector<std::string> PROFILER::report(bool json) {
+    // The stages are listed in the order they were first seen. Some of them
+    // are nested in others, so their times do not add up.
+
+    using milliseconds = std::chrono::duration<double, std::milli>;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> lines;
+
+    if (json) {
+        std::string line{"{\"stages\":["};
+
+        for (const total_type &total : totals) {
+            line.append(line.back() == '[' ? "{" : ",{").append(
+                std::format(
+                    "\"name\":\"{}\",\"calls\":{},\"wall_ms\":{:.3f},"
+                    "\"cpu_ms\":{:.3f},\"bytes_in\":{},\"bytes_out\":{}",
+                    total.name, total.calls,
+                    milliseconds(total.wall).count(),
+                    milliseconds(total.cpu).count(),
+                    total.bytes_in, total.bytes_out
+                )
+            );
+
+            if (total.sampled) {
+                const footprint_type &fp = total.footprint;
+
+                line.append(
+                    std::format(
+                        ",\"memory\":{{\"peak_rss\":{},"
+                        "\"peak_children_rss\":{},\"rss_growth\":{},"
+                        "\"heap_growth\":{},\"allocations\":{},"
+                        "\"assembly_buffer\":{},\"tidy_buffer\":{},"
+                        "\"sections\":{}}}",
+                        fp.peak_rss, fp.peak_children_rss, fp.rss_growth,
+                        fp.heap_growth, fp.allocations, fp.assembly_buffer,
+                        fp.tidy_buffer, fp.sections
+                    )
+                );
+            }
+
+            line.append("}");
+        }
+
+        line.append("],\"assets\":[");
+
+        for (const asset_type &asset : assets) {
+            line.append(line.back() == '[' ? "{" : ",{").append(
+                std::format("\"stage\":\"{}\",\"name\":\"", asset.stage)
+            );
+
+            escape(line, asset.name).append(
+                std::format(
+                    "\",\"wall_ms\":{:.3f},\"cpu_ms\":{:.3f},"
+                    "\"bytes_in\":{},\"bytes_out\":{}}}",
+                    milliseconds(asset.wall).count(),
+                    milliseconds(asset.cpu).count(),
+                    asset.bytes_in, asset.bytes_out
+                )
+            );
+        }
+
+        lines.emplace_back(line.append("]}"));
+    }
+    else {
+        lines.emplace_back(
+            std::format(
+                "{:<14} {:>7} {:>10} {:>10} {:>11} {:>11}",
+                "Stage", "Calls", "Wall ms", "CPU ms", "Bytes in", "Bytes out"
+            )
+        );
+
+        for (const total_type &total : totals) {
+            lines.emplace_back(
+                std::format(
+                    "{:<14} {:>7} {:>10.3f} {:>10.3f} {:>11} {:>11}",
+                    total.name, total.calls,
+                    milliseconds(total.wall).count(),
+                    milliseconds(total.cpu).count(),
+                    total.bytes_in, total.bytes_out
+                )
+            );
+        }
+
+        for (const asset_type &asset : assets) {
+            lines.emplace_back(
+                std::format(
+                    "{:<14} {:>7} {:>10.3f} {:>10.3f} {:>11} {:>11} {}",
+                    asset.stage, "", milliseconds(asset.wall).count(),
+                    milliseconds(asset.cpu).count(),
+                    asset.bytes_in, asset.bytes_out, asset.name
+                )
+            );
+        }
+
+        // The memory is listed apart, as the table would be too wide
+        // otherwise. The growths may be negative when a stage frees memory.
+        size_t peak_children_rss = 0;
+        bool sampled = false;
+
+        for (const total_type &total : totals) {
+            if (!total.sampled) {
+                continue;
+            }
+
+            if (!sampled) {
+                lines.emplace_back(
+                    std::format(
+                        "{:<14} {:>10} {:>10} {:>10} {:>9} {:>9} {:>9} {:>9}",
+                        "Memory (KiB)", "Peak RSS", "RSS +/-", "Heap +/-",
+                        "Allocs", "Assembly", "Tidy", "Sections"
+                    )
+                );
+
+                sampled = true;
+            }
+
+            const footprint_type &fp = total.footprint;
+
+            lines.emplace_back(
+                std::format(
+                    "{:<14} {:>10} {:>10} {:>10} {:>9} {:>9} {:>9} {:>9}",
+                    total.name, fp.peak_rss / 1024, fp.rss_growth / 1024,
+                    fp.heap_growth / 1024, fp.allocations,
+                    fp.assembly_buffer / 1024, fp.tidy_buffer / 1024,
+                    fp.sections / 1024
+                )
+            );
+
+            peak_children_rss = std::max(
+                peak_children_rss, fp.peak_children_rss
+            );
+        }
+
+        if (peak_children_rss) {
+            lines.emplace_back(
+                std::format(
+                    "Peak RSS of the image workers: {} KiB",
+                    peak_children_rss / 1024
+                )
+            );
+        }
+    }
+
+    totals.clear();
+    indices.clear();
+    assets.clear();
+
+    if (trace.is_open()) {
+        trace.flush();
+    }
+
+    return lines;
+}
+
+inline void PROFILER::write_event(const MDMA::stage_type &stage) {
+    // The overlapping stages are written as asynchronous events, since the
+    // complete events of a thread have to nest properly.
+
+    using microseconds = std::chrono::duration<double, std::micro>;
+
+    double ts = microseconds(stage.start - epoch).count();
+    double dur = microseconds(stage.end - stage.start).count();
+    std::string args;
+
+    escape(args.append("{\"detail\":\""), stage.detail).append(
+        std::format(
+            "\",\"cpu_us\":{:.3f},\"bytes_in\":{},\"bytes_out\":{}",
+            microseconds(stage.cpu).count(), stage.bytes_in, stage.bytes_out
+        )
+    );
+
+    if (stage.sampled) {
+        const MDMA::usage_type &usage = stage.usage_end;
+
+        args.append(
+            std::format(
+                ",\"rss\":{},\"heap\":{},\"allocations\":{},"
+                "\"assembly_buffer\":{},\"tidy_buffer\":{},"
+                "\"sections\":{}",
+                usage.rss, usage.heap,
+                usage.allocations - stage.usage_start.allocations,
+                usage.assembly_buffer, usage.tidy_buffer, usage.sections
+            )
+        );
+    }
+
+    args.append("}");
+
+    if (trace_events++) {
+        trace << ",\n";
+    }
+
+    if (stage.async) {
+        trace << std::format(
+            "{{\"name\":\"{0}\",\"cat\":\"mdma\",\"ph\":\"b\",\"id\":{1},"
+            "\"ts\":{2:.3f},\"pid\":{3},\"tid\":{4},\"args\":{5}}},\n"
+            "{{\"name\":\"{0}\",\"cat\":\"mdma\",\"ph\":\"e\",\"id\":{1},"
+            "\"ts\":{6:.3f},\"pid\":{3},\"tid\":{4}}}",
+            stage.name, trace_events, ts, getpid(), stage.thread, args,
+            ts + dur
+        );
+    }
+    else {
+        trace << std::format(
+            "{{\"name\":\"{}\",\"cat\":\"mdma\",\"ph\":\"X\",\"ts\":{:.3f},"
+            "\"dur\":{:.3f},\"pid\":{},\"tid\":{},\"args\":{}}}",
+            stage.name, ts, dur, getpid(), stage.thread, args
+        );
+    }
+
+    // The counters draw the memory as a graph along the timeline.
+    if (stage.sampled) {
+        trace << std::format(
+            ",\n{{\"name\":\"memory\",\"cat\":\"mdma\",\"ph\":\"C\","
+            "\"ts\":{:.3f},\"pid\":{},\"args\":{{\"rss\":{},\"heap\":{}}}}}",
+            ts + dur, getpid(), stage.usage_end.rss, stage.usage_end.heap
+        );
+    }
+
+    // A long running server never gets to write a report, so the trace is
+    // flushed every now and then instead.
+    auto now = std::chrono::steady_clock::now();
+
+    if (now - flushed >= std::chrono::seconds(1)) {
+        trace.flush();
+        flushed = now;
+    }
+}
+
+inline void PROFILER::measure(
+    footprint_type &footprint, const MDMA::stage_type &stage, bool first
+) {
+    const MDMA::usage_type &start = stage.usage_start;
+    const MDMA::usage_type &end = stage.usage_end;
+    int64_t rss_growth = int64_t(end.rss) - int64_t(start.rss);
+    int64_t heap_growth = int64_t(end.heap) - int64_t(start.heap);
+
+    footprint.peak_rss = std::max(footprint.peak_rss, end.peak_rss);
+    footprint.peak_children_rss = std::max(
+        footprint.peak_children_rss, end.peak_children_rss
+    );
+    footprint.rss_growth = first ? rss_growth : std::max(
+        footprint.rss_growth, rss_growth
+    );
+    footprint.heap_growth = first ? heap_growth : std::max(
+        footprint.heap_growth, heap_growth
+    );
+    footprint.allocations += end.allocations - start.allocations;
+    footprint.assembly_buffer = std::max(
+        footprint.assembly_buffer, end.assembly_buffer
+    );
+    footprint.tidy_buffer = std::max(footprint.tidy_buffer, end.tidy_buffer);
+    footprint.sections = std::max(footprint.sections, end.sections);
+}
+
+inline std::string &PROFILER::escape(
+    std::string &output, std::string_view text
+) {
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            output.append(1, '\\').append(1, c);
+        }
+        else if ((unsigned char) c < 0x20) {
+            output.append(std::format("\\u{:04x}", int(c)));
+        }
+        else output.append(1, c);
+    }
+
+    return output;
+}
+
+#endif
@@ -0,0 +1,293 @@
+// SPDX-License-Identifier: MIT
+#ifndef SCALED_H_16_10_2026
+#define SCALED_H_16_10_2026
+
+#include "jpegerror.h"
+////////////////////////////////////////////////////////////////////////////////
+#include <webp/decode.h>
+#include <cstdio>
+#include <jpeglib.h>
+#include <csetjmp>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+// Decoders that shrink JPEG and WebP images while decoding them, so that the
+// pixels of the full image are never held in memory. JPEG images are scaled
+// down in the DCT domain by a power of two, WebP images are rescaled to the
+// requested size row by row. The pixels come out in the ARGB layout that
+// Imlib2 uses. The images these decline, such as CMYK or rotated JPEGs and
+// animated WebPs, are meant to be left to Imlib2.
+
+struct scaled_info_type {
+    const char *format; // jpeg or webp
+    int width;
+    int height;
+    bool alpha;
+};
+
+namespace scaled_detail {
+    using jpeg_detail::jpeg_error_type;
+    using jpeg_detail::jpeg_error_exit;
+    using jpeg_detail::jpeg_output_message;
+
+    inline bool is_jpeg(const unsigned char *data, size_t size) {
+        return size > 3
+            && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff;
+    }
+
+    inline bool is_webp(const unsigned char *data, size_t size) {
+        return size > 12
+            && !memcmp(data, "RIFF", 4) && !memcmp(data + 8, "WEBP", 4);
+    }
+
+    inline unsigned jpeg_orientation(const jpeg_decompress_struct &cinfo) {
+        // Reads the orientation tag from the first directory of the Exif
+        // data. One stands for an upright image.
+
+        for (jpeg_saved_marker_ptr m = cinfo.marker_list; m; m = m->next) {
+            if (m->marker != JPEG_APP0 + 1 || m->data_length < 14
+            ||  memcmp(m->data, "Exif\0\0", 6)) {
+                continue;
+            }
+
+            const JOCTET *tiff = m->data + 6;
+            size_t len = m->data_length - 6;
+            bool little = tiff[0] == 'I' && tiff[1] == 'I';
+
+            if (!little && (tiff[0] != 'M' || tiff[1] != 'M')) {
+                return 1;
+            }
+
+            const auto u16{
+                [&](size_t at) -> unsigned {
+                    return little ? (
+                        unsigned(tiff[at]) | unsigned(tiff[at + 1]) << 8
+                    ) : (
+                        unsigned(tiff[at]) << 8 | unsigned(tiff[at + 1])
+                    );
+                }
+            };
+
+            size_t ifd = little ? (
+                size_t(u16(4)) | size_t(u16(6)) << 16
+            ) : (
+                size_t(u16(4)) << 16 | size_t(u16(6))
+            );
+
+            if (ifd > len || len - ifd < 2) {
+                return 1;
+            }
+
+            size_t count = u16(ifd);
+
+            for (size_t i=0; i<count; ++i) {
+                size_t entry = ifd + 2 + i * 12;
+
+                if (entry + 12 > len) break;
+
+                if (u16(entry) == 0x0112) {
+                    return u16(entry + 8);
+                }
+            }
+
+            return 1;
+        }
+
+        return 1;
+    }
+
+    inline bool jpeg(
+        const unsigned char *data, size_t size, scaled_info_type &info,
+        int min_width, int min_height, std::vector<uint32_t> *pixels,
+        int &width, int &height
+    ) {
+        // Nothing with a destructor may be created after the jump buffer is
+        // set, so the scanline buffer comes from the pool of the decoder.
+
+        jpeg_decompress_struct cinfo;
+        jpeg_error_type error;
+
+        cinfo.err = jpeg_std_error(&error.mgr);
+        error.mgr.error_exit = jpeg_error_exit;
+        error.mgr.output_message = jpeg_output_message;
+
+        if (setjmp(error.jump)) {
+            jpeg_destroy_decompress(&cinfo);
+            return false;
+        }
+
+        jpeg_create_decompress(&cinfo);
+        jpeg_mem_src(&cinfo, (unsigned char *) data, (unsigned long) size);
+        jpeg_save_markers(&cinfo, JPEG_APP0 + 1, 0xffff);
+        jpeg_read_header(&cinfo, TRUE);
+
+        if (cinfo.jpeg_color_space == JCS_CMYK
+        ||  cinfo.jpeg_color_space == JCS_YCCK
+        ||  jpeg_orientation(cinfo) > 1) {
+            jpeg_destroy_decompress(&cinfo);
+            return false;
+        }
+
+        info.format = "jpeg";
+        info.width  = int(cinfo.image_width);
+        info.height = int(cinfo.image_height);
+        info.alpha  = false;
+
+        if (!pixels) {
+            jpeg_destroy_decompress(&cinfo);
+            return true;
+        }
+
+        // The largest reduction that keeps both sides at the minimum or
+        // above it.
+        unsigned denom = 8;
+
+        while (denom > 1 && (
+            (cinfo.image_width + denom - 1) / denom < unsigned(min_width)
+        ||  (cinfo.image_height + denom - 1) / denom < unsigned(min_height)
+        )) {
+            denom /= 2;
+        }
+
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = denom;
+        cinfo.out_color_space = JCS_RGB;
+        cinfo.dct_method = JDCT_IFAST;
+        cinfo.do_fancy_upsampling = FALSE;
+
+        jpeg_start_decompress(&cinfo);
+
+        width = int(cinfo.output_width);
+        height = int(cinfo.output_height);
+        pixels->resize(size_t(width) * size_t(height));
+
+        JSAMPARRAY row{
+            (*cinfo.mem->alloc_sarray)(
+                (j_common_ptr) &cinfo, JPOOL_IMAGE, cinfo.output_width * 3, 1
+            )
+        };
+
+        while (cinfo.output_scanline < cinfo.output_height) {
+            uint32_t *dst{
+                pixels->data() + size_t(cinfo.output_scanline) * size_t(width)
+            };
+
+            jpeg_read_scanlines(&cinfo, row, 1);
+
+            for (size_t x=0; x<size_t(width); ++x) {
+                const JSAMPLE *rgb = row[0] + x * 3;
+
+                dst[x] = (
+                    0xff000000u | uint32_t(rgb[0]) << 16 |
+                    uint32_t(rgb[1]) << 8 | uint32_t(rgb[2])
+                );
+            }
+        }
+
+        jpeg_finish_decompress(&cinfo);
+        jpeg_destroy_decompress(&cinfo);
+
+        return true;
+    }
+
+    inline bool webp(
+        const unsigned char *data, size_t size, scaled_info_type &info,
+        int min_width, int min_height, std::vector<uint32_t> *pixels,
+        int &width, int &height
+    ) {
+        WebPDecoderConfig config;
+
+        if (!WebPInitDecoderConfig(&config)
+        ||  WebPGetFeatures(data, size, &config.input) != VP8_STATUS_OK
+        ||  config.input.has_animation) {
+            return false;
+        }
+
+        info.format = "webp";
+        info.width  = config.input.width;
+        info.height = config.input.height;
+        info.alpha  = config.input.has_alpha;
+
+        if (!pixels) {
+            return true;
+        }
+
+        // The decoder rescales to any size, so the image is decoded right at
+        // the minimum size.
+        width = std::clamp(min_width, 1, std::max(info.width, 1));
+        height = std::clamp(min_height, 1, std::max(info.height, 1));
+        pixels->resize(size_t(width) * size_t(height));
+
+        config.options.use_scaling = 1;
+        config.options.scaled_width = width;
+        config.options.scaled_height = height;
+        config.options.bypass_filtering = 1;
+        config.options.no_fancy_upsampling = 1;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        config.output.colorspace = MODE_BGRA;
+#else
+        config.output.colorspace = MODE_ARGB;
+#endif
+        config.output.is_external_memory = 1;
+        config.output.u.RGBA.rgba = (uint8_t *) pixels->data();
+        config.output.u.RGBA.stride = width * 4;
+        config.output.u.RGBA.size = pixels->size() * 4;
+
+        bool success = WebPDecode(data, size, &config) == VP8_STATUS_OK;
+
+        WebPFreeDecBuffer(&config.output);
+
+        return success;
+    }
+}
+
+inline bool scaled_info(
+    const unsigned char *data, size_t size, scaled_info_type &info
+) {
+    int width;
+    int height;
+
+    if (scaled_detail::is_jpeg(data, size)) {
+        return scaled_detail::jpeg(
+            data, size, info, 0, 0, nullptr, width, height
+        );
+    }
+
+    if (scaled_detail::is_webp(data, size)) {
+        return scaled_detail::webp(
+            data, size, info, 0, 0, nullptr, width, height
+        );
+    }
+
+    return false;
+}
+
+inline bool scaled_decode(
+    const unsigned char *data, size_t size, int min_width, int min_height,
+    std::vector<uint32_t> &pixels, int &width, int &height
+) {
+    // The image comes out at least as large as asked for, unless it is
+    // smaller to begin with.
+
+    scaled_info_type info;
+
+    if (scaled_detail::is_jpeg(data, size)) {
+        return scaled_detail::jpeg(
+            data, size, info, min_width, min_height, &pixels, width, height
+        );
+    }
+
+    if (scaled_detail::is_webp(data, size)) {
+        return scaled_detail::webp(
+            data, size, info, min_width, min_height, &pixels, width, height
+        );
+    }
+
+    return false;
+}
+
+#endif
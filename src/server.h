@@ -0,0 +1,533 @@
+// SPDX-License-Identifier: MIT
+#ifndef SERVER_H_16_10_2026
+#define SERVER_H_16_10_2026
+
+#include "mdma.h"
+#include "output.h"
+////////////////////////////////////////////////////////////////////////////////
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <thread>
+#include <array>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <functional>
+#include <chrono>
+#include <cstring>
+#include <cstdarg>
+#include <limits>
+
+class SERVER {
+    // Assembles the markdown documents posted to it over HTTP/1.0, either on
+    // a unix socket or on a TCP port of the loopback interface. Every worker
+    // thread keeps its own instance of MDMA, so the parsed framework and the
+    // open connections outlive the requests. The options in the query string
+    // of a request override the defaults of the server for that request.
+
+    public:
+    SERVER(
+        const std::string &address, size_t concurrency, size_t max_body,
+        const std::function<void(MDMA &)> &setup,
+        const std::function<void(const char *text)> &log_callback
+    ) : address(address)
+      , concurrency(std::max(concurrency, size_t{1}))
+      , max_body(
+            std::min(
+                max_body, size_t{std::numeric_limits<MD_SIZE>::max()}
+            )
+        )
+      , setup(setup)
+      , log_callback(log_callback)
+      , listener(-1)
+      , tcp(false) {}
+
+    SERVER() = delete;
+    SERVER(const SERVER &) = delete;
+    SERVER &operator=(const SERVER &) = delete;
+
+    ~SERVER() {
+        if (listener != -1) {
+            close(listener);
+        }
+    }
+
+    bool run(std::string_view framework);
+
+    private:
+    static constexpr size_t MAX_HEADER_SIZE = 16 * 1024;
+    static constexpr int TIMEOUT = 30; // in seconds
+
+    bool listen();
+    void serve(std::string_view framework);
+    int handle(
+        int fd, MDMA &, const MDMA::cfg_type &defaults,
+        std::string_view framework, std::string &request
+    );
+    bool configure(MDMA &, const std::string &target) const;
+    bool is_local_host(std::string_view host) const;
+    bool respond(int fd, int status, const char *reason, const char *text);
+
+    static bool send(int fd, const char *data, size_t len);
+
+    void log(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+
+    std::string address;
+    size_t concurrency;
+    size_t max_body; // in bytes
+    std::function<void(MDMA &)> setup;
+    std::function<void(const char *text)> log_callback;
+    int listener;
+    bool tcp;
+};
+
+inline bool SERVER::run(std::string_view framework) {
+    if (!listen()) {
+        return false;
+    }
+
+    // A client hanging up must not kill the server while the response is
+    // being written or spliced into its socket.
+    signal(SIGPIPE, SIG_IGN);
+
+    // libcurl must be initialized before any other threads are started.
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    // Every worker accepts its connections on its own, so there are never
+    // more requests handled at once than there are workers.
+    std::vector<std::thread> workers;
+
+    for (size_t i=0; i<concurrency; ++i) {
+        workers.emplace_back(&SERVER::serve, this, framework);
+    }
+
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    curl_global_cleanup();
+
+    return true;
+}
+
+inline bool SERVER::listen() {
+    bool is_port{
+        !address.empty() && address.size() <= 5 &&
+        address.find_first_not_of("0123456789") == std::string::npos
+    };
+
+    if (is_port) {
+        int port = atoi(address.c_str());
+
+        if (port < 1 || port > 65535) {
+            log("%s: %s", address.c_str(), "invalid port");
+            return false;
+        }
+
+        tcp = true;
+        listener = socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0);
+
+        if (listener == -1) {
+            log("socket: %s", strerror(errno));
+            return false;
+        }
+
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(uint16_t(port));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (bind(listener, (const sockaddr *) &addr, sizeof(addr)) == -1) {
+            log("%s: %s", address.c_str(), strerror(errno));
+            return false;
+        }
+    }
+    else {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+
+        if (address.empty() || address.size() >= sizeof(addr.sun_path)) {
+            log("%s: %s", address.c_str(), "invalid socket path");
+            return false;
+        }
+
+        address.copy(addr.sun_path, address.size());
+
+        listener = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+
+        if (listener == -1) {
+            log("socket: %s", strerror(errno));
+            return false;
+        }
+
+        struct stat st;
+
+        if (!stat(address.c_str(), &st) && S_ISSOCK(st.st_mode)) {
+            // A socket left behind by a previous instance would fail the bind,
+            // but one that still answers belongs to a running server.
+            int probe = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+
+            if (probe == -1) {
+                log("socket: %s", strerror(errno));
+                return false;
+            }
+
+            bool alive{
+                connect(probe, (const sockaddr *) &addr, sizeof(addr)) == 0
+            };
+            int error = errno;
+
+            close(probe);
+
+            if (alive || error != ECONNREFUSED) {
+                log(
+                    "%s: %s", address.c_str(),
+                    alive ? "already in use" : strerror(error)
+                );
+                return false;
+            }
+
+            unlink(address.c_str());
+        }
+
+        if (bind(listener, (const sockaddr *) &addr, sizeof(addr)) == -1) {
+            log("%s: %s", address.c_str(), strerror(errno));
+            return false;
+        }
+    }
+
+    if (::listen(listener, SOMAXCONN) == -1) {
+        log("listen: %s", strerror(errno));
+        return false;
+    }
+
+    log(
+        "Listening on %s with %lu worker%s.", address.c_str(), concurrency,
+        concurrency == 1 ? "" : "s"
+    );
+
+    return true;
+}
+
+inline void SERVER::serve(std::string_view framework) {
+    MDMA mdma;
+    setup(mdma);
+
+    // A process forked from one of many threads could be left with a lock
+    // that another thread held, such as the one of the log or of Imlib2, so
+    // the images are decoded by the worker itself under the lock of Imlib2.
+    mdma.cfg.jobs = 1;
+
+    const MDMA::cfg_type defaults = mdma.cfg;
+    std::string request;
+
+    while (true) {
+        int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+
+            log("accept: %s", strerror(errno));
+
+            if (errno == EBADF || errno == EINVAL) break;
+
+            // Running out of descriptors is temporary, so wait a moment.
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+
+        timeval timeout{ .tv_sec = TIMEOUT, .tv_usec = 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        auto start = std::chrono::steady_clock::now();
+        int status = handle(fd, mdma, defaults, framework, request);
+
+        close(fd);
+
+        if (!status) {
+            // The request or its response was cut short, which is already
+            // logged if it was not the client that went away.
+            continue;
+        }
+
+        using milliseconds = std::chrono::duration<double, std::milli>;
+
+        log(
+            "Request %.60s: %d in %.3f ms.",
+            request.substr(0, request.find('\r')).c_str(), status,
+            milliseconds(std::chrono::steady_clock::now() - start).count()
+        );
+    }
+}
+
+inline int SERVER::handle(
+    int fd, MDMA &mdma, const MDMA::cfg_type &defaults,
+    std::string_view framework, std::string &request
+) {
+    std::array<char, 16*1024> readbuf;
+    size_t header_end;
+
+    request.clear();
+
+    while ((header_end = request.find("\r\n\r\n")) == std::string::npos) {
+        if (request.size() > MAX_HEADER_SIZE) {
+            respond(fd, 431, "Request Header Fields Too Large", "");
+            return 431;
+        }
+
+        ssize_t nb = recv(fd, readbuf.data(), readbuf.size(), 0);
+
+        if (nb == -1 && errno == EINTR) continue;
+        if (nb <= 0) return 0;
+
+        request.append(readbuf.data(), size_t(nb));
+    }
+
+    std::string_view header{request.data(), header_end};
+    std::string_view line{header.substr(0, header.find("\r\n"))};
+    size_t method_end = line.find(' ');
+    size_t target_end = line.find(' ', method_end + 1);
+
+    if (method_end == line.npos || target_end == line.npos) {
+        respond(fd, 400, "Bad Request", "malformed request line");
+        return 400;
+    }
+
+    if (line.substr(0, method_end) != "POST") {
+        respond(fd, 405, "Method Not Allowed", "only POST is supported");
+        return 405;
+    }
+
+    std::string target{
+        line.substr(method_end + 1, target_end - method_end - 1)
+    };
+
+    size_t content_length = 0;
+    bool has_length = false;
+    std::string_view host;
+
+    for (size_t pos = header.find("\r\n"); pos != header.npos;) {
+        size_t next = header.find("\r\n", pos + 2);
+        std::string_view field{header.substr(pos + 2, next - pos - 2)};
+        size_t colon = field.find(':');
+
+        pos = next;
+
+        if (colon == field.npos) {
+            continue;
+        }
+
+        std::string_view name{field.substr(0, colon)};
+        std::string_view value{field.substr(colon + 1)};
+
+        while (!value.empty() && isspace((unsigned char) value.front())) {
+            value.remove_prefix(1);
+        }
+
+        while (!value.empty() && isspace((unsigned char) value.back())) {
+            value.remove_suffix(1);
+        }
+
+        if (name.size() == 4 && !strncasecmp(name.data(), "host", 4)) {
+            host = value;
+        }
+        else if (name.size() == 14
+        && !strncasecmp(name.data(), "content-length", 14)) {
+            has_length = !value.empty() && value.size() <= 10 && (
+                value.find_first_not_of("0123456789") == value.npos
+            );
+
+            content_length = has_length ? std::stoul(std::string(value)) : 0;
+        }
+    }
+
+    if (tcp && !host.empty() && !is_local_host(host)) {
+        // A web page could otherwise have its visitors post to the server
+        // under a name of its own that resolves to the loopback interface.
+        respond(fd, 421, "Misdirected Request", "unknown host");
+        return 421;
+    }
+
+    if (!has_length) {
+        respond(fd, 411, "Length Required", "missing content length");
+        return 411;
+    }
+
+    if (content_length > max_body) {
+        // The body is refused before any of it is read.
+        respond(fd, 413, "Content Too Large", "file size limit exceeded");
+        return 413;
+    }
+
+    size_t body_start = header_end + 4;
+
+    while (request.size() - body_start < content_length) {
+        ssize_t nb = recv(fd, readbuf.data(), readbuf.size(), 0);
+
+        if (nb == -1 && errno == EINTR) continue;
+        if (nb <= 0) return 0;
+
+        request.append(readbuf.data(), size_t(nb));
+    }
+
+    mdma.cfg = defaults;
+
+    if (!configure(mdma, target)) {
+        respond(fd, 400, "Bad Request", "invalid options");
+        return 400;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    if (!mdma.assemble(
+        framework.data(), framework.size(),
+        request.data() + body_start, content_length
+    )) {
+        respond(fd, 500, "Internal Server Error", "assembly failed");
+        return 500;
+    }
+
+    using milliseconds = std::chrono::duration<double, std::milli>;
+
+    std::string head{
+        std::format(
+            "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/html; charset=utf-8\r\n"
+            "Server-Timing: assemble;dur={:.3f}\r\n"
+            "Connection: close\r\n\r\n",
+            milliseconds(std::chrono::steady_clock::now() - start).count()
+        )
+    };
+
+    OUTPUT output;
+
+    output.attach(fd);
+
+    if (!output.write(head.data(), head.size())
+    ||  !mdma.write(
+            [&output](const char *data, size_t len) {
+                return output.write(data, len);
+            },
+            [&output](int from, size_t size) {
+                return output.splice(from, size);
+            }
+        )
+    ||  !output.commit()) {
+        // The status line is already sent, so the client can only tell the
+        // failure from the response ending early.
+        log(
+            "Request %.60s: %s", request.substr(0, line.size()).c_str(),
+            strerror(errno)
+        );
+
+        return 0;
+    }
+
+    return 200;
+}
+
+inline bool SERVER::configure(MDMA &mdma, const std::string &target) const {
+    std::string value;
+
+    if (!(value = MDMA::uri_param_value(target.c_str(), "preview")).empty()) {
+        int i = atoi(value.c_str());
+
+        if ((i == 0 && value != "0") || i < 0 || i > 255) {
+            return false;
+        }
+
+        mdma.cfg.preview = uint8_t(i);
+    }
+
+    if (!(value = MDMA::uri_param_value(target.c_str(), "dialect")).empty()) {
+        if (value != "github" && value != "commonmark") {
+            return false;
+        }
+
+        mdma.cfg.github = value == "github";
+    }
+
+    if (!(value = MDMA::uri_param_value(target.c_str(), "monolith")).empty()) {
+        if (value != "0" && value != "1") {
+            return false;
+        }
+
+        mdma.cfg.monolith = value == "1";
+    }
+
+    if (!(value = MDMA::uri_param_value(target.c_str(), "minify")).empty()) {
+        if (value != "0" && value != "1") {
+            return false;
+        }
+
+        mdma.cfg.minify = value == "1";
+    }
+
+    return true;
+}
+
+inline bool SERVER::is_local_host(std::string_view host) const {
+    // The port is optional, but it must be the one listened on.
+
+    for (std::string_view name : { "localhost", "127.0.0.1" }) {
+        if (host.size() < name.size()
+        ||  strncasecmp(host.data(), name.data(), name.size())) {
+            continue;
+        }
+
+        std::string_view port{host.substr(name.size())};
+
+        if (port.empty() || (port[0] == ':' && port.substr(1) == address)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+inline bool SERVER::respond(
+    int fd, int status, const char *reason, const char *text
+) {
+    std::string response{
+        std::format(
+            "HTTP/1.0 {} {}\r\n"
+            "Content-Type: text/plain; charset=utf-8\r\n"
+            "Content-Length: {}\r\n"
+            "Connection: close\r\n\r\n{}\n",
+            status, reason, strlen(text) + 1, text
+        )
+    };
+
+    return send(fd, response.data(), response.size());
+}
+
+inline bool SERVER::send(int fd, const char *data, size_t len) {
+    while (len) {
+        ssize_t nb = ::send(fd, data, len, MSG_NOSIGNAL);
+
+        if (nb == -1 && errno == EINTR) continue;
+        if (nb <= 0) return false;
+
+        data += nb;
+        len -= size_t(nb);
+    }
+
+    return true;
+}
+
+inline void SERVER::log(const char *fmt, ...) const {
+    va_list args;
+    va_start(args, fmt);
+    MDMA::vlog(log_callback, fmt, args);
+    va_end(args);
+}
+
+#endif
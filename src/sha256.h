@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: MIT
+#ifndef SHA256_H_16_10_2026
+#define SHA256_H_16_10_2026
+
+#include <array>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+
+class SHA256 {
+    public:
+    SHA256() : state(initial_state), block{}, block_size(0), length(0) {}
+
+    SHA256 &update(const void *data, size_t len) {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+
+        length += len;
+
+        while (len > 0) {
+            size_t n = std::min(block.size() - block_size, len);
+
+            memcpy(block.data() + block_size, bytes, n);
+            block_size += n;
+            bytes += n;
+            len -= n;
+
+            if (block_size == block.size()) {
+                transform();
+                block_size = 0;
+            }
+        }
+
+        return *this;
+    }
+
+    SHA256 &update(std::string_view str) {
+        return update(str.data(), str.size());
+    }
+
+    std::array<unsigned char, 32> digest() {
+        uint64_t bits = length * 8;
+
+        block[block_size++] = 0x80;
+
+        if (block_size > block.size() - sizeof(bits)) {
+            std::fill(block.begin() + long(block_size), block.end(), 0);
+            transform();
+            block_size = 0;
+        }
+
+        std::fill(
+            block.begin() + long(block_size),
+            block.end() - long(sizeof(bits)), 0
+        );
+
+        for (size_t i=0; i<sizeof(bits); ++i) {
+            block[block.size() - 1 - i] = (unsigned char) (bits >> (8 * i));
+        }
+
+        transform();
+
+        std::array<unsigned char, 32> result;
+
+        for (size_t i=0; i<state.size(); ++i) {
+            for (size_t j=0; j<4; ++j) {
+                result[4*i + j] = (unsigned char) (state[i] >> (24 - 8 * j));
+            }
+        }
+
+        state = initial_state;
+        block_size = 0;
+        length = 0;
+
+        return result;
+    }
+
+    std::string hexdigest() {
+        static constexpr const char *hex = "0123456789abcdef";
+        std::string result;
+
+        for (unsigned char c : digest()) {
+            result.append(1, hex[c >> 4]).append(1, hex[c & 0xf]);
+        }
+
+        return result;
+    }
+
+    private:
+    static constexpr const std::array<uint32_t, 8> initial_state{
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    static constexpr const std::array<uint32_t, 64> k{
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+        0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+        0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+        0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+        0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+        0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+        0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+        0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+        0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+
+    static constexpr uint32_t rotr(uint32_t x, int n) {
+        return (x >> n) | (x << (32 - n));
+    }
+
+    void transform() {
+        std::array<uint32_t, 64> w;
+
+        for (size_t i=0; i<16; ++i) {
+            w[i] = (
+                uint32_t(block[4*i    ]) << 24 | uint32_t(block[4*i + 1]) << 16 |
+                uint32_t(block[4*i + 2]) <<  8 | uint32_t(block[4*i + 3])
+            );
+        }
+
+        for (size_t i=16; i<64; ++i) {
+            uint32_t s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+            uint32_t s1 = rotr(w[i-2], 17) ^ rotr(w[i-2],  19) ^ (w[i-2] >> 10);
+
+            w[i] = w[i-16] + s0 + w[i-7] + s1;
+        }
+
+        std::array<uint32_t, 8> v{state};
+
+        for (size_t i=0; i<64; ++i) {
+            uint32_t s1 = rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25);
+            uint32_t ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+            uint32_t t1 = v[7] + s1 + ch + k[i] + w[i];
+            uint32_t s0 = rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22);
+            uint32_t mj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+            uint32_t t2 = s0 + mj;
+
+            v[7] = v[6];
+            v[6] = v[5];
+            v[5] = v[4];
+            v[4] = v[3] + t1;
+            v[3] = v[2];
+            v[2] = v[1];
+            v[1] = v[0];
+            v[0] = t1 + t2;
+        }
+
+        for (size_t i=0; i<state.size(); ++i) {
+            state[i] += v[i];
+        }
+    }
+
+    std::array<uint32_t, 8> state;
+    std::array<unsigned char, 64> block;
+    size_t block_size;
+    uint64_t length;
+};
+
+#endif
@@ -27,129 +27,207 @@ SOFTWARE.
 #define SLUGIFY_H_06_06_2023
 
 #include <string>
-#include <unordered_map>
-#include <regex>
+#include <string_view>
+#include <array>
 #include <algorithm>
 
-std::string slugify(std::string input) {
-    std::unordered_map<std::string, std::string> charMap {
+namespace slugify_detail {
+    struct transliteration_type {
+        char32_t code;
+        std::string_view text;
+    };
+
+    inline constexpr transliteration_type transliteration_list[]{
         // latin
-        {"À", "A"}, {"Á", "A"}, {"Â", "A"}, {"Ã", "A"}, {"Ä", "A"}, {"Å", "A"},
-        {"Æ", "AE"}, {"Ç", "C"}, {"È", "E"}, {"É", "E"}, {"Ê", "E"}, {"Ë", "E"},
-        {"Ì", "I"}, {"Í", "I"}, {"Î", "I"}, {"Ï", "I"}, {"Ð", "D"}, {"Ñ", "N"},
-        {"Ò", "O"}, {"Ó", "O"}, {"Ô", "O"}, {"Õ", "O"}, {"Ö", "O"}, {"Ő", "O"},
-        {"Ø", "O"}, {"Ù", "U"}, {"Ú", "U"}, {"Û", "U"}, {"Ü", "U"}, {"Ű", "U"},
-        {"Ý", "Y"}, {"Þ", "TH"}, {"ß", "ss"}, {"à", "a"}, {"á", "a"},
-        {"â", "a"}, {"ã", "a"}, {"ä", "a"}, {"å", "a"}, {"æ", "ae"}, {"ç", "c"},
-        {"è", "e"}, {"é", "e"}, {"ê", "e"}, {"ë", "e"}, {"ì", "i"}, {"í", "i"},
-        {"î", "i"}, {"ï", "i"}, {"ð", "d"}, {"ñ", "n"}, {"ò", "o"}, {"ó", "o"},
-        {"ô", "o"}, {"õ", "o"}, {"ö", "o"}, {"ő", "o"}, {"ø", "o"}, {"ù", "u"},
-        {"ú", "u"}, {"û", "u"}, {"ü", "u"}, {"ű", "u"}, {"ý", "y"}, {"þ", "th"},
-        {"ÿ", "y"}, {"ẞ", "SS"},
+        {U'À', "A"}, {U'Á', "A"}, {U'Â', "A"}, {U'Ã', "A"}, {U'Ä', "A"},
+        {U'Å', "A"}, {U'Æ', "AE"}, {U'Ç', "C"}, {U'È', "E"}, {U'É', "E"},
+        {U'Ê', "E"}, {U'Ë', "E"}, {U'Ì', "I"}, {U'Í', "I"}, {U'Î', "I"},
+        {U'Ï', "I"}, {U'Ð', "D"}, {U'Ñ', "N"}, {U'Ò', "O"}, {U'Ó', "O"},
+        {U'Ô', "O"}, {U'Õ', "O"}, {U'Ö', "O"}, {U'Ő', "O"}, {U'Ø', "O"},
+        {U'Ù', "U"}, {U'Ú', "U"}, {U'Û', "U"}, {U'Ü', "U"}, {U'Ű', "U"},
+        {U'Ý', "Y"}, {U'Þ', "TH"}, {U'ß', "ss"}, {U'à', "a"}, {U'á', "a"},
+        {U'â', "a"}, {U'ã', "a"}, {U'ä', "a"}, {U'å', "a"}, {U'æ', "ae"},
+        {U'ç', "c"}, {U'è', "e"}, {U'é', "e"}, {U'ê', "e"}, {U'ë', "e"},
+        {U'ì', "i"}, {U'í', "i"}, {U'î', "i"}, {U'ï', "i"}, {U'ð', "d"},
+        {U'ñ', "n"}, {U'ò', "o"}, {U'ó', "o"}, {U'ô', "o"}, {U'õ', "o"},
+        {U'ö', "o"}, {U'ő', "o"}, {U'ø', "o"}, {U'ù', "u"}, {U'ú', "u"},
+        {U'û', "u"}, {U'ü', "u"}, {U'ű', "u"}, {U'ý', "y"}, {U'þ', "th"},
+        {U'ÿ', "y"}, {U'ẞ', "SS"},
         // greek
-        {"α", "a"}, {"β", "b"}, {"γ", "g"}, {"δ", "d"}, {"ε", "e"}, {"ζ", "z"},
-        {"η", "h"}, {"θ", "8"}, {"ι", "i"}, {"κ", "k"}, {"λ", "l"}, {"μ", "m"},
-        {"ν", "n"}, {"ξ", "3"}, {"ο", "o"}, {"π", "p"}, {"ρ", "r"}, {"σ", "s"},
-        {"τ", "t"}, {"υ", "y"}, {"φ", "f"}, {"χ", "x"}, {"ψ", "ps"}, {"ω", "w"},
-        {"ά", "a"}, {"έ", "e"}, {"ί", "i"}, {"ό", "o"}, {"ύ", "y"}, {"ή", "h"},
-        {"ώ", "w"}, {"ς", "s"}, {"ϊ", "i"}, {"ΰ", "y"}, {"ϋ", "y"}, {"ΐ", "i"},
-        {"Α", "A"}, {"Β", "B"}, {"Γ", "G"}, {"Δ", "D"}, {"Ε", "E"}, {"Ζ", "Z"},
-        {"Η", "H"}, {"Θ", "8"}, {"Ι", "I"}, {"Κ", "K"}, {"Λ", "L"}, {"Μ", "M"},
-        {"Ν", "N"}, {"Ξ", "3"}, {"Ο", "O"}, {"Π", "P"}, {"Ρ", "R"}, {"Σ", "S"},
-        {"Τ", "T"}, {"Υ", "Y"}, {"Φ", "F"}, {"Χ", "X"}, {"Ψ", "PS"}, {"Ω", "W"},
-        {"Ά", "A"}, {"Έ", "E"}, {"Ί", "I"}, {"Ό", "O"}, {"Ύ", "Y"}, {"Ή", "H"},
-        {"Ώ", "W"}, {"Ϊ", "I"}, {"Ϋ", "Y"},
+        {U'α', "a"}, {U'β', "b"}, {U'γ', "g"}, {U'δ', "d"}, {U'ε', "e"},
+        {U'ζ', "z"}, {U'η', "h"}, {U'θ', "8"}, {U'ι', "i"}, {U'κ', "k"},
+        {U'λ', "l"}, {U'μ', "m"}, {U'ν', "n"}, {U'ξ', "3"}, {U'ο', "o"},
+        {U'π', "p"}, {U'ρ', "r"}, {U'σ', "s"}, {U'τ', "t"}, {U'υ', "y"},
+        {U'φ', "f"}, {U'χ', "x"}, {U'ψ', "ps"}, {U'ω', "w"}, {U'ά', "a"},
+        {U'έ', "e"}, {U'ί', "i"}, {U'ό', "o"}, {U'ύ', "y"}, {U'ή', "h"},
+        {U'ώ', "w"}, {U'ς', "s"}, {U'ϊ', "i"}, {U'ΰ', "y"}, {U'ϋ', "y"},
+        {U'ΐ', "i"}, {U'Α', "A"}, {U'Β', "B"}, {U'Γ', "G"}, {U'Δ', "D"},
+        {U'Ε', "E"}, {U'Ζ', "Z"}, {U'Η', "H"}, {U'Θ', "8"}, {U'Ι', "I"},
+        {U'Κ', "K"}, {U'Λ', "L"}, {U'Μ', "M"}, {U'Ν', "N"}, {U'Ξ', "3"},
+        {U'Ο', "O"}, {U'Π', "P"}, {U'Ρ', "R"}, {U'Σ', "S"}, {U'Τ', "T"},
+        {U'Υ', "Y"}, {U'Φ', "F"}, {U'Χ', "X"}, {U'Ψ', "PS"}, {U'Ω', "W"},
+        {U'Ά', "A"}, {U'Έ', "E"}, {U'Ί', "I"}, {U'Ό', "O"}, {U'Ύ', "Y"},
+        {U'Ή', "H"}, {U'Ώ', "W"}, {U'Ϊ', "I"}, {U'Ϋ', "Y"},
         // turkish
-        {"ş", "s"}, {"Ş", "S"}, {"ı", "i"}, {"İ", "I"}, {"ç", "c"}, {"Ç", "C"},
-        {"ü", "u"}, {"Ü", "U"}, {"ö", "o"}, {"Ö", "O"}, {"ğ", "g"}, {"Ğ", "G"},
+        {U'ş', "s"}, {U'Ş', "S"}, {U'ı', "i"}, {U'İ', "I"}, {U'ğ', "g"},
+        {U'Ğ', "G"},
         // russian
-        {"а", "a"}, {"б", "b"}, {"в", "v"}, {"г", "g"}, {"д", "d"}, {"е", "e"},
-        {"ё", "yo"}, {"ж", "zh"}, {"з", "z"}, {"и", "i"}, {"й", "j"},
-        {"к", "k"}, {"л", "l"}, {"м", "m"}, {"н", "n"}, {"о", "o"}, {"п", "p"},
-        {"р", "r"}, {"с", "s"}, {"т", "t"}, {"у", "u"}, {"ф", "f"}, {"х", "h"},
-        {"ц", "c"}, {"ч", "ch"}, {"ш", "sh"}, {"щ", "sh"}, {"ъ", "u"},
-        {"ы", "y"}, {"ь", ""}, {"э", "e"}, {"ю", "yu"}, {"я", "ya"}, {"А", "A"},
-        {"Б", "B"}, {"В", "V"}, {"Г", "G"}, {"Д", "D"}, {"Е", "E"}, {"Ё", "Yo"},
-        {"Ж", "Zh"}, {"З", "Z"}, {"И", "I"}, {"Й", "J"}, {"К", "K"}, {"Л", "L"},
-        {"М", "M"}, {"Н", "N"}, {"О", "O"}, {"П", "P"}, {"Р", "R"}, {"С", "S"},
-        {"Т", "T"}, {"У", "U"}, {"Ф", "F"}, {"Х", "H"}, {"Ц", "C"}, {"Ч", "Ch"},
-        {"Ш", "Sh"}, {"Щ", "Sh"}, {"Ъ", "U"}, {"Ы", "Y"}, {"Ь", ""}, {"Э", "E"},
-        {"Ю", "Yu"}, {"Я", "Ya"},
+        {U'а', "a"}, {U'б', "b"}, {U'в', "v"}, {U'г', "g"}, {U'д', "d"},
+        {U'е', "e"}, {U'ё', "yo"}, {U'ж', "zh"}, {U'з', "z"}, {U'и', "i"},
+        {U'й', "j"}, {U'к', "k"}, {U'л', "l"}, {U'м', "m"}, {U'н', "n"},
+        {U'о', "o"}, {U'п', "p"}, {U'р', "r"}, {U'с', "s"}, {U'т', "t"},
+        {U'у', "u"}, {U'ф', "f"}, {U'х', "h"}, {U'ц', "c"}, {U'ч', "ch"},
+        {U'ш', "sh"}, {U'щ', "sh"}, {U'ъ', "u"}, {U'ы', "y"}, {U'ь', ""},
+        {U'э', "e"}, {U'ю', "yu"}, {U'я', "ya"}, {U'А', "A"}, {U'Б', "B"},
+        {U'В', "V"}, {U'Г', "G"}, {U'Д', "D"}, {U'Е', "E"}, {U'Ё', "Yo"},
+        {U'Ж', "Zh"}, {U'З', "Z"}, {U'И', "I"}, {U'Й', "J"}, {U'К', "K"},
+        {U'Л', "L"}, {U'М', "M"}, {U'Н', "N"}, {U'О', "O"}, {U'П', "P"},
+        {U'Р', "R"}, {U'С', "S"}, {U'Т', "T"}, {U'У', "U"}, {U'Ф', "F"},
+        {U'Х', "H"}, {U'Ц', "C"}, {U'Ч', "Ch"}, {U'Ш', "Sh"}, {U'Щ', "Sh"},
+        {U'Ъ', "U"}, {U'Ы', "Y"}, {U'Ь', ""}, {U'Э', "E"}, {U'Ю', "Yu"},
+        {U'Я', "Ya"},
         // ukranian
-        {"Є", "Ye"}, {"І", "I"}, {"Ї", "Yi"}, {"Ґ", "G"}, {"є", "ye"},
-        {"і", "i"}, {"ї", "yi"}, {"ґ", "g"},
+        {U'Є', "Ye"}, {U'І', "I"}, {U'Ї', "Yi"}, {U'Ґ', "G"}, {U'є', "ye"},
+        {U'і', "i"}, {U'ї', "yi"}, {U'ґ', "g"},
         // czech
-        {"č", "c"}, {"ď", "d"}, {"ě", "e"}, {"ň", "n"}, {"ř", "r"}, {"š", "s"},
-        {"ť", "t"}, {"ů", "u"}, {"ž", "z"}, {"Č", "C"}, {"Ď", "D"}, {"Ě", "E"},
-        {"Ň", "N"}, {"Ř", "R"}, {"Š", "S"}, {"Ť", "T"}, {"Ů", "U"}, {"Ž", "Z"},
+        {U'č', "c"}, {U'ď', "d"}, {U'ě', "e"}, {U'ň', "n"}, {U'ř', "r"},
+        {U'š', "s"}, {U'ť', "t"}, {U'ů', "u"}, {U'ž', "z"}, {U'Č', "C"},
+        {U'Ď', "D"}, {U'Ě', "E"}, {U'Ň', "N"}, {U'Ř', "R"}, {U'Š', "S"},
+        {U'Ť', "T"}, {U'Ů', "U"}, {U'Ž', "Z"},
         // polish
-        {"ą", "a"}, {"ć", "c"}, {"ę", "e"}, {"ł", "l"}, {"ń", "n"}, {"ó", "o"},
-        {"ś", "s"}, {"ź", "z"}, {"ż", "z"}, {"Ą", "A"}, {"Ć", "C"}, {"Ę", "e"},
-        {"Ł", "L"}, {"Ń", "N"}, {"Ś", "S"}, {"Ź", "Z"}, {"Ż", "Z"},
+        {U'ą', "a"}, {U'ć', "c"}, {U'ę', "e"}, {U'ł', "l"}, {U'ń', "n"},
+        {U'ś', "s"}, {U'ź', "z"}, {U'ż', "z"}, {U'Ą', "A"}, {U'Ć', "C"},
+        {U'Ę', "e"}, {U'Ł', "L"}, {U'Ń', "N"}, {U'Ś', "S"}, {U'Ź', "Z"},
+        {U'Ż', "Z"},
         // latvian
-        {"ā", "a"}, {"č", "c"}, {"ē", "e"}, {"ģ", "g"}, {"ī", "i"}, {"ķ", "k"},
-        {"ļ", "l"}, {"ņ", "n"}, {"š", "s"}, {"ū", "u"}, {"ž", "z"}, {"Ā", "A"},
-        {"Č", "C"}, {"Ē", "E"}, {"Ģ", "G"}, {"Ī", "i"}, {"Ķ", "k"}, {"Ļ", "L"},
-        {"Ņ", "N"}, {"Š", "S"}, {"Ū", "u"}, {"Ž", "Z"},
+        {U'ā', "a"}, {U'ē', "e"}, {U'ģ', "g"}, {U'ī', "i"}, {U'ķ', "k"},
+        {U'ļ', "l"}, {U'ņ', "n"}, {U'ū', "u"}, {U'Ā', "A"}, {U'Ē', "E"},
+        {U'Ģ', "G"}, {U'Ī', "i"}, {U'Ķ', "k"}, {U'Ļ', "L"}, {U'Ņ', "N"},
+        {U'Ū', "u"},
         // currency
-        {"€", "euro"}, {"₢", "cruzeiro"}, {"₣", "french franc"}, {"£", "pound"},
-        {"₤", "lira"}, {"₥", "mill"}, {"₦", "naira"}, {"₧", "peseta"},
-        {"₨", "rupee"}, {"₩", "won"}, {"₪", "new shequel"}, {"₫", "dong"},
-        {"₭", "kip"}, {"₮", "tugrik"}, {"₯", "drachma"}, {"₰", "penny"},
-        {"₱", "peso"}, {"₲", "guarani"}, {"₳", "austral"}, {"₴", "hryvnia"},
-        {"₵", "cedi"}, {"¢", "cent"}, {"¥", "yen"}, {"元", "yuan"},
-        {"円", "yen"}, {"﷼", "rial"}, {"₠", "ecu"}, {"¤", "currency"},
-        {"฿", "baht"}, {"$", "dollar"},
+        {U'€', "euro"}, {U'₢', "cruzeiro"}, {U'₣', "french franc"},
+        {U'£', "pound"}, {U'₤', "lira"}, {U'₥', "mill"}, {U'₦', "naira"},
+        {U'₧', "peseta"}, {U'₨', "rupee"}, {U'₩', "won"}, {U'₪', "new shequel"},
+        {U'₫', "dong"}, {U'₭', "kip"}, {U'₮', "tugrik"}, {U'₯', "drachma"},
+        {U'₰', "penny"}, {U'₱', "peso"}, {U'₲', "guarani"}, {U'₳', "austral"},
+        {U'₴', "hryvnia"}, {U'₵', "cedi"}, {U'¢', "cent"}, {U'¥', "yen"},
+        {U'元', "yuan"}, {U'円', "yen"}, {U'﷼', "rial"}, {U'₠', "ecu"},
+        {U'¤', "currency"}, {U'฿', "baht"}, {U'$', "dollar"},
         // symbols
-        {"©", "(c)"}, {"œ", "oe"}, {"Œ", "OE"}, {"∑", "sum"}, {"®", "(r)"},
-        {"†", "+"}, {"“", "\""}, {"∂", "d"}, {"ƒ", "f"}, {"™", "tm"},
-        {"℠", "sm"}, {"…", "..."}, {"˚", "o"}, {"º", "o"}, {"ª", "a"},
-        {"•", "*"}, {"∆", "delta"}, {"∞", "infinity"}, {"♥", "love"},
-        {"&", "and"}, {"|", "or"}, {"<", "less"}, {">", "greater"}
+        {U'©', "(c)"}, {U'œ', "oe"}, {U'Œ', "OE"}, {U'∑', "sum"}, {U'®', "(r)"},
+        {U'†', "+"}, {U'“', "\""}, {U'∂', "d"}, {U'ƒ', "f"}, {U'™', "tm"},
+        {U'℠', "sm"}, {U'…', "..."}, {U'˚', "o"}, {U'º', "o"}, {U'ª', "a"},
+        {U'•', "*"}, {U'∆', "delta"}, {U'∞', "infinity"}, {U'♥', "love"},
+        {U'&', "and"}, {U'|', "or"}, {U'<', "less"}, {U'>', "greater"}
+    };
+
+    inline constexpr auto transliterations{
+        []() {
+            auto table{std::to_array(transliteration_list)};
+
+            std::sort(
+                table.begin(), table.end(),
+                [](
+                    const transliteration_type &a,
+                    const transliteration_type &b
+                ) {
+                    return a.code < b.code;
+                }
+            );
+
+            return table;
+        }()
     };
 
-    // loop every character in charMap
-    for(auto kv : charMap)
-    {
-	    // check if key is in string
-	    if(input.find(kv.first) != std::string::npos)
-	    {
-		    // replace key with value
-		    input.replace(input.find(kv.first), kv.first.length(), kv.second);
-	    }
+    constexpr std::string_view transliterate(char32_t code) {
+        auto it = std::lower_bound(
+            transliterations.begin(), transliterations.end(), code,
+            [](const transliteration_type &t, char32_t c) { return t.code < c; }
+        );
+
+        return it != transliterations.end() && it->code == code ? it->text : "";
     }
 
-    input = std::regex_replace(
-        input, std::regex("[\\s]+"), "-"
-    );
+    constexpr size_t decode_utf8(std::string_view str, char32_t &code) {
+        // Returns the length of the sequence, or 0 if it is malformed.
+        unsigned char lead = (unsigned char) str[0];
+        size_t len = (
+            lead < 0x80 ? 1 : lead < 0xC2 ? 0 : lead < 0xE0 ? 2 :
+            lead < 0xF0 ? 3 : lead < 0xF5 ? 4 : 0
+        );
 
-    input = std::regex_replace(
-        input, std::regex("[^A-Za-z0-9_-]+"), ""
-    );
+        if (!len || len > str.size()) {
+            return 0;
+        }
 
-    input = std::regex_replace(
-        input, std::regex("^[^A-Za-z]+"), ""
-    );
+        code = len == 1 ? lead : lead & (0x7F >> len);
 
-    input = std::regex_replace(
-        input, std::regex("[-]+"), "-"
-    );
+        for (size_t i=1; i<len; ++i) {
+            unsigned char c = (unsigned char) str[i];
 
-    /*
-    std::regex e1("[^\\w\\s$*_+~.()\'\"-]");
-    input = std::regex_replace(input, e1, "");
+            if ((c & 0xC0) != 0x80) {
+                return 0;
+            }
 
-    std::regex e2("^\\s+|\\s+$");
-    input = std::regex_replace(input, e2, "");
+            code = (code << 6) | (c & 0x3F);
+        }
 
-    std::regex e3("[-\\s]+");
-    input = std::regex_replace(input, e3, "-");
+        return len;
+    }
+}
+
+inline std::string slugify(std::string_view input) {
+    // Transliterates the input and then keeps only [A-Za-z0-9_-], turning the
+    // white space into dashes, stripping everything before the first letter
+    // and collapsing the runs of dashes, all in a single pass.
+
+    std::string result;
+    result.reserve(input.size());
+
+    auto put{
+        [&result](char c) {
+            bool alpha = (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+            bool digit = c >= '0' && c <= '9';
+
+            if (c == ' ' || (c >= '\t' && c <= '\r')) {
+                c = '-';
+            }
+            else if (!alpha && !digit && c != '_' && c != '-') {
+                return;
+            }
+
+            if (result.empty() ? !alpha : (c == '-' && result.back() == '-')) {
+                return;
+            }
+
+            result.append(1, c);
+        }
+    };
 
-    std::regex e4("#-$");
-    input = std::regex_replace(input, e4, "");
-    */
+    for (size_t i=0; i<input.size();) {
+        char32_t code = 0;
+        size_t len = slugify_detail::decode_utf8(input.substr(i), code);
+
+        if (!len) {
+            ++i;
+            continue;
+        }
+
+        i += len;
+
+        std::string_view text{slugify_detail::transliterate(code)};
+
+        if (text.empty() && code < 0x80) {
+            put(char(code));
+            continue;
+        }
+
+        for (char c : text) {
+            put(c);
+        }
+    }
 
-    return input;
-};
+    return result;
+}
 
 #endif
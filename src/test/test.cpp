@@ -0,0 +1,919 @@
+// SPDX-License-Identifier: MIT
+#include "../mdma.h"
+#include "../input.h"
+#include "../output.h"
+#include "../server.h"
+#include "../bench/corpus.h"
+////////////////////////////////////////////////////////////////////////////////
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <md4c-html.h>
+#include <iostream>
+#include <fstream>
+#include <thread>
+
+// Assembles a fixture document and checks the parts of the program around
+// the assembly: reading the input, writing the output in place or under a
+// temporary name, confining the local files to a directory, invalidating the
+// cached sections and refusing malformed requests in server mode. The other
+// markdown documents given are assembled and compared with the output of
+// md_html. Every failed check is printed and makes the program exit with a
+// failure.
+
+static constexpr auto default_framework{
+    std::to_array<unsigned char>({ MDMA_FRAMEWORK })
+};
+
+static constexpr auto default_template{
+    std::to_array<unsigned char>({ MDMA_TEMPLATE })
+};
+
+static size_t failures = 0;
+
+void log_text(const char *text) {
+    std::cerr << text << "\n";
+}
+
+void check(bool success, const char *what, int line = __builtin_LINE()) {
+    if (!success) {
+        std::cerr << "test.cpp:" << line << ": " << what << "\n";
+        ++failures;
+    }
+}
+
+std::string read_file(const std::filesystem::path &path) {
+    std::ifstream input(path, std::ios::binary);
+
+    return std::string(std::istreambuf_iterator<char>(input), {});
+}
+
+bool assemble(MDMA &mdma, std::string_view md, std::string &html) {
+    // The built-in framework is loaded the way the program loads it.
+    html.clear();
+
+    return mdma.set_compiled_framework(
+        (const char *) default_template.data(), default_template.size()
+    ) && mdma.assemble(
+        (const char *) default_framework.data(), default_framework.size(),
+        md.data(), md.size()
+    ) && mdma.write(
+        [&html](const char *data, size_t len) {
+            html.append(data, len);
+            return true;
+        }
+    );
+}
+
+void test_fixture(const std::string &path) {
+    // The output is minified and the fixture has no raw HTML, so the document
+    // is not laid out by tidy and the fragments are the ones dumped.
+
+    static constexpr const char *fragments[]{
+        "<article class=\"tab\"><h1><a href=\"#Fixture\" id=\"Fixture\" "
+        "target=\"_self\">Fixture",
+        "<p>Copyright © 2026 &amp; <em>so</em> <strong>on</strong>, see "
+        "<a href=\"https://example.com\" target=\"_blank\" title=\"Home\">"
+        "home</a>",
+        "<a href=\"#Fixture\" target=\"_self\">back</a>",
+        "<h2><a href=\"#Lists\" id=\"Lists\" target=\"_self\">Lists",
+        "<ol start=\"3\">\n<li>three</li>",
+        "<li>nested</li>",
+        "class=\"task-list-item-checkbox\" disabled checked>",
+        "<h3><a href=\"#Tables\" id=\"Tables\" target=\"_self\">Tables",
+        "<th style=\"text-align: center;\">Center</th>",
+        "<td style=\"text-align: right;\">c</td>",
+        "<h4><a href=\"#Code\" id=\"Code\" target=\"_self\">Code",
+        "<pre><code class=\"language-cpp\">bool a = 1 &lt; 2;\n</code></pre>",
+        "<article class=\"tab\"><h1><a href=\"#Second\" id=\"Second\" "
+        "target=\"_self\">Second",
+        "<blockquote>\n<p>quoted</p>\n</blockquote>",
+        "<a href=\"#Tables\" target=\"_self\">Tables</a>"
+    };
+
+    INPUT md;
+    MDMA mdma;
+    std::string html;
+
+    mdma.cfg.github = true;
+    mdma.cfg.minify = true;
+    mdma.set_logger(log_text);
+
+    check(md.load(path), "the fixture is loaded");
+    check(assemble(mdma, md, html), "the fixture is assembled");
+
+    for (const char *fragment : fragments) {
+        check(html.find(fragment) != html.npos, fragment);
+    }
+
+    check(
+        html.find("before the first heading") == html.npos,
+        "the text before the first heading is left out"
+    );
+}
+
+void test_input(const std::filesystem::path &directory) {
+    // The regular files are mapped unless told otherwise, and the rest are
+    // read until their end, whatever size they report.
+
+    const std::string path{(directory / "input.md").string()};
+    const std::string text{"# Input\n"};
+    const std::string piped(200 * 1024, '#');
+    INPUT input;
+    int fds[2];
+
+    std::ofstream(path, std::ios::binary) << text;
+    std::ofstream((directory / "empty.md").string(), std::ios::binary);
+
+    check(
+        input.load(path) && std::string_view(input) == text,
+        "a regular file is mapped"
+    );
+    check(
+        input.load(path, false) && std::string_view(input) == text,
+        "a regular file is read"
+    );
+    check(
+        input.load((directory / "empty.md").string()) && !input.size(),
+        "an empty file is read"
+    );
+    check(
+        input.load("/proc/self/stat") && input.size(),
+        "a file that reports no size is read"
+    );
+    check(
+        !input.load((directory / "missing.md").string()) && errno == ENOENT,
+        "a missing file fails with ENOENT"
+    );
+
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        check(false, "a pipe is created");
+        return;
+    }
+
+    // The pipe holds less than is written, so a thread keeps writing while
+    // the input is read.
+    std::thread writer(
+        [&piped, fd = fds[1]]() {
+            OUTPUT output;
+
+            output.attach(fd);
+            output.write(piped.data(), piped.size());
+            output.commit();
+            close(fd);
+        }
+    );
+
+    check(
+        input.load(std::format("/proc/self/fd/{}", fds[0]))
+        && std::string_view(input) == piped,
+        "a pipe is read until its end"
+    );
+
+    writer.join();
+    close(fds[0]);
+}
+
+void test_output(const std::filesystem::path &directory) {
+    // A regular file is replaced once the output is committed, keeping its
+    // mode and the links to it, while the rest is written in place.
+
+    const std::filesystem::path file{directory / "output.html"};
+    const std::filesystem::path link{directory / "link.html"};
+    const std::filesystem::path dangling{directory / "dangling.html"};
+    std::error_code ec;
+    struct stat st;
+    int fds[2];
+
+    std::ofstream(file, std::ios::binary) << "old";
+    chmod(file.c_str(), 0640);
+
+    {
+        OUTPUT output;
+
+        check(output.open(file.string()), "a regular file is opened");
+        check(output.write("new", 3), "a regular file is written");
+        check(read_file(file) == "old", "the old file is kept until commit");
+        check(output.commit(), "a regular file is committed");
+    }
+
+    check(read_file(file) == "new", "the new file replaces the old one");
+    check(
+        stat(file.c_str(), &st) == 0 && (st.st_mode & 07777) == 0640,
+        "the mode of the old file is kept"
+    );
+
+    {
+        OUTPUT output;
+
+        check(
+            output.open(file.string()) && output.write("lost", 4),
+            "a regular file is written again"
+        );
+    }
+
+    check(read_file(file) == "new", "an uncommitted output is discarded");
+
+    std::filesystem::create_symlink("output.html", link, ec);
+    std::filesystem::create_symlink("created.html", dangling, ec);
+
+    for (const std::filesystem::path &path : { link, dangling }) {
+        OUTPUT output;
+
+        check(
+            output.open(path.string()) && output.write("linked", 6)
+            && output.commit(), "a symbolic link is written"
+        );
+        check(
+            std::filesystem::is_symlink(path, ec)
+            && read_file(path) == "linked",
+            "a symbolic link is kept and its target written"
+        );
+    }
+
+    for (const auto &entry : std::filesystem::directory_iterator(
+        directory, ec
+    )) {
+        check(
+            entry.path().extension() != ".tmp", "no temporary file is left"
+        );
+    }
+
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        check(false, "a pipe is created");
+        return;
+    }
+
+    {
+        OUTPUT output;
+
+        check(
+            output.open(std::format("/proc/self/fd/{}", fds[1]))
+            && output.write("piped", 5) && output.commit(),
+            "a pipe is written in place"
+        );
+    }
+
+    close(fds[1]);
+
+    char buf[16];
+    ssize_t nb = read(fds[0], buf, sizeof(buf));
+
+    check(
+        nb == 5 && std::string_view(buf, 5) == "piped",
+        "the pipe gets the output"
+    );
+
+    close(fds[0]);
+}
+
+void test_confinement(const std::filesystem::path &directory) {
+    // A confined instance loads no file outside its directory, whether it is
+    // named by an absolute path, by a path going up or by a symbolic link.
+
+    const std::filesystem::path root{directory / "root"};
+    const std::filesystem::path inside{root / "images" / "image-0.jpg"};
+    const std::filesystem::path outside{directory / "outside.jpg"};
+    const std::filesystem::path escape{root / "escape.jpg"};
+    const std::string md{
+        std::format(
+            "# Images\n\n![](images/image-0.jpg) ![](../outside.jpg) "
+            "![](escape.jpg) ![]({})\n", outside.string()
+        )
+    };
+    std::error_code ec;
+
+    std::filesystem::copy_file(inside, outside, ec);
+    std::filesystem::create_symlink("../outside.jpg", escape, ec);
+
+    for (bool confined : { true, false }) {
+        MDMA mdma;
+        std::string html;
+
+        mdma.cfg.preview  = 8;
+        mdma.cfg.confined = confined;
+        mdma.set_logger(confined ? [](const char *) {} : log_text);
+        mdma.set_directory(root);
+
+        check(assemble(mdma, md, html), "the images are assembled");
+
+        const std::set<std::filesystem::path> &files{mdma.get_local_files()};
+
+        check(files.count(inside), "a file inside the directory is loaded");
+        check(
+            files.count(outside) != confined,
+            confined ? (
+                "a confined instance loads no file outside the directory"
+            ) : "an instance loads a file outside the directory"
+        );
+        check(
+            files.count(escape) != confined,
+            confined ? (
+                "a confined instance follows no link out of the directory"
+            ) : "an instance follows a link out of the directory"
+        );
+    }
+}
+
+void test_cache(const std::filesystem::path &directory) {
+    // A section is cached under a key that covers the files it embeds and
+    // the configuration, so it is cached anew once either of them changes.
+
+    const std::filesystem::path root{directory / "root"};
+    const std::filesystem::path image{root / "images" / "image-0.jpg"};
+    const std::filesystem::path cache{directory / "cache"};
+    const std::string md{
+        "# One\n\n![](images/image-0.jpg)\n\n# Two\n\nText.\n"
+    };
+
+    const auto run{
+        [&](bool confined) {
+            MDMA mdma;
+            std::string html;
+
+            mdma.cfg.preview  = 8;
+            mdma.cfg.confined = confined;
+            mdma.set_logger(log_text);
+            mdma.set_directory(root);
+            mdma.set_cache_directory(cache);
+
+            return assemble(mdma, md, html);
+        }
+    };
+
+    const auto entries{
+        [&cache]() {
+            std::error_code ec;
+            size_t count = 0;
+
+            for (const auto &entry : std::filesystem::directory_iterator(
+                cache / "sections", ec
+            )) {
+                count += entry.path().extension() != ".tmp";
+            }
+
+            return count;
+        }
+    };
+
+    check(run(false) && entries() == 2, "every section is cached");
+    check(run(false) && entries() == 2, "the cached sections are recalled");
+
+    std::error_code ec;
+
+    std::filesystem::last_write_time(
+        image, std::filesystem::last_write_time(image, ec) +
+        std::chrono::hours(1), ec
+    );
+
+    check(
+        run(false) && entries() == 3,
+        "a section is cached anew once its image changes"
+    );
+    check(
+        run(true) && entries() == 5,
+        "the sections of a confined instance are cached apart"
+    );
+}
+
+std::string request(uint16_t port, const std::string &text) {
+    // The server may still be starting, so the connection is retried.
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int fd = -1;
+
+    for (int attempt = 0; attempt < 100 && fd == -1; ++attempt) {
+        fd = socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0);
+
+        if (fd != -1
+        &&  connect(fd, (const sockaddr *) &addr, sizeof(addr)) == -1) {
+            close(fd);
+            fd = -1;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    }
+
+    if (fd == -1) {
+        return {};
+    }
+
+    std::string response;
+    std::array<char, 4096> buf;
+    ssize_t nb;
+
+    for (size_t sent = 0; sent < text.size(); sent += size_t(nb)) {
+        if ((nb = send(
+            fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL
+        )) <= 0) {
+            break;
+        }
+    }
+
+    shutdown(fd, SHUT_WR);
+
+    while ((nb = recv(fd, buf.data(), buf.size(), 0)) > 0) {
+        response.append(buf.data(), size_t(nb));
+    }
+
+    close(fd);
+
+    return response;
+}
+
+void test_server(const std::filesystem::path &directory) {
+    // The server runs in a child process on a free port of the loopback
+    // interface. The malformed requests are refused before their body is
+    // read, so they are not assembled at all.
+
+    int probe = socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    sockaddr_in addr{};
+    socklen_t addr_len = sizeof(addr);
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (probe == -1
+    ||  bind(probe, (const sockaddr *) &addr, sizeof(addr)) == -1
+    ||  getsockname(probe, (sockaddr *) &addr, &addr_len) == -1) {
+        check(false, "a free port is found");
+        return;
+    }
+
+    close(probe);
+
+    const uint16_t port = ntohs(addr.sin_port);
+    const std::string host{std::format("Host: localhost:{}\r\n", port)};
+
+    pid_t pid = fork();
+
+    if (pid == -1) {
+        check(false, "the server is started");
+        return;
+    }
+
+    if (pid == 0) {
+        SERVER server(
+            std::to_string(port), 1, 1024,
+            [&directory](MDMA &mdma) {
+                mdma.cfg.minify   = true;
+                mdma.cfg.confined = true;
+                mdma.cfg.offline  = true;
+                mdma.set_directory(directory / "root");
+                mdma.set_compiled_framework(
+                    (const char *) default_template.data(),
+                    default_template.size()
+                );
+            },
+            [](const char *) {}
+        );
+
+        _exit(
+            server.run(
+                std::string_view(
+                    (const char *) default_framework.data(),
+                    default_framework.size()
+                )
+            ) ? EXIT_SUCCESS : EXIT_FAILURE
+        );
+    }
+
+    const std::string body{"# Served\n"};
+
+    check(
+        request(
+            port, "POST / HTTP/1.0\r\n" + host + std::format(
+                "Content-Length: {}\r\n\r\n{}", body.size(), body
+            )
+        ).starts_with("HTTP/1.0 200 "), "a request is served"
+    );
+    check(
+        request(port, "POST / HTTP/1.0\r\n" + host + "\r\n").starts_with(
+            "HTTP/1.0 411 "
+        ), "a request without a length is refused"
+    );
+    check(
+        request(
+            port, "POST / HTTP/1.0\r\n" + host + "Content-Length: 1025\r\n\r\n"
+        ).starts_with("HTTP/1.0 413 "), "a request too large is refused"
+    );
+    check(
+        request(
+            port, "POST / HTTP/1.0\r\nHost: example.com\r\n"
+            "Content-Length: 0\r\n\r\n"
+        ).starts_with("HTTP/1.0 421 "), "a request for another host is refused"
+    );
+
+    // The header is sent whole, so that the server has read all of it when
+    // it closes the connection, which would otherwise be reset.
+    check(
+        request(
+            port, "POST / HTTP/1.0\r\nX-Padding: " + std::string(16 * 1024, 'x')
+        ).starts_with("HTTP/1.0 431 "), "a header too large is refused"
+    );
+
+    kill(pid, SIGKILL);
+    while (waitpid(pid, nullptr, 0) == -1 && errno == EINTR);
+}
+
+std::string decode_text(std::string_view text) {
+    // Resolves the character references, so that the texts compare equal
+    // whether or not their characters were escaped.
+
+    std::string result;
+
+    for (size_t i=0; i<text.size();) {
+        size_t end = text.find(';', i);
+
+        if (text[i] != '&' || end == text.npos || end - i > 32) {
+            result.push_back(text[i++]);
+            continue;
+        }
+
+        std::string_view name{text.substr(i + 1, end - i - 1)};
+        std::string decoded;
+
+        if (name.size() > 1 && name.front() == '#') {
+            bool hex = name[1] == 'x' || name[1] == 'X';
+            std::string digits(name.substr(hex ? 2 : 1));
+            char *digits_end = nullptr;
+            unsigned long cp = strtoul(
+                digits.c_str(), &digits_end, hex ? 16 : 10
+            );
+
+            if (!digits.empty() && !*digits_end) {
+                if (!cp || cp >= 0x110000 || (cp >= 0xD800 && cp <= 0xDFFF)) {
+                    cp = 0xFFFD;
+                }
+
+                if (cp < 0x80) {
+                    decoded.push_back(char(cp));
+                }
+                else if (cp < 0x800) {
+                    decoded.push_back(char(0xC0 | (cp >> 6)));
+                    decoded.push_back(char(0x80 | (cp & 0x3F)));
+                }
+                else if (cp < 0x10000) {
+                    decoded.push_back(char(0xE0 | (cp >> 12)));
+                    decoded.push_back(char(0x80 | ((cp >> 6) & 0x3F)));
+                    decoded.push_back(char(0x80 | (cp & 0x3F)));
+                }
+                else {
+                    decoded.push_back(char(0xF0 | (cp >> 18)));
+                    decoded.push_back(char(0x80 | ((cp >> 12) & 0x3F)));
+                    decoded.push_back(char(0x80 | ((cp >> 6) & 0x3F)));
+                    decoded.push_back(char(0x80 | (cp & 0x3F)));
+                }
+            }
+        }
+        else decoded.assign(html_entity(name));
+
+        if (decoded.empty()) {
+            result.push_back(text[i++]);
+            continue;
+        }
+
+        result.append(decoded);
+        i = end + 1;
+    }
+
+    return result;
+}
+
+std::string collapse(std::string_view text) {
+    std::string result;
+
+    for (char c : decode_text(text)) {
+        if (!isspace((unsigned char) c)) {
+            result.push_back(c);
+        }
+        else if (!result.empty() && result.back() != ' ') {
+            result.push_back(' ');
+        }
+    }
+
+    if (!result.empty() && result.back() == ' ') {
+        result.pop_back();
+    }
+
+    return result;
+}
+
+std::vector<std::string> tokenize(std::string_view html) {
+    // Splits the HTML into its tags, with their attributes sorted, and the
+    // texts between them, with their whitespace collapsed. The comments, the
+    // tabs, the anchors and progress styles of the headings and the
+    // attributes that only the assembler adds are left out, and the alignment
+    // of the table cells is written the way the assembler writes it.
+
+    std::vector<std::string> tokens;
+    std::vector<bool> anchors; // whether each open link is left out
+    std::string text;
+
+    const auto flush_text{
+        [&]() {
+            std::string collapsed{collapse(text)};
+
+            if (!collapsed.empty()) {
+                tokens.emplace_back("\"" + collapsed + "\"");
+            }
+
+            text.clear();
+        }
+    };
+
+    for (size_t pos = 0; pos < html.size();) {
+        if (html[pos] != '<') {
+            size_t lt = std::min(html.find('<', pos), html.size());
+
+            text.append(html.substr(pos, lt - pos));
+            pos = lt;
+            continue;
+        }
+
+        if (html.substr(pos).starts_with("<!--")) {
+            size_t end = html.find("-->", pos + 4);
+
+            pos = end == html.npos ? html.size() : end + 3;
+            continue;
+        }
+
+        if (pos + 1 < html.size()
+        && (html[pos + 1] == '!' || html[pos + 1] == '?')) {
+            pos = std::min(html.find('>', pos), html.size() - 1) + 1;
+            continue;
+        }
+
+        size_t i = pos + 1;
+        bool closing = i < html.size() && html[i] == '/';
+        size_t name_start = i += closing;
+
+        while (i < html.size()
+        && (isalnum((unsigned char) html[i]) || html[i] == '-')) {
+            ++i;
+        }
+
+        if (i == name_start) {
+            text.push_back(html[pos++]);
+            continue;
+        }
+
+        std::string name(html.substr(name_start, i - name_start));
+        std::map<std::string, std::string> attributes;
+
+        for (char &c : name) {
+            c = char(tolower((unsigned char) c));
+        }
+
+        while (i < html.size() && html[i] != '>') {
+            if (isspace((unsigned char) html[i]) || html[i] == '/') {
+                ++i;
+                continue;
+            }
+
+            size_t attr_start = i;
+
+            while (i < html.size() && !isspace((unsigned char) html[i])
+            &&  html[i] != '=' && html[i] != '>' && html[i] != '/') {
+                ++i;
+            }
+
+            std::string attr(html.substr(attr_start, i - attr_start));
+            std::string_view value;
+
+            for (char &c : attr) {
+                c = char(tolower((unsigned char) c));
+            }
+
+            if (i < html.size() && html[i] == '=') {
+                size_t value_start = ++i;
+                size_t value_end;
+
+                if (i < html.size() && (html[i] == '"' || html[i] == '\'')) {
+                    value_end = std::min(
+                        html.find(html[i], ++value_start), html.size()
+                    );
+                    i = std::min(value_end + 1, html.size());
+                }
+                else {
+                    while (i < html.size() && !isspace((unsigned char) html[i])
+                    &&  html[i] != '>') {
+                        ++i;
+                    }
+
+                    value_end = i;
+                }
+
+                value = html.substr(value_start, value_end - value_start);
+            }
+
+            // The boolean attributes may be given their name as a value.
+            attributes[attr] = value == attr ? "" : collapse(value);
+        }
+
+        pos = std::min(i + 1, html.size());
+
+        if (!closing && (name == "script" || name == "style")) {
+            // The contents of the raw text elements are not markup.
+            std::string end_tag{"</" + name};
+            auto it{
+                std::search(
+                    html.begin() + long(pos), html.end(),
+                    end_tag.begin(), end_tag.end(),
+                    [](char a, char b) {
+                        return tolower((unsigned char) a) == b;
+                    }
+                )
+            };
+            size_t end = size_t(it - html.begin());
+            std::string_view contents{html.substr(pos, end - pos)};
+
+            pos = std::min(html.find('>', end), html.size() - 1) + 1;
+
+            if (attributes["class"] == "MDMA-AUTOGENERATED") {
+                continue;
+            }
+
+            flush_text();
+            tokens.emplace_back("<" + name + ">");
+            text.assign(contents);
+            flush_text();
+            tokens.emplace_back("</" + name + ">");
+
+            continue;
+        }
+
+        if (name == "article") {
+            continue;
+        }
+
+        if (name == "a" && !closing) {
+            anchors.emplace_back(attributes.contains("id"));
+
+            if (anchors.back()) continue;
+        }
+        else if (name == "a" && !anchors.empty()) {
+            bool anchor = anchors.back();
+
+            anchors.pop_back();
+
+            if (anchor) continue;
+        }
+
+        attributes.erase("target");
+        attributes.erase("loading");
+
+        if (attributes.contains("align")) {
+            attributes["style"] = "text-align: " + attributes["align"] + ";";
+            attributes.erase("align");
+        }
+
+        std::string token{closing ? "</" + name : "<" + name};
+
+        for (const auto &[attr, value] : attributes) {
+            token.append(" ").append(attr).append("=\"").append(value).append(
+                "\""
+            );
+        }
+
+        flush_text();
+        tokens.emplace_back(token.append(">"));
+    }
+
+    flush_text();
+
+    return tokens;
+}
+
+void test_render(const std::string &path) {
+    // The assembled sections are compared with the output of md_html, which
+    // rendered the markdown before the assembler did, from the first top
+    // level heading on, since the text before it is left out.
+
+    INPUT md;
+    MDMA mdma;
+    std::string html;
+    std::string expected;
+
+    mdma.cfg.github = true;
+    mdma.cfg.minify = true;
+    mdma.set_logger(log_text);
+
+    if (!md.load(path)) {
+        check(false, "a markdown document is loaded");
+        return;
+    }
+
+    check(assemble(mdma, md, html), "a markdown document is assembled");
+    check(
+        !md_html(
+            md.data(), MD_SIZE(md.size()),
+            [](const MD_CHAR *text, MD_SIZE size, void *userdata) {
+                static_cast<std::string *>(userdata)->append(text, size);
+            },
+            &expected, MD_DIALECT_GITHUB, MD_HTML_FLAG_XHTML
+        ), "a markdown document is rendered by md_html"
+    );
+
+    size_t first = html.find("<article class=\"tab\">");
+    size_t last = html.rfind("</article>");
+
+    std::vector<std::string> assembled{
+        tokenize(
+            first < last && last != html.npos ? (
+                std::string_view(html).substr(first, last - first)
+            ) : std::string_view{}
+        )
+    };
+    std::vector<std::string> rendered{
+        tokenize(
+            std::string_view(expected).substr(
+                std::min(expected.find("<h1>"), expected.size())
+            )
+        )
+    };
+
+    auto [it_rendered, it_assembled] = std::mismatch(
+        rendered.begin(), rendered.end(), assembled.begin(), assembled.end()
+    );
+
+    bool same{
+        it_rendered == rendered.end() && it_assembled == assembled.end()
+    };
+
+    if (!same) {
+        std::cerr << path << ": token " << (it_rendered - rendered.begin())
+                  << ": md_html has "
+                  << (it_rendered != rendered.end() ? *it_rendered : "none")
+                  << ", the assembler has "
+                  << (it_assembled != assembled.end() ? *it_assembled : "none")
+                  << "\n";
+    }
+
+    check(same, "a markdown document is rendered like md_html does");
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " FIXTURE [MARKDOWN]...\n";
+        return EXIT_FAILURE;
+    }
+
+    std::string directory_template{
+        (std::filesystem::temp_directory_path() / "mdma-test-XXXXXX").string()
+    };
+
+    if (!mkdtemp(directory_template.data())) {
+        std::cerr << directory_template << ": " << strerror(errno) << "\n";
+        return EXIT_FAILURE;
+    }
+
+    const std::filesystem::path directory{directory_template};
+    std::string md;
+
+    // The corpus provides an image to embed.
+    if (!CORPUS(
+        CORPUS::params_type{
+            .headings    = 1,
+            .depth       = 1,
+            .tables      = 0,
+            .code_blocks = 0,
+            .images      = 1,
+            .image_width = 64,
+            .videos      = 0,
+            .seed        = 1
+        }, log_text
+    ).generate(directory / "root", md)) {
+        std::error_code ec;
+        std::filesystem::remove_all(directory, ec);
+        return EXIT_FAILURE;
+    }
+
+    test_fixture(argv[1]);
+    test_input(directory);
+    test_output(directory);
+    test_confinement(directory);
+    test_cache(directory);
+    test_server(directory);
+
+    for (int i=2; i<argc; ++i) {
+        test_render(argv[i]);
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all(directory, ec);
+
+    if (failures) {
+        std::cerr << failures << " check" << (failures == 1 ? "" : "s")
+                  << " failed.\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "All checks passed.\n";
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: MIT
+#ifndef WATCHER_H_16_10_2026
+#define WATCHER_H_16_10_2026
+
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <filesystem>
+#include <functional>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <array>
+#include <map>
+#include <set>
+#include <cstring>
+#include <cerrno>
+
+class WATCHER {
+    // Waits for any of the given files to change. The directories of the
+    // files are watched instead of the files themselves, because editors
+    // tend to save by renaming a new file over the old one.
+
+    public:
+    WATCHER(const std::function<void(const char *text)> &log_callback)
+        : fd(inotify_init1(IN_CLOEXEC))
+        , directories()
+        , files()
+        , log_callback(log_callback) {
+        if (fd == -1) {
+            log("inotify_init1", strerror(errno));
+        }
+    }
+
+    WATCHER() = delete;
+    WATCHER(const WATCHER &) = delete;
+    WATCHER &operator=(const WATCHER &) = delete;
+
+    ~WATCHER() {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+
+    bool watch(const std::vector<std::filesystem::path> &);
+    size_t wait(
+        std::chrono::milliseconds debounce,
+        std::chrono::steady_clock::time_point &first_change
+    );
+
+    private:
+    static constexpr uint32_t EVENTS{
+        IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM
+    };
+
+    bool read_events(std::set<std::filesystem::path> &changed);
+
+    void log(const char *subject, const char *text) const {
+        if (log_callback) {
+            std::string line{subject};
+            log_callback(line.append(": ").append(text).c_str());
+        }
+    }
+
+    int fd;
+    std::map<int, std::filesystem::path> directories;
+    std::set<std::filesystem::path> files;
+    std::function<void(const char *text)> log_callback;
+};
+
+inline bool WATCHER::watch(const std::vector<std::filesystem::path> &paths) {
+    if (fd == -1) {
+        return false;
+    }
+
+    std::set<std::filesystem::path> dirs;
+
+    files.clear();
+
+    for (const std::filesystem::path &path : paths) {
+        // A symbolic link is watched along with the file that it points to,
+        // since either of them may be replaced.
+        std::error_code ec;
+        std::filesystem::path file{
+            std::filesystem::absolute(path).lexically_normal()
+        };
+        std::filesystem::path target{
+            std::filesystem::weakly_canonical(file, ec)
+        };
+
+        if (!ec && target != file) {
+            dirs.emplace(target.parent_path());
+            files.emplace(std::move(target));
+        }
+
+        dirs.emplace(file.parent_path());
+        files.emplace(std::move(file));
+    }
+
+    for (auto it = directories.begin(); it != directories.end();) {
+        if (dirs.erase(it->second)) {
+            ++it;
+            continue;
+        }
+
+        inotify_rm_watch(fd, it->first);
+        it = directories.erase(it);
+    }
+
+    for (const std::filesystem::path &dir : dirs) {
+        int wd = inotify_add_watch(fd, dir.c_str(), EVENTS);
+
+        if (wd == -1) {
+            log(dir.c_str(), strerror(errno));
+            continue;
+        }
+
+        directories[wd] = dir;
+    }
+
+    return true;
+}
+
+inline size_t WATCHER::wait(
+    std::chrono::milliseconds debounce,
+    std::chrono::steady_clock::time_point &first_change
+) {
+    // After the first change the events are collected until the files have
+    // been left alone for the debounce period, so that a burst of writes
+    // causes only one rebuild.
+
+    std::set<std::filesystem::path> changed;
+    pollfd pfd{ .fd = fd, .events = POLLIN, .revents = 0 };
+
+    while (fd != -1) {
+        int timeout = changed.empty() ? -1 : int(debounce.count());
+        int ready = poll(&pfd, 1, timeout);
+
+        if (ready == -1) {
+            if (errno == EINTR) continue;
+
+            log("poll", strerror(errno));
+            break;
+        }
+
+        if (ready == 0) {
+            break;
+        }
+
+        bool was_empty = changed.empty();
+
+        if (!read_events(changed)) {
+            break;
+        }
+
+        if (was_empty && !changed.empty()) {
+            first_change = std::chrono::steady_clock::now();
+        }
+    }
+
+    return changed.size();
+}
+
+inline bool WATCHER::read_events(std::set<std::filesystem::path> &changed) {
+    // Returns false if the events can no longer be read.
+
+    alignas(inotify_event) std::array<char, 16 * 1024> buf;
+    ssize_t len = read(fd, buf.data(), buf.size());
+
+    if (len == -1) {
+        if (errno == EINTR || errno == EAGAIN) {
+            return true;
+        }
+
+        log("read", strerror(errno));
+        return false;
+    }
+
+    for (ssize_t i = 0; i < len;) {
+        const inotify_event *event{
+            reinterpret_cast<const inotify_event *>(buf.data() + i)
+        };
+
+        i += ssize_t(sizeof(inotify_event) + event->len);
+
+        auto dir = directories.find(event->wd);
+
+        if (dir == directories.end() || !event->len) {
+            continue;
+        }
+
+        std::filesystem::path file{dir->second / event->name};
+
+        if (files.count(file)) {
+            changed.emplace(std::move(file));
+        }
+    }
+
+    return true;
+}
+
+#endif